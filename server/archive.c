@@ -0,0 +1,373 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <threads.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "archive.h"
+#include "game_table.h"
+
+#define ARCHIVE_FILE "games.archive"
+#define INDEX_FILE "games.index"
+#define MAX_PATH_LENGTH 4096
+// every record starts with the length of the rest of it
+#define RECORD_HEADER 4
+
+static char directory[MAX_PATH_LENGTH - 64];
+static int archiveFd = -1;
+static int indexFd = -1;
+// where the last completely written batch ends in each file, everything past it is rewritten
+static uint64_t archiveLength = 0;
+static uint64_t indexLength = 0;
+// set while batches keep failing, so a full disk is reported once rather than every flush
+static bool failing = false;
+static atomic_bool stopping = false;
+static bool running = false;
+static thrd_t writerThread;
+// only touched by the writer thread once it runs
+static ByteBuffer batch = {nullptr, 0, 0};
+static ByteBuffer indexBatch = {nullptr, 0, 0};
+
+static int open_file(const char* dir, const char* name, int flags);
+
+static bool write_all(int fd, const char* data, size_t length, uint64_t offset);
+
+static bool read_all(int fd, void* data, size_t length, uint64_t offset);
+
+static void flush_batch();
+
+static bool write_batch();
+
+static int run_writer(void* arg);
+
+static bool decode_game(const uint8_t* data, size_t length, ArchivedGame* game);
+
+static bool build_lookup(ArchiveReader* reader);
+
+int open_file(const char* dir, const char* name, int flags) {
+    char path[MAX_PATH_LENGTH];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    return open(path, flags | O_CLOEXEC, 0644);
+}
+
+bool write_all(int fd, const char* data, size_t length, uint64_t offset) {
+    // positioned writes, a batch that failed halfway is simply written over by its retry
+    while (length > 0) {
+        ssize_t written = pwrite(fd, data, length, (off_t) offset);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += written;
+        length -= written;
+        offset += written;
+    }
+    return true;
+}
+
+bool read_all(int fd, void* data, size_t length, uint64_t offset) {
+    return pread(fd, data, length, (off_t) offset) == (ssize_t) length;
+}
+
+bool archive_open(const char* path) {
+    if (strlen(path) >= sizeof(directory)) {
+        printf("archive directory name is too long\n");
+        return false;
+    }
+    strcpy(directory, path);
+    if (mkdir(directory, 0755) < 0 && errno != EEXIST) {
+        perror("cannot create the archive directory");
+        return false;
+    }
+
+    archiveFd = open_file(directory, ARCHIVE_FILE, O_RDWR | O_CREAT);
+    indexFd = open_file(directory, INDEX_FILE, O_RDWR | O_CREAT);
+    struct stat st;
+    if (archiveFd < 0 || indexFd < 0 || fstat(indexFd, &st) < 0) {
+        perror("cannot open the archive");
+        return false;
+    }
+
+    // a crash can leave half an index entry, and records behind the last one the index reaches
+    uint64_t count = (uint64_t) st.st_size / sizeof(ArchiveIndexEntry);
+    archiveLength = 0;
+    if (count > 0) {
+        ArchiveIndexEntry last;
+        uint8_t header[RECORD_HEADER];
+        if (!read_all(indexFd, &last, sizeof(last), (count - 1) * sizeof(ArchiveIndexEntry)) ||
+            !read_all(archiveFd, header, sizeof(header), last.offset)) {
+            printf("archive in %s does not match its index\n", directory);
+            return false;
+        }
+        archiveLength = last.offset + RECORD_HEADER +
+                        (header[0] | header[1] << 8 | header[2] << 16 | (uint64_t) header[3] << 24);
+    }
+    indexLength = count * sizeof(ArchiveIndexEntry);
+    failing = false;
+    if (ftruncate(indexFd, (off_t) indexLength) < 0 || ftruncate(archiveFd, (off_t) archiveLength) < 0) {
+        perror("cannot truncate the archive");
+        return false;
+    }
+    printf("Archive holds %llu games\n", (unsigned long long) count);
+
+    enable_game_archive();
+    atomic_store(&stopping, false);
+    if (thrd_create(&writerThread, run_writer, nullptr) != thrd_success) {
+        printf("failed to start the archive writer\n");
+        return false;
+    }
+    running = true;
+    return true;
+}
+
+void archive_close() {
+    if (!running)
+        return;
+    atomic_store(&stopping, true);
+    thrd_join(writerThread, nullptr);
+    running = false;
+    close(archiveFd);
+    close(indexFd);
+    archiveFd = -1;
+    indexFd = -1;
+    byte_buffer_free(&batch);
+    byte_buffer_free(&indexBatch);
+}
+
+void archive_append(ByteBuffer* out, const GameStatus* gameStatus) {
+    size_t id_length = strlen(gameStatus->gameId);
+    size_t length = 1 + id_length + 2 * 6 + 1 + 8 + 2 + 2 * (size_t) gameStatus->moveCount;
+    byte_buffer_reserve(out, RECORD_HEADER + length);
+    uint8_t* at = (uint8_t*) out->data + out->length;
+    uint8_t* start = at;
+
+    // little endian throughout, the record length first so the writer can walk a batch
+    at += RECORD_HEADER;
+    *at++ = (uint8_t) id_length;
+    memcpy(at, gameStatus->gameId, id_length);
+    at += id_length;
+    for (int color = 0; color < 2; color++) {
+        const Player* p = gameStatus->players[color];
+        size_t player_length = p != nullptr ? strlen(p->playerId) : 0;
+        *at++ = (uint8_t) player_length;
+        if (player_length > 0)
+            memcpy(at, p->playerId, player_length);
+        at += player_length;
+    }
+    *at++ = (uint8_t) gameStatus->winner;
+    uint64_t now = (uint64_t) time(NULL);
+    for (int i = 0; i < 8; i++)
+        *at++ = (uint8_t) (now >> (8 * i));
+    *at++ = (uint8_t) gameStatus->moveCount;
+    *at++ = (uint8_t) (gameStatus->moveCount >> 8);
+    // the hashes and versions beside each move only serve the live game, the move alone replays it
+    for (int i = 0; i < gameStatus->moveCount; i++) {
+        *at++ = (uint8_t) gameStatus->moves[i].move;
+        *at++ = (uint8_t) (gameStatus->moves[i].move >> 8);
+    }
+
+    size_t record_length = (size_t) (at - start) - RECORD_HEADER;
+    for (int i = 0; i < RECORD_HEADER; i++)
+        start[i] = (uint8_t) (record_length >> (8 * i));
+    out->length += at - start;
+}
+
+void flush_batch() {
+    // a batch that could not be written stays and goes out again with the games archived since
+    collect_game_archive(&batch);
+    if (batch.length == 0)
+        return;
+
+    if (write_batch()) {
+        if (failing)
+            printf("Archive writes succeed again\n");
+        failing = false;
+        batch.length = 0;
+        return;
+    }
+    if (!failing)
+        perror("archive write has failed, the games are kept until it succeeds");
+    failing = true;
+    // cut off whatever part of the batch got through, a crash must not find index entries past the records
+    if (ftruncate(archiveFd, (off_t) archiveLength) < 0 || ftruncate(indexFd, (off_t) indexLength) < 0)
+        perror("cannot truncate the archive");
+}
+
+bool write_batch() {
+    indexBatch.length = 0;
+    for (size_t at = 0; at < batch.length;) {
+        const uint8_t* record = (const uint8_t*) batch.data + at;
+        size_t record_length = record[0] | record[1] << 8 | record[2] << 16 | (size_t) record[3] << 24;
+        ArchiveIndexEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.offset = archiveLength + at;
+        memcpy(entry.gameId, record + RECORD_HEADER + 1, record[RECORD_HEADER]);
+        byte_buffer_append(&indexBatch, (const char*) &entry, sizeof(entry));
+        at += RECORD_HEADER + record_length;
+    }
+
+    // records first, an index entry must never point past the end of the archive
+    if (!write_all(archiveFd, batch.data, batch.length, archiveLength) ||
+        !write_all(indexFd, indexBatch.data, indexBatch.length, indexLength))
+        return false;
+    archiveLength += batch.length;
+    indexLength += indexBatch.length;
+    return true;
+}
+
+int run_writer(void* arg) {
+    (void) arg;
+    struct timespec interval = {.tv_sec = 0, .tv_nsec = ARCHIVE_FLUSH_INTERVAL_MS * 1000000L};
+    while (!atomic_load(&stopping)) {
+        thrd_sleep(&interval, nullptr);
+        flush_batch();
+    }
+    flush_batch();
+    if (batch.length > 0)
+        printf("%zu bytes of archived games could not be written\n", batch.length);
+    if (fdatasync(archiveFd) < 0 || fdatasync(indexFd) < 0)
+        perror("archive fdatasync has failed");
+    return 0;
+}
+
+bool archive_reader_open(ArchiveReader* reader, const char* path) {
+    reader->archiveFd = open_file(path, ARCHIVE_FILE, O_RDONLY);
+    int index_fd = open_file(path, INDEX_FILE, O_RDONLY);
+    struct stat st;
+    if (reader->archiveFd < 0 || index_fd < 0 || fstat(index_fd, &st) < 0) {
+        perror("cannot open the archive");
+        if (reader->archiveFd >= 0)
+            close(reader->archiveFd);
+        if (index_fd >= 0)
+            close(index_fd);
+        return false;
+    }
+
+    reader->count = (uint64_t) st.st_size / sizeof(ArchiveIndexEntry);
+    reader->index = nullptr;
+    if (reader->count > 0) {
+        void* index = mmap(nullptr, reader->count * sizeof(ArchiveIndexEntry), PROT_READ, MAP_PRIVATE, index_fd, 0);
+        if (index == MAP_FAILED) {
+            perror("mmap has failed");
+            close(index_fd);
+            close(reader->archiveFd);
+            return false;
+        }
+        reader->index = index;
+    }
+    close(index_fd);
+    if (!build_lookup(reader)) {
+        archive_reader_close(reader);
+        return false;
+    }
+    return true;
+}
+
+bool build_lookup(ArchiveReader* reader) {
+    // at most half full, so a probe for a missing id ends at an empty slot soon
+    size_t capacity = 16;
+    while (capacity < 2 * reader->count)
+        capacity *= 2;
+    reader->lookup = calloc(capacity, sizeof(uint64_t));
+    reader->lookupMask = capacity - 1;
+    if (reader->lookup == nullptr) {
+        perror("cannot allocate the archive lookup");
+        return false;
+    }
+
+    // oldest first, a reused id ends up pointing at its newest game
+    for (uint64_t i = 0; i < reader->count; i++) {
+        char game_id[MAX_GAME_ID_LENGTH + 1];
+        memcpy(game_id, reader->index[i].gameId, MAX_GAME_ID_LENGTH);
+        game_id[MAX_GAME_ID_LENGTH] = '\0';
+        size_t slot = hash_game_id(game_id) & reader->lookupMask;
+        while (reader->lookup[slot] != 0 &&
+               strncmp(reader->index[reader->lookup[slot] - 1].gameId, game_id, MAX_GAME_ID_LENGTH) != 0)
+            slot = (slot + 1) & reader->lookupMask;
+        reader->lookup[slot] = i + 1;
+    }
+    return true;
+}
+
+void archive_reader_close(ArchiveReader* reader) {
+    if (reader->index != nullptr)
+        munmap((void*) reader->index, reader->count * sizeof(ArchiveIndexEntry));
+    free(reader->lookup);
+    reader->lookup = nullptr;
+    close(reader->archiveFd);
+}
+
+bool archive_read_game(ArchiveReader* reader, uint64_t number, ArchivedGame* game) {
+    if (number >= reader->count)
+        return false;
+
+    // two reads at the offset the index gives, nothing else of the archive is touched
+    uint64_t offset = reader->index[number].offset;
+    uint8_t header[RECORD_HEADER];
+    if (!read_all(reader->archiveFd, header, sizeof(header), offset))
+        return false;
+    size_t length = header[0] | header[1] << 8 | header[2] << 16 | (size_t) header[3] << 24;
+    uint8_t* record = malloc(length);
+    bool valid = read_all(reader->archiveFd, record, length, offset + RECORD_HEADER) &&
+                 decode_game(record, length, game);
+    free(record);
+    if (!valid) {
+        printf("archived game %llu is damaged\n", (unsigned long long) number);
+        return false;
+    }
+    game->number = number;
+    return true;
+}
+
+bool archive_find_game(ArchiveReader* reader, const char* gameId, ArchivedGame* game) {
+    if (strlen(gameId) > MAX_GAME_ID_LENGTH)
+        return false;
+    for (size_t slot = hash_game_id(gameId) & reader->lookupMask; reader->lookup[slot] != 0;
+         slot = (slot + 1) & reader->lookupMask) {
+        uint64_t number = reader->lookup[slot] - 1;
+        if (strncmp(reader->index[number].gameId, gameId, MAX_GAME_ID_LENGTH + 1) == 0)
+            return archive_read_game(reader, number, game);
+    }
+    return false;
+}
+
+bool decode_game(const uint8_t* data, size_t length, ArchivedGame* game) {
+    size_t at = 0;
+    char* strings[3] = {game->gameId, game->playerIds[0], game->playerIds[1]};
+    size_t sizes[3] = {sizeof(game->gameId), sizeof(game->playerIds[0]), sizeof(game->playerIds[1])};
+    for (int i = 0; i < 3; i++) {
+        if (at >= length || data[at] >= sizes[i] || length - at - 1 < data[at])
+            return false;
+        memcpy(strings[i], data + at + 1, data[at]);
+        strings[i][data[at]] = '\0';
+        at += 1 + data[at];
+    }
+    if (length - at < 1 + 8 + 2)
+        return false;
+
+    game->winner = (int8_t) data[at++];
+    uint64_t finished = 0;
+    for (int i = 0; i < 8; i++)
+        finished |= (uint64_t) data[at++] << (8 * i);
+    game->finishedAt = (int64_t) finished;
+    game->moveCount = data[at] | data[at + 1] << 8;
+    at += 2;
+    if (length - at != 2 * (size_t) game->moveCount)
+        return false;
+
+    game->moves = malloc(sizeof(Move) * (game->moveCount > 0 ? game->moveCount : 1));
+    for (int i = 0; i < game->moveCount; i++, at += 2)
+        game->moves[i] = (Move) (data[at] | data[at + 1] << 8);
+    return true;
+}
+
+void archive_game_free(ArchivedGame* game) {
+    free(game->moves);
+    game->moves = nullptr;
+}
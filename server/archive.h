@@ -0,0 +1,73 @@
+#ifndef SERVER_ARCHIVE_H
+#define SERVER_ARCHIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "game.h"
+#include "json_writer.h"
+
+// the writer thread appends whatever the shards archived this often
+#define ARCHIVE_FLUSH_INTERVAL_MS 100
+
+// where a game starts in the archive file, one per game in archive order
+typedef struct {
+    uint64_t offset;
+    char gameId[MAX_GAME_ID_LENGTH + 1];
+} ArchiveIndexEntry;
+
+typedef struct {
+    // position in the archive, counted from 0, the index entry it is found by
+    uint64_t number;
+    char gameId[MAX_GAME_ID_LENGTH + 1];
+    char playerIds[2][6];
+    // -1 for a game freed before it ended
+    int winner;
+    // unix time the game left memory
+    int64_t finishedAt;
+    int moveCount;
+    Move* moves;
+} ArchivedGame;
+
+typedef struct {
+    int archiveFd;
+    const ArchiveIndexEntry* index;
+    uint64_t count;
+    // built when the reader opens: open addressing on the id hash, one slot per id holding
+    // the number of its newest game plus one, 0 for an empty slot
+    uint64_t* lookup;
+    size_t lookupMask;
+} ArchiveReader;
+
+/*
+ * Finished games are kept in an append-only archive in their own directory:
+ * games.archive holds one record per game, the moves at two bytes each after
+ * the ids, the result and the time, and games.index one fixed-size entry per
+ * record with its offset and game id. free_game encodes the record into its
+ * shard while the lock is held, a writer thread collects the shards every
+ * flush interval and appends the batch, the index entries only after the
+ * records they point at. A record the index does not reach was torn by a
+ * crash and is cut off on the next start.
+ */
+
+// starts the writer thread, false if the files in directory cannot be used
+bool archive_open(const char* directory);
+
+// writes out everything archived so far and stops the writer thread
+void archive_close();
+
+// encodes a game into a shard's pending archive
+void archive_append(ByteBuffer* out, const GameStatus* gameStatus);
+
+bool archive_reader_open(ArchiveReader* reader, const char* directory);
+
+void archive_reader_close(ArchiveReader* reader);
+
+// reads the game stored under number, the moves are allocated and freed with archive_game_free
+bool archive_read_game(ArchiveReader* reader, uint64_t number, ArchivedGame* game);
+
+// the most recent game archived under gameId, ids are reused once a game is freed
+bool archive_find_game(ArchiveReader* reader, const char* gameId, ArchivedGame* game);
+
+void archive_game_free(ArchivedGame* game);
+
+#endif //SERVER_ARCHIVE_H
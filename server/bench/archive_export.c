@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include "../archive.h"
+#include "../movegen.h"
+#include "../san.h"
+
+// movetext lines are wrapped before this many columns
+#define LINE_WIDTH 80
+
+/*
+ * Writes archived games to standard output as PGN, every game in archive
+ * order, or a single one picked by its archive number (-n) or game id (-g)
+ * through the index. Moves are turned back into SAN by replaying them from
+ * the initial position, so the output can be checked with pgn_replay.
+ */
+
+static const char* result_of(int winner) {
+    switch (winner) {
+        case WHITE:
+            return "1-0";
+        case BLACK:
+            return "0-1";
+        case DRAW:
+            return "1/2-1/2";
+        default:
+            return "*";
+    }
+}
+
+static void write_token(const char* token, int* column) {
+    int length = (int) strlen(token);
+    if (*column > 0 && *column + 1 + length > LINE_WIDTH) {
+        putchar('\n');
+        *column = 0;
+    }
+    if (*column > 0) {
+        putchar(' ');
+        (*column)++;
+    }
+    fputs(token, stdout);
+    *column += length;
+}
+
+static bool export_game(const ArchivedGame* game) {
+    char date[16] = "????.??.??";
+    time_t finished = (time_t) game->finishedAt;
+    struct tm day;
+    if (gmtime_r(&finished, &day) != nullptr)
+        strftime(date, sizeof(date), "%Y.%m.%d", &day);
+
+    const char* result = result_of(game->winner);
+    printf("[Event \"Online game\"]\n[Site \"?\"]\n[Date \"%s\"]\n[Round \"-\"]\n", date);
+    printf("[White \"%s\"]\n[Black \"%s\"]\n[Result \"%s\"]\n", game->playerIds[0][0] ? game->playerIds[0] : "?",
+           game->playerIds[1][0] ? game->playerIds[1] : "?", result);
+    printf("[GameId \"%s\"]\n[ArchiveNumber \"%llu\"]\n\n", game->gameId, (unsigned long long) game->number);
+
+    Position position;
+    position_init(&position);
+    int column = 0;
+    bool valid = true;
+    for (int i = 0; i < game->moveCount; i++) {
+        Move move = game->moves[i];
+        // the archive only holds moves the server accepted, anything else means a damaged record
+        int promotion = IS_PROMOTION(move) ? PROMOTION_PIECE(move) : QUEEN;
+        if (find_legal_move(&position, MOVE_FROM(move), MOVE_TO(move), promotion) != move) {
+            fprintf(stderr, "game %s: archived move %d is not legal, the rest is left out\n", game->gameId, i + 1);
+            valid = false;
+            break;
+        }
+        char token[SAN_MAX_LENGTH + 8];
+        if (i % 2 == 0) {
+            snprintf(token, sizeof(token), "%d.", i / 2 + 1);
+            write_token(token, &column);
+        }
+        san_format(&position, move, token);
+        write_token(token, &column);
+
+        UndoInfo undo;
+        make_move(&position, move, &undo);
+    }
+    write_token(result, &column);
+    printf("\n\n");
+    return valid;
+}
+
+static bool export_one(ArchivedGame* game) {
+    bool valid = export_game(game);
+    archive_game_free(game);
+    return valid;
+}
+
+int main(int argc, char** argv) {
+    const char* game_id = nullptr;
+    long long number = -1;
+    int option;
+    while ((option = getopt(argc, argv, "n:g:")) != -1) {
+        switch (option) {
+            case 'n':
+                number = strtoll(optarg, NULL, 10);
+                break;
+            case 'g':
+                game_id = optarg;
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-n number | -g game id] archive directory\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "usage: %s [-n number | -g game id] archive directory\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    bitboard_init();
+    ArchiveReader reader;
+    if (!archive_reader_open(&reader, argv[optind]))
+        return EXIT_FAILURE;
+
+    ArchivedGame game;
+    bool ok = true;
+    if (game_id != nullptr) {
+        ok = archive_find_game(&reader, game_id, &game);
+        if (ok)
+            ok = export_one(&game);
+        else
+            fprintf(stderr, "no archived game with id %s\n", game_id);
+    } else if (number >= 0) {
+        ok = archive_read_game(&reader, (uint64_t) number, &game);
+        if (ok)
+            ok = export_one(&game);
+        else
+            fprintf(stderr, "no archived game number %lld\n", number);
+    } else {
+        for (uint64_t i = 0; i < reader.count; i++)
+            ok &= archive_read_game(&reader, i, &game) && export_one(&game);
+    }
+
+    archive_reader_close(&reader);
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,119 @@
+#ifndef SERVER_BENCH_H
+#define SERVER_BENCH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+static inline uint64_t bench_now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// xorshift64*, deterministic so runs are comparable
+static inline uint64_t bench_random(uint64_t* state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 0x2545F4914F6CDD1DULL;
+}
+
+// keeps the optimizer from discarding results that are otherwise unused
+static inline void bench_do_not_optimize(const void* p) {
+    __asm__ volatile("" : : "g"(p) : "memory");
+}
+
+#define BENCH_BATCHES 9
+// long enough that timer resolution and loop overhead vanish, short enough for a quick suite
+#define BENCH_BATCH_NS 20000000ULL
+
+// runs the operation iterations times, the loop lives inside so no call is timed per iteration
+typedef void (*BenchOp)(void* arg, uint64_t iterations);
+
+typedef struct {
+    double nsPerOp;
+    // interquartile range of the batches relative to the median
+    double spread;
+} BenchResult;
+
+static inline int bench_compare_doubles(const void* a, const void* b) {
+    double x = *(const double*) a;
+    double y = *(const double*) b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Sizes a batch to about BENCH_BATCH_NS, then times BENCH_BATCHES of them and
+ * reports the median. A batch that caught an interrupt or a migration lands at
+ * the top and does not move the median, so repeated runs agree closely.
+ */
+static inline BenchResult bench_measure(BenchOp op, void* arg) {
+    uint64_t iterations = 1;
+    for (;;) {
+        uint64_t start = bench_now_ns();
+        op(arg, iterations);
+        uint64_t elapsed = bench_now_ns() - start;
+        if (elapsed >= BENCH_BATCH_NS / 4) {
+            iterations = iterations * BENCH_BATCH_NS / (elapsed > 0 ? elapsed : 1) + 1;
+            break;
+        }
+        iterations *= 4;
+    }
+
+    double batches[BENCH_BATCHES];
+    for (int i = 0; i < BENCH_BATCHES; i++) {
+        uint64_t start = bench_now_ns();
+        op(arg, iterations);
+        batches[i] = (double) (bench_now_ns() - start) / (double) iterations;
+    }
+    qsort(batches, BENCH_BATCHES, sizeof(double), bench_compare_doubles);
+
+    double median = batches[BENCH_BATCHES / 2];
+    double spread = (batches[BENCH_BATCHES * 3 / 4] - batches[BENCH_BATCHES / 4]) / median;
+    return (BenchResult) {median, spread};
+}
+
+/*
+ * Defining BENCH_COUNT_ALLOCATIONS before including this header counts heap
+ * allocations by interposing glibc's malloc family. That does not work under
+ * AddressSanitizer, so sanitized builds leave COUNT_ALLOCATIONS undefined.
+ */
+#if defined(BENCH_COUNT_ALLOCATIONS) && !defined(__SANITIZE_ADDRESS__)
+#define COUNT_ALLOCATIONS 1
+#include <stddef.h>
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void* __libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void* ptr);
+
+static size_t allocations = 0;
+
+void* malloc(size_t size) {
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+    allocations++;
+    return __libc_realloc(ptr, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    allocations++;
+    return __libc_memalign(alignment, size);
+}
+
+void free(void* ptr) {
+    __libc_free(ptr);
+}
+#endif
+
+#endif //SERVER_BENCH_H
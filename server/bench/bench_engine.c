@@ -0,0 +1,120 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <threads.h>
+#include "../engine.h"
+#include "bench.h"
+
+#define MAX_THREADS 64
+#define TABLE_BYTES (32 << 20)
+
+typedef struct {
+    const char* name;
+    const char* fen;
+    // expected best move as from and to squares, -1 when any move will do
+    int from;
+    int to;
+} EngineCase;
+
+typedef struct {
+    uint64_t budgetNs;
+    uint64_t nodes;
+    int depths;
+    int failures;
+} Worker;
+
+/*
+ * Searches a few positions for a fixed time each and prints the depth reached
+ * and the nodes per second. The tactical cases have a single right answer, a
+ * wrong move there means the search or the evaluation broke. With more than
+ * one thread every thread runs the whole set at once, sharing the
+ * transposition table the way concurrent computer games do on the server.
+ */
+static const EngineCase cases[] = {
+        {"startpos",  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1", -1, -1},
+        {"kiwipete",  "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1", -1, -1},
+        {"middlegame", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10", -1, -1},
+        // Qxf7#
+        {"mate1",     "r1bqkb1r/pppp1ppp/2n2n2/4p2Q/2B1P3/8/PPPP1PPP/RNB1K1NR w KQkq - 4 4", 39, 53},
+        // Re8#, the back rank
+        {"backrank",  "6k1/5ppp/8/8/8/8/r4PPP/4RRK1 w - - 0 1", 4, 60},
+        // Rxd5, the only capture and the only move that is not a draw
+        {"hanging",   "4k3/8/8/3q4/8/8/8/3RK3 w - - 0 1", 3, 35},
+};
+
+#define CASE_COUNT (int) (sizeof(cases) / sizeof(cases[0]))
+
+static int run_cases(void* arg) {
+    Worker* worker = arg;
+    for (int i = 0; i < CASE_COUNT; i++) {
+        Position pos;
+        if (!position_from_fen(&pos, cases[i].fen)) {
+            worker->failures++;
+            continue;
+        }
+        SearchResult result = engine_search(&pos, nullptr, 0, worker->budgetNs);
+        worker->nodes += result.nodes;
+        worker->depths += result.depth;
+        if (cases[i].from >= 0 && (MOVE_FROM(result.best) != cases[i].from || MOVE_TO(result.best) != cases[i].to))
+            worker->failures++;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    int budget_ms = argc > 1 ? atoi(argv[1]) : 500;
+    int thread_count = argc > 2 ? atoi(argv[2]) : 1;
+    if (budget_ms <= 0)
+        budget_ms = 500;
+    if (thread_count < 1 || thread_count > MAX_THREADS)
+        thread_count = 1;
+    uint64_t budget = (uint64_t) budget_ms * 1000000ULL;
+    int failures = 0;
+
+    bitboard_init();
+    engine_init(TABLE_BYTES);
+
+    printf("%-10s %5s %12s %10s %8s %14s %s\n", "position", "depth", "nodes", "ms", "score", "nodes/s", "");
+
+    for (int i = 0; i < CASE_COUNT; i++) {
+        Position pos;
+        if (!position_from_fen(&pos, cases[i].fen)) {
+            printf("%-10s invalid fen\n", cases[i].name);
+            failures++;
+            continue;
+        }
+
+        SearchResult result = engine_search(&pos, nullptr, 0, budget);
+        bool ok = cases[i].from < 0 ||
+                  (MOVE_FROM(result.best) == cases[i].from && MOVE_TO(result.best) == cases[i].to);
+        if (!ok)
+            failures++;
+
+        printf("%-10s %5d %12lu %10.1f %8d %14.0f %s\n", cases[i].name, result.depth, result.nodes,
+               (double) result.elapsedNs / 1e6, result.score,
+               (double) result.nodes * 1e9 / (double) (result.elapsedNs ? result.elapsedNs : 1), ok ? "ok" : "FAIL");
+    }
+
+    if (thread_count > 1) {
+        Worker workers[MAX_THREADS] = {};
+        thrd_t threads[MAX_THREADS];
+        uint64_t start = bench_now_ns();
+        for (int i = 0; i < thread_count; i++) {
+            workers[i].budgetNs = budget;
+            thrd_create(&threads[i], run_cases, &workers[i]);
+        }
+        uint64_t nodes = 0;
+        int depths = 0;
+        for (int i = 0; i < thread_count; i++) {
+            thrd_join(threads[i], nullptr);
+            nodes += workers[i].nodes;
+            depths += workers[i].depths;
+            failures += workers[i].failures;
+        }
+        uint64_t elapsed = bench_now_ns() - start;
+        printf("%d threads: %lu nodes, %.0f nodes/s, mean depth %.1f\n", thread_count, nodes,
+               (double) nodes * 1e9 / (double) (elapsed ? elapsed : 1), (double) depths / (thread_count * CASE_COUNT));
+    }
+
+    printf("%d failures\n", failures);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
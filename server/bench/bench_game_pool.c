@@ -0,0 +1,159 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <malloc.h>
+#include "../game.h"
+#include "../slab.h"
+#define BENCH_COUNT_ALLOCATIONS
+#include "bench.h"
+
+#define LIVE_GAMES 10000
+#define CHURN 1000000
+#define IDS 100000
+
+/*
+ * Keeps LIVE_GAMES games alive and replaces a random one CHURN times, the way
+ * games end and start on a busy server. The legacy run repeats the old layout
+ * (game record, two players and the id as four heap objects, the repetition
+ * history inline), the slab run uses GameStatus from a pool. Both do the same
+ * initialisation, so the difference is layout and allocator. Reports ns and
+ * heap allocations per replaced game and bytes per live game.
+ */
+typedef struct {
+    char* gameId;
+    mtx_t* lock;
+    Player* players[2];
+    Position position;
+    uint64_t history[FIFTY_MOVE_PLIES + 1];
+    int winner;
+    unsigned int version;
+    MoveRecord* moves;
+    int moveCount;
+    int moveCapacity;
+    struct Connection* waiters;
+    Timer timer;
+    time_t abandonedAt;
+} LegacyGame;
+
+// copied into every new game, parsing the start position would dwarf what is measured
+static Position startPosition;
+
+static Player* legacy_player(int color) {
+    Player* p = malloc(sizeof(Player));
+    strcpy(p->playerId, color == WHITE ? "512" : "77");
+    p->color = color;
+    p->disconnected = false;
+    p->lastHeartbeat = 0;
+    p->pendingPolls = 0;
+    return p;
+}
+
+static LegacyGame* legacy_create(const char* gameId) {
+    LegacyGame* g = malloc(sizeof(LegacyGame));
+    g->gameId = malloc(6);
+    strcpy(g->gameId, gameId);
+    g->players[0] = legacy_player(WHITE);
+    g->players[1] = legacy_player(BLACK);
+    g->position = startPosition;
+    g->history[0] = g->position.hash;
+    g->winner = -1;
+    g->version = 0;
+    return g;
+}
+
+static void legacy_free(LegacyGame* g) {
+    free(g->players[0]);
+    free(g->players[1]);
+    free(g->gameId);
+    free(g);
+}
+
+static size_t legacy_bytes(LegacyGame* g) {
+    return malloc_usable_size(g) + malloc_usable_size(g->players[0]) + malloc_usable_size(g->players[1]) +
+           malloc_usable_size(g->gameId);
+}
+
+static GameStatus* pool_create(Slab* pool, const char* gameId) {
+    GameStatus* g = slab_alloc(pool);
+    strcpy(g->gameId, gameId);
+    for (int i = 0; i < 2; i++) {
+        Player* p = &g->seats[i];
+        strcpy(p->playerId, i == 0 ? "512" : "77");
+        p->color = i == 0 ? WHITE : BLACK;
+        p->disconnected = false;
+        p->lastHeartbeat = 0;
+        p->pendingPolls = 0;
+        g->players[i] = p;
+    }
+    g->position = startPosition;
+    g->startHash = g->position.hash;
+    g->winner = -1;
+    g->version = 0;
+    return g;
+}
+
+static void report(const char* name, uint64_t elapsed, size_t allocated, size_t bytes) {
+#ifdef COUNT_ALLOCATIONS
+    printf("%-8s %10.1f %14.2f %12zu\n", name, (double) elapsed / CHURN, (double) allocated / CHURN, bytes);
+#else
+    (void) allocated;
+    printf("%-8s %10.1f %14s %12zu\n", name, (double) elapsed / CHURN, "n/a", bytes);
+#endif
+}
+
+int main() {
+    bitboard_init();
+    position_init(&startPosition);
+    uint64_t rng = 0x9E3779B97F4A7C15ULL;
+    // five characters at most, like the ids clients use; the bound lets the compiler see the digits fit
+    static char ids[IDS][6];
+    for (int i = 0; i < IDS; i++)
+        snprintf(ids[i], sizeof(ids[i]), "%u", (unsigned int) i % IDS);
+    printf("%-8s %10s %14s %12s\n", "layout", "ns/game", "allocs/game", "bytes/game");
+
+    LegacyGame** legacy = malloc(sizeof(LegacyGame*) * LIVE_GAMES);
+    for (int i = 0; i < LIVE_GAMES; i++)
+        legacy[i] = legacy_create(ids[i]);
+#ifdef COUNT_ALLOCATIONS
+    size_t allocations_before = allocations;
+#endif
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < CHURN; i++) {
+        size_t victim = bench_random(&rng) % LIVE_GAMES;
+        legacy_free(legacy[victim]);
+        legacy[victim] = legacy_create(ids[i % IDS]);
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    size_t allocated = 0;
+#ifdef COUNT_ALLOCATIONS
+    allocated = allocations - allocations_before;
+#endif
+    report("legacy", elapsed, allocated, legacy_bytes(legacy[0]));
+    for (int i = 0; i < LIVE_GAMES; i++)
+        legacy_free(legacy[i]);
+    free(legacy);
+
+    Slab pool;
+    slab_init(&pool, sizeof(GameStatus), 64);
+    GameStatus** games = malloc(sizeof(GameStatus*) * LIVE_GAMES);
+    for (int i = 0; i < LIVE_GAMES; i++)
+        games[i] = pool_create(&pool, ids[i]);
+#ifdef COUNT_ALLOCATIONS
+    allocations_before = allocations;
+#endif
+    start = bench_now_ns();
+    for (int i = 0; i < CHURN; i++) {
+        size_t victim = bench_random(&rng) % LIVE_GAMES;
+        slab_free(&pool, games[victim]);
+        games[victim] = pool_create(&pool, ids[i % IDS]);
+    }
+    elapsed = bench_now_ns() - start;
+#ifdef COUNT_ALLOCATIONS
+    allocated = allocations - allocations_before;
+#endif
+    report("slab", elapsed, allocated, pool.objectSize);
+    slab_destroy(&pool);
+    free(games);
+
+    return 0;
+}
@@ -0,0 +1,73 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../game_table.h"
+#include "bench.h"
+
+#define LOOKUPS 2000000
+#define ID_LENGTH 24
+
+/*
+ * Fills the game registry with an increasing number of games and measures
+ * lookups of live ids, lookups of missing ids and insert/remove churn.
+ * With the hash index the cost per lookup should stay flat as the table grows.
+ */
+int main() {
+    const size_t sizes[] = {100, 1000, 10000, 100000, 500000, 1000000};
+    const size_t size_count = sizeof(sizes) / sizeof(sizes[0]);
+    size_t max_games = sizes[size_count - 1];
+
+    GameStatus* games = calloc(max_games, sizeof(GameStatus));
+    char* missing_ids = malloc(max_games * ID_LENGTH);
+    for (size_t i = 0; i < max_games; i++) {
+        snprintf(games[i].gameId, sizeof(games[i].gameId), "g%zu", i);
+        snprintf(missing_ids + i * ID_LENGTH, ID_LENGTH, "m%zu", i);
+    }
+
+    printf("%10s %14s %14s %14s\n", "games", "hit ns/op", "miss ns/op", "churn ns/op");
+
+    for (size_t s = 0; s < size_count; s++) {
+        size_t n = sizes[s];
+        GameTable table;
+        game_table_init(&table, 0);
+        for (size_t i = 0; i < n; i++) {
+            game_table_insert(&table, &games[i]);
+        }
+
+        uint64_t rng = 0x9E3779B97F4A7C15ULL;
+        uint64_t start = bench_now_ns();
+        for (size_t i = 0; i < LOOKUPS; i++) {
+            GameStatus* g = game_table_find(&table, games[bench_random(&rng) % n].gameId);
+            bench_do_not_optimize(g);
+        }
+        double hit_ns = (double) (bench_now_ns() - start) / LOOKUPS;
+
+        start = bench_now_ns();
+        for (size_t i = 0; i < LOOKUPS; i++) {
+            GameStatus* g = game_table_find(&table, missing_ids + bench_random(&rng) % n * ID_LENGTH);
+            bench_do_not_optimize(g);
+        }
+        double miss_ns = (double) (bench_now_ns() - start) / LOOKUPS;
+
+        // games ending and new ones starting, the table size stays the same
+        start = bench_now_ns();
+        for (size_t i = 0; i < LOOKUPS / 2; i++) {
+            GameStatus* g = &games[bench_random(&rng) % n];
+            game_table_remove(&table, g);
+            game_table_insert(&table, g);
+        }
+        double churn_ns = (double) (bench_now_ns() - start) / (LOOKUPS / 2);
+
+        if (table.size != n) {
+            printf("table lost games: %zu != %zu\n", table.size, n);
+            return 1;
+        }
+
+        printf("%10zu %14.1f %14.1f %14.1f\n", n, hit_ns, miss_ns, churn_ns);
+        game_table_free(&table);
+    }
+
+    free(missing_ids);
+    free(games);
+    return 0;
+}
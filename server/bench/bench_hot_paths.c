@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../chess_rules.h"
+#include "../connection.h"
+#include "../game.h"
+#include "../http.h"
+#include "../protocol.h"
+#include "bench.h"
+
+#define MAX_TABLE_GAMES 1000000
+#define LOOKUP_IDS 4096
+#define DELTA_MOVES 4
+
+/*
+ * The paths every request goes through, each timed as the median of several
+ * equal batches so a change to one of them shows up as a shift well outside
+ * the run-to-run spread:
+ *
+ *   rules     is_move_valid for a move of every piece type, and a refused one,
+ *             in an opening, a middlegame and an endgame position
+ *   encode    every response shape as the server frames it, HTTP header included,
+ *             full-state shapes also with the board already encoded as the game
+ *             caches it between polls
+ *   decode    framing and decoding of the common requests, HTTP/JSON with a
+ *             browser's headers and binary
+ *   lookup    find_game for live and unknown ids as the registry grows
+ *
+ * Compare numbers from Release builds (-O3 -march=native) on an idle machine.
+ * An optional argument only runs the cases whose name starts with it, e.g.
+ * "bench_hot_paths rules/middlegame".
+ */
+
+typedef struct {
+    const char* name;
+    const char* fen;
+} BenchPosition;
+
+static const BenchPosition POSITIONS[] = {
+        {"opening",    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1"},
+        {"middlegame", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1"},
+        {"endgame",    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1"},
+};
+
+static const char* PIECE_NAMES[] = {"", "pawn", "knight", "bishop", "rook", "queen", "king"};
+
+typedef struct {
+    GameStatus* game;
+    int fromX;
+    int fromY;
+    int toX;
+    int toY;
+} RulesCase;
+
+typedef struct {
+    const Message* message;
+    ByteBuffer out;
+} EncodeCase;
+
+typedef struct {
+    Protocol protocol;
+    const char* data;
+    size_t length;
+} DecodeCase;
+
+typedef struct {
+    char (*ids)[MAX_GAME_ID_LENGTH + 1];
+} LookupCase;
+
+static const char* filter = nullptr;
+
+// whether any case named prefix... can pass the filter, groups nobody asked for are not even set up
+static bool group_wanted(const char* prefix) {
+    if (filter == nullptr)
+        return true;
+    size_t length = strlen(filter) < strlen(prefix) ? strlen(filter) : strlen(prefix);
+    return strncmp(filter, prefix, length) == 0;
+}
+
+static void report(const char* name, BenchOp op, void* arg) {
+    if (filter != nullptr && strncmp(name, filter, strlen(filter)) != 0)
+        return;
+    BenchResult result = bench_measure(op, arg);
+    printf("%-40s %10.1f %7.1f%%\n", name, result.nsPerOp, result.spread * 100);
+    fflush(stdout);
+}
+
+static void run_rules(void* arg, uint64_t iterations) {
+    RulesCase* c = arg;
+    for (uint64_t i = 0; i < iterations; i++) {
+        bool valid = is_move_valid(c->game, c->fromX, c->fromY, c->toX, c->toY);
+        bench_do_not_optimize(&valid);
+    }
+}
+
+static void bench_rules() {
+    if (!group_wanted("rules/"))
+        return;
+    char name[64];
+    for (size_t p = 0; p < sizeof(POSITIONS) / sizeof(POSITIONS[0]); p++) {
+        GameStatus game = {.winner = -1};
+        position_from_fen(&game.position, POSITIONS[p].fen);
+        MoveList moves;
+        generate_legal_moves(&game.position, &moves);
+
+        // the first legal move of each piece type, the generator's order is deterministic
+        for (int type = PAWN; type <= KING; type++) {
+            for (int i = 0; i < moves.count; i++) {
+                int from = MOVE_FROM(moves.moves[i]);
+                if (get_piece_type(piece_at(&game.position, from)) != type)
+                    continue;
+                int to = MOVE_TO(moves.moves[i]);
+                RulesCase c = {&game, SQUARE_X(from), SQUARE_Y(from), SQUARE_X(to), SQUARE_Y(to)};
+                snprintf(name, sizeof(name), "rules/%s/%s", POSITIONS[p].name, PIECE_NAMES[type]);
+                report(name, run_rules, &c);
+                break;
+            }
+        }
+
+        // a piece that stays where it is never matches, so every legal move gets looked at
+        int from = MOVE_FROM(moves.moves[0]);
+        RulesCase c = {&game, SQUARE_X(from), SQUARE_Y(from), SQUARE_X(from), SQUARE_Y(from)};
+        snprintf(name, sizeof(name), "rules/%s/refused", POSITIONS[p].name);
+        report(name, run_rules, &c);
+        free(game.moves);
+    }
+}
+
+static void run_encode(void* arg, uint64_t iterations) {
+    EncodeCase* c = arg;
+    for (uint64_t i = 0; i < iterations; i++) {
+        c->out.length = 0;
+        size_t body = http_response_begin(&c->out);
+        encode_json_message(&c->out, c->message);
+        http_response_end(&c->out, body, true);
+        bench_do_not_optimize(c->out.data);
+    }
+}
+
+static void bench_encode() {
+    if (!group_wanted("encode/"))
+        return;
+    char name[64];
+    static Player white = {.playerId = "512", .color = WHITE};
+    static Player black = {.playerId = "77", .color = BLACK};
+    static GameStatus game = {.gameId = "bench", .players = {&white, &black}, .winner = -1};
+    position_init(&game.position);
+    // a short opening so the delta has moves to replay
+    static const int OPENING[][4] = {{4, 6, 4, 4}, {4, 1, 4, 3}, {6, 7, 5, 5}, {1, 0, 2, 2}};
+    for (int i = 0; i < DELTA_MOVES; i++) {
+        apply_move(&game, find_move(&game, OPENING[i][0], OPENING[i][1], OPENING[i][2], OPENING[i][3], QUEEN));
+        game.version++;
+    }
+
+    static const struct {
+        const char* name;
+        int messageType;
+    } SHAPES[] = {
+            {"encode/WAIT_FOR_OTHER_PLAYER", WAIT_FOR_OTHER_PLAYER},
+            {"encode/GAME_STARTED",          GAME_STARTED},
+            {"encode/GAME_STATE_RESPONSE",   GAME_STATE_RESPONSE},
+            {"encode/GAME_STATE_DELTA",      GAME_STATE_DELTA},
+            {"encode/GAME_STATE_UNCHANGED",  GAME_STATE_UNCHANGED},
+            {"encode/MOVE_ACCEPTED",         MOVE_ACCEPTED},
+            {"encode/GAME_ENDED",            GAME_ENDED},
+            {"encode/PLAYER_DISCONNECTED",   PLAYER_DISCONNECTED},
+    };
+    for (size_t i = 0; i < sizeof(SHAPES) / sizeof(SHAPES[0]); i++) {
+        Message message = {.messageType = SHAPES[i].messageType, .gameId = game.gameId, .playerId = black.playerId};
+        message.playerColor = black.color;
+        message.currentTurn = game.position.sideToMove;
+        message.winner = WHITE;
+        message.version = game.version;
+        message.position = &game.position;
+        message.baseVersion = game.version - DELTA_MOVES;
+        message.moves = game.moves + game.moveCount - DELTA_MOVES;
+        message.moveCount = DELTA_MOVES;
+
+        EncodeCase c = {&message, {nullptr, 0, 0}};
+        report(SHAPES[i].name, run_encode, &c);
+
+        if (message.messageType == GAME_STATE_RESPONSE || message.messageType == GAME_ENDED) {
+            ByteBuffer state = {nullptr, 0, 0};
+            encode_json_state(&state, game.version, &game.position);
+            message.state = state.data;
+            message.stateLength = state.length;
+            snprintf(name, sizeof(name), "%s/cached", SHAPES[i].name);
+            report(name, run_encode, &c);
+            byte_buffer_free(&state);
+        }
+        byte_buffer_free(&c.out);
+    }
+    free(game.moves);
+}
+
+static void run_decode(void* arg, uint64_t iterations) {
+    DecodeCase* c = arg;
+    for (uint64_t i = 0; i < iterations; i++) {
+        Request request;
+        bool decoded;
+        if (c->protocol == PROTOCOL_BINARY) {
+            size_t payload = (uint8_t) c->data[0] << 8 | (uint8_t) c->data[1];
+            decoded = decode_binary_request((const uint8_t*) c->data + BINARY_FRAME_HEADER, payload, &request);
+        } else {
+            HttpParser parser;
+            http_parser_reset(&parser);
+            decoded = http_parse_request(&parser, c->data, c->length, MAX_MESSAGE_LENGTH) == HTTP_COMPLETE &&
+                      decode_json_request(c->data + parser.headerLength, parser.contentLength, &request);
+        }
+        bench_do_not_optimize(&decoded);
+        bench_do_not_optimize(&request);
+    }
+}
+
+static void bench_decode() {
+    if (!group_wanted("decode/"))
+        return;
+    // what a browser sends along with every fetch
+    static const char HEADERS[] =
+            "POST / HTTP/1.1\r\n"
+            "Host: localhost:2137\r\n"
+            "Connection: keep-alive\r\n"
+            "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\"\r\n"
+            "sec-ch-ua-platform: \"Linux\"\r\n"
+            "sec-ch-ua-mobile: ?0\r\n"
+            "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) "
+            "Chrome/118.0.0.0 Safari/537.36\r\n"
+            "Content-Type: text/plain;charset=UTF-8\r\n"
+            "Accept: */*\r\n"
+            "Origin: http://localhost:5173\r\n"
+            "Sec-Fetch-Site: same-site\r\n"
+            "Sec-Fetch-Mode: cors\r\n"
+            "Sec-Fetch-Dest: empty\r\n"
+            "Referer: http://localhost:5173/\r\n"
+            "Accept-Encoding: gzip, deflate, br\r\n"
+            "Accept-Language: en-US,en;q=0.9\r\n";
+    static const struct {
+        const char* name;
+        const char* body;
+    } BODIES[] = {
+            {"decode/json/JOIN_GAME",          "{\"messageType\":128,\"gameId\":null,\"playerId\":null,"
+                                               "\"game_id\":\"bench\"}"},
+            {"decode/json/GAME_STATE_REQUEST", "{\"messageType\":129,\"gameId\":\"bench\",\"playerId\":\"77\","
+                                               "\"lastSeenVersion\":12}"},
+            {"decode/json/MOVE_PIECE",         "{\"messageType\":130,\"gameId\":\"bench\",\"playerId\":\"77\","
+                                               "\"move\":{\"from\":[4,1],\"to\":[4,3]}}"},
+    };
+    char data[2048];
+    for (size_t i = 0; i < sizeof(BODIES) / sizeof(BODIES[0]); i++) {
+        int length = snprintf(data, sizeof(data), "%sContent-Length: %zu\r\n\r\n%s", HEADERS,
+                              strlen(BODIES[i].body), BODIES[i].body);
+        DecodeCase c = {PROTOCOL_HTTP, data, (size_t) length};
+        report(BODIES[i].name, run_decode, &c);
+    }
+
+    static const char SYNC_FRAME[] = {0, 15, 0, (char) 129, 5, 'b', 'e', 'n', 'c', 'h', 2, '7', '7', 0, 0, 0, 12};
+    static const char MOVE_FRAME[] = {0, 14, 0, (char) 130, 5, 'b', 'e', 'n', 'c', 'h', 2, '7', '7', 12, 28, 0};
+    DecodeCase sync = {PROTOCOL_BINARY, SYNC_FRAME, sizeof(SYNC_FRAME)};
+    report("decode/binary/GAME_STATE_REQUEST", run_decode, &sync);
+    DecodeCase move = {PROTOCOL_BINARY, MOVE_FRAME, sizeof(MOVE_FRAME)};
+    report("decode/binary/MOVE_PIECE", run_decode, &move);
+}
+
+static void run_lookup(void* arg, uint64_t iterations) {
+    LookupCase* c = arg;
+    for (uint64_t i = 0; i < iterations; i++) {
+        GameStatus* game = find_game(c->ids[i % LOOKUP_IDS]);
+        bench_do_not_optimize(game);
+    }
+}
+
+static void bench_lookup() {
+    if (!group_wanted("lookup/"))
+        return;
+    static const int SIZES[] = {1000, 10000, 100000, MAX_TABLE_GAMES};
+    char (*hits)[MAX_GAME_ID_LENGTH + 1] = malloc(LOOKUP_IDS * sizeof(*hits));
+    char (*misses)[MAX_GAME_ID_LENGTH + 1] = malloc(LOOKUP_IDS * sizeof(*misses));
+    uint64_t rng = 42;
+    int created = 0;
+    char id[MAX_GAME_ID_LENGTH + 1];
+    char name[64];
+
+    for (size_t s = 0; s < sizeof(SIZES) / sizeof(SIZES[0]); s++) {
+        // the registry only grows, each size adds to the games of the one before
+        for (; created < SIZES[s]; created++) {
+            snprintf(id, sizeof(id), "g%d", created);
+            create_or_join_game(id);
+        }
+        // ids are picked up front in random order, so the lookups do not walk memory in sequence
+        for (int i = 0; i < LOOKUP_IDS; i++) {
+            snprintf(hits[i], sizeof(hits[i]), "g%d", (int) (bench_random(&rng) % (uint64_t) created));
+            snprintf(misses[i], sizeof(misses[i]), "m%d", (int) (bench_random(&rng) % (uint64_t) created));
+        }
+
+        LookupCase hit = {hits};
+        snprintf(name, sizeof(name), "lookup/%d/hit", SIZES[s]);
+        report(name, run_lookup, &hit);
+        LookupCase miss = {misses};
+        snprintf(name, sizeof(name), "lookup/%d/miss", SIZES[s]);
+        report(name, run_lookup, &miss);
+    }
+    free(hits);
+    free(misses);
+}
+
+int main(int argc, char** argv) {
+    filter = argc > 1 ? argv[1] : nullptr;
+    init_games();
+
+    printf("%-40s %10s %8s\n", "case", "ns/op", "spread");
+    bench_rules();
+    bench_encode();
+    bench_decode();
+    bench_lookup();
+    return 0;
+}
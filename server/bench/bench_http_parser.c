@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../http.h"
+#include "bench.h"
+
+#define LIMIT 2048
+#define ROUNDS 200000
+#define FUZZ_CASES 200000
+
+/*
+ * Measures parse throughput for a typical browser request fed whole, in
+ * random chunks and one byte at a time, then fuzzes the parser: mutated and
+ * random requests are fed whole and in random chunks and both feeds have to
+ * reach the same verdict. Run it in a Debug build so the sanitizers catch any
+ * out of bounds read. An optional argument sets the number of fuzz cases.
+ */
+static const char REQUEST[] =
+        "POST / HTTP/1.1\r\n"
+        "Host: localhost:2137\r\n"
+        "Connection: keep-alive\r\n"
+        "Content-Length: 80\r\n"
+        "sec-ch-ua: \"Chromium\";v=\"118\", \"Google Chrome\";v=\"118\"\r\n"
+        "sec-ch-ua-platform: \"Linux\"\r\n"
+        "sec-ch-ua-mobile: ?0\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/118.0.0.0 Safari/537.36\r\n"
+        "Content-Type: text/plain;charset=UTF-8\r\n"
+        "Accept: */*\r\n"
+        "Origin: http://localhost:5173\r\n"
+        "Sec-Fetch-Site: same-site\r\n"
+        "Sec-Fetch-Mode: cors\r\n"
+        "Sec-Fetch-Dest: empty\r\n"
+        "Referer: http://localhost:5173/\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Accept-Language: pl-PL,pl;q=0.9,en-US;q=0.8,en;q=0.7\r\n"
+        "\r\n"
+        "{\"messageType\":129,\"gameId\":\"abcde\",\"playerId\":\"12345\",\"lastSeenVersion\":17}    ";
+
+static const char* SEEDS[] = {
+        REQUEST,
+        "POST / HTTP/1.0\r\nContent-Length: 2\r\n\r\n{}",
+        "POST / HTTP/1.1\r\nconnection: Close\r\ncontent-length:  4 \r\n\r\nnull",
+        "GET /x HTTP/1.1\nHost: a\n\n",
+        "POST / HTTP/1.1\r\nContent-Length: 3\r\nContent-Length: 3\r\nConnection: upgrade, keep-alive\r\n\r\nabc",
+        "\r\nPOST / HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n",
+};
+
+typedef struct {
+    HttpParseResult result;
+    size_t headerLength;
+    size_t contentLength;
+    bool keepAlive;
+    int errorStatus;
+} Verdict;
+
+// feeds length bytes in chunks of at most max_chunk, random when state is given, like a socket would deliver them
+static Verdict feed(const char* data, size_t length, size_t max_chunk, uint64_t* state) {
+    HttpParser parser;
+    http_parser_reset(&parser);
+    HttpParseResult result = HTTP_INCOMPLETE;
+    size_t received = 0;
+    while (received < length && result == HTTP_INCOMPLETE) {
+        size_t chunk = state != nullptr ? 1 + bench_random(state) % max_chunk : max_chunk;
+        received = received + chunk < length ? received + chunk : length;
+        result = http_parse_request(&parser, data, received, LIMIT);
+    }
+
+    Verdict verdict = {result, 0, 0, false, 0};
+    if (result == HTTP_COMPLETE) {
+        verdict.headerLength = parser.headerLength;
+        verdict.contentLength = parser.contentLength;
+        verdict.keepAlive = parser.keepAlive;
+    } else if (result == HTTP_INVALID) {
+        verdict.errorStatus = parser.errorStatus;
+    }
+    return verdict;
+}
+
+static bool same_verdict(Verdict a, Verdict b) {
+    return a.result == b.result && a.headerLength == b.headerLength && a.contentLength == b.contentLength &&
+           a.keepAlive == b.keepAlive && a.errorStatus == b.errorStatus;
+}
+
+static void run(const char* name, size_t max_chunk, bool random_chunks) {
+    size_t length = sizeof(REQUEST) - 1;
+    uint64_t state = 42;
+
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < ROUNDS; i++) {
+        Verdict verdict = feed(REQUEST, length, max_chunk, random_chunks ? &state : nullptr);
+        bench_do_not_optimize(&verdict);
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+
+    printf("%-10s %10.1f %12.0f %10.1f\n", name, (double) elapsed / ROUNDS, (double) ROUNDS * 1e9 / (double) elapsed,
+           (double) length * ROUNDS * 1e3 / (double) elapsed);
+}
+
+static size_t mutate(char* data, size_t length, uint64_t* state) {
+    static const char INTERESTING[] = "\r\n: ,\t0123456789-\x7f";
+    int mutations = 1 + (int) (bench_random(state) % 4);
+    for (int i = 0; i < mutations && length > 0; i++) {
+        size_t at = bench_random(state) % length;
+        switch (bench_random(state) % 5) {
+            case 0:
+                data[at] = (char) bench_random(state);
+                break;
+            case 1:
+                data[at] = INTERESTING[bench_random(state) % (sizeof(INTERESTING) - 1)];
+                break;
+            case 2:
+                // drop a byte
+                memmove(data + at, data + at + 1, length - at - 1);
+                length--;
+                break;
+            case 3:
+                // duplicate a run of bytes, which also produces oversized requests
+                if (length < LIMIT * 2 - 64) {
+                    size_t run = 1 + bench_random(state) % 32;
+                    if (at + run > length)
+                        run = length - at;
+                    memmove(data + at + run, data + at, length - at);
+                    length += run;
+                }
+                break;
+            default:
+                length = at;
+                break;
+        }
+    }
+    return length;
+}
+
+static int fuzz(long cases) {
+    uint64_t state = 7;
+    long outcomes[3] = {0};
+    char* data = malloc(LIMIT * 2);
+
+    for (long i = 0; i < cases; i++) {
+        const char* seed = SEEDS[bench_random(&state) % (sizeof(SEEDS) / sizeof(SEEDS[0]))];
+        size_t length = strlen(seed);
+        memcpy(data, seed, length);
+        length = mutate(data, length, &state);
+
+        // an exactly sized heap copy so the sanitizers see any read past the received bytes
+        char* exact = malloc(length ? length : 1);
+        memcpy(exact, data, length);
+
+        Verdict whole = feed(exact, length, length ? length : 1, nullptr);
+        Verdict split = feed(exact, length, 1 + bench_random(&state) % 64, &state);
+        Verdict bytes = feed(exact, length, 1, nullptr);
+        free(exact);
+
+        if (!same_verdict(whole, split) || !same_verdict(whole, bytes)) {
+            printf("fuzz case %ld: split feeds disagree (%d/%d/%d) on:\n%.*s\n", i, whole.result, split.result,
+                   bytes.result, (int) length, data);
+            free(data);
+            return EXIT_FAILURE;
+        }
+        if (whole.result == HTTP_COMPLETE && whole.headerLength + whole.contentLength > LIMIT) {
+            printf("fuzz case %ld: accepted a request over the limit\n", i);
+            free(data);
+            return EXIT_FAILURE;
+        }
+        outcomes[whole.result]++;
+    }
+
+    printf("fuzz: %ld cases, %ld incomplete, %ld complete, %ld invalid\n", cases, outcomes[HTTP_INCOMPLETE],
+           outcomes[HTTP_COMPLETE], outcomes[HTTP_INVALID]);
+    free(data);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char** argv) {
+    long cases = argc > 1 ? strtol(argv[1], NULL, 10) : FUZZ_CASES;
+
+    Verdict verdict = feed(REQUEST, sizeof(REQUEST) - 1, sizeof(REQUEST) - 1, nullptr);
+    if (verdict.result != HTTP_COMPLETE || !verdict.keepAlive || verdict.contentLength != 80) {
+        printf("reference request did not parse\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%-10s %10s %12s %10s\n", "feed", "ns/req", "req/s", "MB/s");
+    run("whole", sizeof(REQUEST) - 1, false);
+    run("chunks", 64, true);
+    run("bytes", 1, false);
+
+    return fuzz(cases);
+}
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../game.h"
+#include "../http.h"
+#include "../protocol.h"
+#include "bench.h"
+
+#define MESSAGES 200000
+#define DELTA_MOVES 4
+
+/*
+ * Compares the HTTP/JSON and the binary protocol message by message: CPU time
+ * to frame and encode the common responses, CPU time to frame and decode the
+ * common requests, and the bytes each one puts on the wire. HTTP requests
+ * carry the short header of a scripted client, browsers send several hundred
+ * bytes more.
+ */
+
+typedef enum {
+    SYNC,
+    MOVE
+} RequestKind;
+
+static GameStatus game;
+static Player white = {.playerId = "512", .color = WHITE};
+static Player black = {.playerId = "77", .color = BLACK};
+
+static void build_message(Message* message, int messageType) {
+    *message = (Message) {.messageType = messageType, .gameId = game.gameId, .playerId = black.playerId};
+    message->playerColor = black.color;
+    message->currentTurn = game.position.sideToMove;
+    message->version = game.version;
+    message->position = &game.position;
+    if (messageType == GAME_STATE_DELTA) {
+        message->baseVersion = game.version - DELTA_MOVES;
+        message->moves = game.moves + game.moveCount - DELTA_MOVES;
+        message->moveCount = DELTA_MOVES;
+    }
+}
+
+static size_t encode_response(ByteBuffer* out, Protocol protocol, const Message* message) {
+    if (protocol == PROTOCOL_BINARY) {
+        size_t payload = binary_frame_begin(out);
+        encode_binary_message(out, message);
+        return binary_frame_end(out, payload);
+    }
+    size_t body = http_response_begin(out);
+    encode_json_message(out, message);
+    return http_response_end(out, body, true);
+}
+
+static void run_response(const char* name, Protocol protocol, int messageType) {
+    Message message;
+    build_message(&message, messageType);
+    ByteBuffer out = {nullptr, 0, 0};
+    size_t start = encode_response(&out, protocol, &message);
+    size_t bytes = out.length - start;
+
+    uint64_t begin = bench_now_ns();
+    for (int i = 0; i < MESSAGES; i++) {
+        out.length = 0;
+        encode_response(&out, protocol, &message);
+        bench_do_not_optimize(out.data);
+    }
+    uint64_t elapsed = bench_now_ns() - begin;
+
+    printf("%-22s %-7s %10.1f %8zu\n", name, protocol == PROTOCOL_BINARY ? "binary" : "json",
+           (double) elapsed / MESSAGES, bytes);
+    byte_buffer_free(&out);
+}
+
+static size_t build_request(char* data, Protocol protocol, RequestKind kind) {
+    if (protocol == PROTOCOL_BINARY) {
+        static const uint8_t SYNC_FRAME[] = {0, 15, 0, 129, 5, 'b', 'e', 'n', 'c', 'h', 2, '7', '7', 0, 0, 0, 12};
+        static const uint8_t MOVE_FRAME[] = {0, 14, 0, 130, 5, 'b', 'e', 'n', 'c', 'h', 2, '7', '7', 12, 28, 0};
+        const uint8_t* frame = kind == SYNC ? SYNC_FRAME : MOVE_FRAME;
+        size_t length = kind == SYNC ? sizeof(SYNC_FRAME) : sizeof(MOVE_FRAME);
+        memcpy(data, frame, length);
+        return length;
+    }
+
+    const char* body = kind == SYNC
+                       ? "{\"messageType\":129,\"gameId\":\"bench\",\"playerId\":\"77\",\"lastSeenVersion\":12}"
+                       : "{\"messageType\":130,\"gameId\":\"bench\",\"playerId\":\"77\","
+                         "\"move\":{\"from\":[4,1],\"to\":[4,3]}}";
+    return (size_t) sprintf(data, "POST / HTTP/1.1\r\nHost: localhost:2137\r\nContent-Type: application/json\r\n"
+                                  "Content-Length: %zu\r\n\r\n%s", strlen(body), body);
+}
+
+static bool decode_request(const char* data, size_t length, Protocol protocol, Request* request) {
+    if (protocol == PROTOCOL_BINARY) {
+        size_t payload = (uint8_t) data[0] << 8 | (uint8_t) data[1];
+        return BINARY_FRAME_HEADER + payload == length &&
+               decode_binary_request((const uint8_t*) data + BINARY_FRAME_HEADER, payload, request);
+    }
+
+    HttpParser parser;
+    http_parser_reset(&parser);
+    if (http_parse_request(&parser, data, length, 2048) != HTTP_COMPLETE)
+        return false;
+    return decode_json_request(data + parser.headerLength, parser.contentLength, request);
+}
+
+static void run_request(const char* name, Protocol protocol, RequestKind kind) {
+    char data[512];
+    size_t length = build_request(data, protocol, kind);
+    Request request;
+    if (!decode_request(data, length, protocol, &request)) {
+        printf("%s request did not decode\n", name);
+        exit(EXIT_FAILURE);
+    }
+
+    uint64_t begin = bench_now_ns();
+    for (int i = 0; i < MESSAGES; i++) {
+        decode_request(data, length, protocol, &request);
+        bench_do_not_optimize(&request);
+    }
+    uint64_t elapsed = bench_now_ns() - begin;
+
+    printf("%-22s %-7s %10.1f %8zu\n", name, protocol == PROTOCOL_BINARY ? "binary" : "json",
+           (double) elapsed / MESSAGES, length);
+}
+
+int main() {
+    init_games();
+
+    // a short opening so the delta has moves to replay
+    strcpy(game.gameId, "bench");
+    game.players[0] = &white;
+    game.players[1] = &black;
+    game.winner = -1;
+    position_init(&game.position);
+    static const int OPENING[][4] = {{4, 6, 4, 4}, {4, 1, 4, 3}, {6, 7, 5, 5}, {1, 0, 2, 2}};
+    for (int i = 0; i < DELTA_MOVES; i++) {
+        apply_move(&game, find_move(&game, OPENING[i][0], OPENING[i][1], OPENING[i][2], OPENING[i][3], QUEEN));
+        game.version++;
+    }
+
+    printf("%-22s %-7s %10s %8s\n", "message", "proto", "ns/msg", "bytes");
+    Protocol protocols[] = {PROTOCOL_HTTP, PROTOCOL_BINARY};
+    for (int i = 0; i < 2; i++)
+        run_response("GAME_STATE_RESPONSE", protocols[i], GAME_STATE_RESPONSE);
+    for (int i = 0; i < 2; i++)
+        run_response("GAME_STATE_DELTA", protocols[i], GAME_STATE_DELTA);
+    for (int i = 0; i < 2; i++)
+        run_response("MOVE_ACCEPTED", protocols[i], MOVE_ACCEPTED);
+    for (int i = 0; i < 2; i++)
+        run_request("GAME_STATE_REQUEST", protocols[i], SYNC);
+    for (int i = 0; i < 2; i++)
+        run_request("MOVE_PIECE", protocols[i], MOVE);
+
+    free(game.moves);
+    return 0;
+}
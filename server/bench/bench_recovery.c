@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "../game.h"
+#include "../journal.h"
+#include "bench.h"
+
+#define GAMES 100000
+#define PLIES 20
+
+/*
+ * Journals GAMES games of PLIES random moves each, then recovers them twice in
+ * fresh processes: first from the journal alone (which also folds it into a
+ * snapshot), then from that snapshot. Every phase digests all games and the
+ * digests have to match. An optional argument sets the journal directory, a
+ * temporary one is used and removed otherwise.
+ */
+
+static uint64_t* digests;
+
+static void game_id(char* id, int i) {
+    snprintf(id, MAX_GAME_ID_LENGTH + 1, "r%d", i);
+}
+
+static uint64_t digest_games() {
+    uint64_t digest = 0;
+    char id[MAX_GAME_ID_LENGTH + 1];
+    for (int i = 0; i < GAMES; i++) {
+        game_id(id, i);
+        GameStatus* g = find_game(id);
+        if (g == nullptr)
+            return 0;
+        uint64_t h = g->position.hash ^ (uint64_t) g->version << 32 ^ (uint64_t) g->moveCount << 48;
+        for (int c = 0; c < 2; c++)
+            h = h * 31 + (g->players[c] != nullptr ? (uint64_t) atoi(g->players[c]->playerId) + 1 : 0);
+        digest += h * (uint64_t) (i + 1);
+    }
+    return digest;
+}
+
+static void populate() {
+    uint64_t rng = 42;
+    char id[MAX_GAME_ID_LENGTH + 1];
+    for (int i = 0; i < GAMES; i++) {
+        game_id(id, i);
+        // the writer thread collects concurrently, so the shard lock is taken like a request would
+        mtx_lock(game_lock(id));
+        create_or_join_game(id);
+        GameStatus* g = create_or_join_game(id);
+        for (int ply = 0; ply < PLIES && g->winner == -1; ply++) {
+            MoveList moves;
+            generate_legal_moves(&g->position, &moves);
+            apply_move(g, moves.moves[bench_random(&rng) % moves.count]);
+            mark_game_changed(g);
+        }
+        mtx_unlock(game_lock(id));
+    }
+}
+
+static void run_phase(int phase, const char* directory) {
+    // the child would print whatever is still buffered a second time
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        init_games();
+        uint64_t start = bench_now_ns();
+        if (!journal_open(directory, JOURNAL_SYNC_NONE))
+            _exit(EXIT_FAILURE);
+        uint64_t recovered = bench_now_ns();
+        if (phase == 0)
+            populate();
+        digests[phase] = digest_games();
+        journal_close();
+        uint64_t end = bench_now_ns();
+
+        static const char* NAMES[] = {"write", "journal", "snapshot"};
+        printf("%-10s %12.1f %12.1f\n", NAMES[phase], (double) (recovered - start) / 1e6,
+               (double) (end - start) / 1e6);
+        fflush(stdout);
+        _exit(EXIT_SUCCESS);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+        printf("phase %d failed\n", phase);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void remove_directory(const char* directory) {
+    DIR* dir = opendir(directory);
+    if (dir == nullptr)
+        return;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        if (strcmp(entry->d_name, ".") != 0 && strcmp(entry->d_name, "..") != 0)
+            unlinkat(dirfd(dir), entry->d_name, 0);
+    }
+    closedir(dir);
+    rmdir(directory);
+}
+
+int main(int argc, char** argv) {
+    char temporary[] = "/tmp/bench_recovery_XXXXXX";
+    const char* directory = argc > 1 ? argv[1] : mkdtemp(temporary);
+    if (directory == nullptr) {
+        perror("mkdtemp has failed");
+        return EXIT_FAILURE;
+    }
+
+    // the phases run in fresh processes, the digests come back through shared memory
+    digests = mmap(nullptr, 3 * sizeof(uint64_t), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    printf("%-10s %12s %12s\n", "phase", "open ms", "total ms");
+    for (int phase = 0; phase < 3; phase++)
+        run_phase(phase, directory);
+
+    bool match = digests[0] != 0 && digests[0] == digests[1] && digests[0] == digests[2];
+    printf("%d games of %d plies, recovered state %s\n", GAMES, PLIES, match ? "matches" : "DIFFERS");
+    if (argc <= 1)
+        remove_directory(directory);
+    return match ? EXIT_SUCCESS : EXIT_FAILURE;
+}
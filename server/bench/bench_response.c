@@ -0,0 +1,107 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <cjson/cJSON.h>
+#include "../game.h"
+#include "../http.h"
+#include "../json_writer.h"
+#define BENCH_COUNT_ALLOCATIONS
+#include "bench.h"
+
+#define RESPONSES 200000
+
+/*
+ * Builds the game state response (the biggest and most frequent one) both the
+ * old way, through a cJSON tree, cJSON_Print and a formatted header, and with
+ * the in-place JSON writer, and reports ns and heap allocations per response.
+ * Sanitized builds cannot count allocations and skip the counts.
+ */
+
+static const char HTTP_HEADER[] = "HTTP/1.1 200 OK\r\nAccess-Control-Allow-Origin: *\r\nContent-Type: application/json\r\nContent-Length: %zu\r\nConnection: %s\r\n\r\n";
+
+static void cjson_response(ByteBuffer* out, GameStatus* g, Player* p) {
+    cJSON* resp = cJSON_CreateObject();
+    cJSON_AddNumberToObject(resp, "messageType", 2);
+    cJSON_AddStringToObject(resp, "gameId", g->gameId);
+    cJSON_AddStringToObject(resp, "playerId", p->playerId);
+    cJSON_AddNumberToObject(resp, "currentTurn", g->position.sideToMove);
+    cJSON_AddNumberToObject(resp, "version", g->version);
+    cJSON_AddNumberToObject(resp, "playerColor", p->color);
+
+    cJSON* board = cJSON_CreateArray();
+    for (int i = 0; i < 8; i++) {
+        cJSON* row = cJSON_CreateArray();
+        for (int j = 0; j < 8; j++) {
+            cJSON_AddItemToArray(row, cJSON_CreateNumber(piece_at(&g->position, SQUARE(j, i))));
+        }
+        cJSON_AddItemToArray(board, row);
+    }
+    cJSON_AddItemToObject(resp, "board", board);
+
+    char* marshalled = cJSON_Print(resp);
+    size_t length = strlen(marshalled);
+    byte_buffer_reserve(out, length + 150);
+    out->length += sprintf(out->data + out->length, HTTP_HEADER, length, "keep-alive");
+    memcpy(out->data + out->length, marshalled, length);
+    out->length += length;
+
+    cJSON_Delete(resp);
+    cJSON_free(marshalled);
+}
+
+static void writer_response(ByteBuffer* out, GameStatus* g, Player* p) {
+    size_t body = http_response_begin(out);
+    JsonWriter writer;
+    json_begin_object(&writer, out);
+    json_add_int(&writer, "messageType", 2);
+    json_add_string(&writer, "gameId", g->gameId);
+    json_add_string(&writer, "playerId", p->playerId);
+    json_add_int(&writer, "currentTurn", g->position.sideToMove);
+    json_add_int(&writer, "version", g->version);
+    json_add_int(&writer, "playerColor", p->color);
+    write_board(&writer, &g->position);
+    json_end_object(&writer);
+    http_response_end(out, body, true);
+}
+
+static void run(const char* name, void (*build)(ByteBuffer*, GameStatus*, Player*), GameStatus* g, Player* p) {
+    ByteBuffer out = {nullptr, 0, 0};
+    // warm up so the reused buffer has reached its final size
+    build(&out, g, p);
+    size_t bytes = out.length;
+
+#ifdef COUNT_ALLOCATIONS
+    size_t allocations_before = allocations;
+#endif
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < RESPONSES; i++) {
+        out.length = 0;
+        build(&out, g, p);
+        bench_do_not_optimize(out.data);
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+
+#ifdef COUNT_ALLOCATIONS
+    printf("%-8s %10.1f %14.2f %10zu\n", name, (double) elapsed / RESPONSES,
+           (double) (allocations - allocations_before) / RESPONSES, bytes);
+#else
+    printf("%-8s %10.1f %14s %10zu\n", name, (double) elapsed / RESPONSES, "n/a", bytes);
+#endif
+
+    byte_buffer_free(&out);
+}
+
+int main() {
+    init_games();
+
+    Player white = {.playerId = "512", .color = WHITE};
+    Player black = {.playerId = "77", .color = BLACK};
+    GameStatus g = {.gameId = "bench", .players = {&white, &black}, .winner = -1, .version = 12};
+    position_init(&g.position);
+
+    printf("%-8s %10s %14s %10s\n", "writer", "ns/resp", "allocs/resp", "buffer");
+    run("cjson", cjson_response, &g, &black);
+    run("inplace", writer_response, &g, &black);
+
+    return 0;
+}
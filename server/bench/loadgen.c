@@ -0,0 +1,689 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <threads.h>
+#include <stdatomic.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include "../protocol.h"
+#include "bench.h"
+
+#define MAX_THREADS 64
+#define RECEIVE_BUFFER 4096
+#define REQUEST_BUFFER 512
+#define MAX_EVENTS 256
+// how often due moves and polls are looked for
+#define TICK_MS 1
+// longer than the server's long poll timeout, a request that takes this long is lost
+#define REQUEST_TIMEOUT_NS (15 * 1000000000ULL)
+// polls still open this long after both players left cannot be answered anymore
+#define END_GRACE_NS (100 * 1000000ULL)
+// the whole /metrics page, read once before and once after the run
+#define METRICS_BUFFER (256 * 1024)
+
+/*
+ * Load generator for the HTTP/JSON port. Plays N games at once, each between
+ * two simulated players that pick random legal moves, and talks to the server
+ * the way the browser client does: every message is a POSTed JSON body, each
+ * player keeps one keep-alive connection for its poll loop and one for joining,
+ * moving and disconnecting. A game that ends, or reaches the ply limit, is left
+ * by both players and replaced by a new one until the run is over.
+ *
+ * Latency is reported per kind of request. A poll carrying the version the game
+ * is already at waits for the next move and counts as LONG_POLL, any other poll
+ * is answered at once and counts as POLL. WAKE is the time from sending a move
+ * until a parked poll delivered it. The server's /metrics page is read before
+ * and after the run to report how many system calls its event loops made per
+ * request, which compares the epoll and io_uring backends.
+ *
+ *   loadgen [-g games] [-d seconds] [-t think ms] [-i poll interval ms] [-F]
+ *           [-m plies] [-T threads] [-h host] [-p port]
+ *
+ * -F polls without a version, so every poll returns the full board at once
+ * instead of waiting; with -i that gives a fixed poll rate per player.
+ */
+
+typedef enum {
+    STAT_JOIN,
+    STAT_POLL,
+    STAT_LONG_POLL,
+    STAT_MOVE,
+    STAT_DISCONNECT,
+    STAT_WAKE,
+    STAT_KINDS
+} StatKind;
+
+static const char* STAT_NAMES[STAT_KINDS] = {"JOIN_GAME", "POLL", "LONG_POLL", "MOVE_PIECE", "DISCONNECT", "WAKE"};
+
+typedef enum {
+    GAME_JOINING,
+    GAME_PLAYING,
+    GAME_ENDING
+} GamePhase;
+
+typedef struct {
+    uint32_t* samples;
+    size_t count;
+    size_t capacity;
+} Samples;
+
+struct SimPlayer;
+
+typedef struct {
+    int fd;
+    struct SimPlayer* player;
+    // the StatKind of the request in flight, -1 when idle
+    int inFlight;
+    uint64_t sentAt;
+    char in[RECEIVE_BUFFER];
+    size_t inLength;
+    char out[REQUEST_BUFFER];
+    size_t outLength;
+    size_t outSent;
+} SimConnection;
+
+typedef struct SimPlayer {
+    struct SimGame* game;
+    int color;
+    char playerId[PLAYER_ID_LENGTH + 1];
+    SimConnection command;
+    SimConnection poll;
+    long long lastSeenVersion;
+    uint64_t pollDueAt;
+} SimPlayer;
+
+typedef struct SimGame {
+    char gameId[MAX_GAME_ID_LENGTH + 1];
+    GamePhase phase;
+    SimPlayer players[2];
+    // both sides are played here, so the position and version always match the server's
+    Position position;
+    long long version;
+    int plies;
+    Move pendingMove;
+    uint64_t moveDueAt;
+    uint64_t lastMoveSentAt;
+    int pendingDisconnects;
+    uint64_t endedAt;
+} SimGame;
+
+typedef struct {
+    int index;
+    int epollFd;
+    SimGame* games;
+    int gameCount;
+    uint64_t rng;
+    unsigned int nextGameId;
+    Samples stats[STAT_KINDS];
+    size_t gamesPlayed;
+    size_t errors;
+} Worker;
+
+// counters from the server's /metrics page
+typedef struct {
+    uint64_t requests;
+    uint64_t syscalls;
+} ServerCounters;
+
+static struct sockaddr_in serverAddress;
+static const char* host = "127.0.0.1";
+static int port = 2137;
+static int gameCount = 100;
+static int threadCount = 1;
+static double duration = 10;
+static uint64_t thinkNs = 100 * 1000000ULL;
+static uint64_t pollIntervalNs = 0;
+static bool fullPolls = false;
+static int maxPlies = 40;
+static atomic_bool stopping = false;
+
+static void record(Samples* samples, uint64_t ns) {
+    if (samples->count == samples->capacity) {
+        samples->capacity = samples->capacity == 0 ? 4096 : samples->capacity * 2;
+        samples->samples = realloc(samples->samples, samples->capacity * sizeof(uint32_t));
+    }
+    uint64_t us = ns / 1000;
+    samples->samples[samples->count++] = us > UINT32_MAX ? UINT32_MAX : (uint32_t) us;
+}
+
+static int compare_samples(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*) a;
+    uint32_t y = *(const uint32_t*) b;
+    return x < y ? -1 : x > y;
+}
+
+// the responses come from the server's own writer, a key search is enough to read them
+static long long json_int(const char* body, const char* key) {
+    const char* at = strstr(body, key);
+    return at != nullptr ? strtoll(at + strlen(key), nullptr, 10) : -1;
+}
+
+static void json_string(const char* body, const char* key, char* value, size_t size) {
+    value[0] = '\0';
+    const char* at = strstr(body, key);
+    if (at == nullptr)
+        return;
+    at += strlen(key);
+    size_t length = 0;
+    while (at[length] != '"' && at[length] != '\0' && length + 1 < size)
+        length++;
+    memcpy(value, at, length);
+    value[length] = '\0';
+}
+
+static bool open_connection(Worker* w, SimConnection* conn, SimPlayer* player) {
+    conn->player = player;
+    conn->inFlight = -1;
+    conn->inLength = 0;
+    conn->outLength = 0;
+    conn->outSent = 0;
+
+    // a blocking connect to a local server is quicker than tracking half-open sockets
+    conn->fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (conn->fd < 0 || connect(conn->fd, (struct sockaddr*) &serverAddress, sizeof(serverAddress)) < 0) {
+        perror("connect has failed");
+        if (conn->fd >= 0)
+            close(conn->fd);
+        conn->fd = -1;
+        return false;
+    }
+    int one = 1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
+
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = conn};
+    return epoll_ctl(w->epollFd, EPOLL_CTL_ADD, conn->fd, &ev) == 0;
+}
+
+// drops whatever the connection was doing and starts over on a fresh one
+static void reconnect(Worker* w, SimConnection* conn) {
+    if (conn->fd >= 0)
+        close(conn->fd);
+    if (!open_connection(w, conn, conn->player))
+        exit(EXIT_FAILURE);
+}
+
+static void flush_request(SimConnection* conn) {
+    while (conn->outSent < conn->outLength) {
+        ssize_t sent = send(conn->fd, conn->out + conn->outSent, conn->outLength - conn->outSent, MSG_NOSIGNAL);
+        if (sent < 0) {
+            // the rest goes out on EPOLLOUT, a broken connection shows up as EOF on the read side
+            return;
+        }
+        conn->outSent += sent;
+    }
+}
+
+static void send_request(SimConnection* conn, int kind, const char* body) {
+    int length = snprintf(conn->out, sizeof(conn->out),
+                          "POST / HTTP/1.1\r\nHost: %s:%d\r\nContent-Type: application/json\r\n"
+                          "Content-Length: %zu\r\n\r\n%s", host, port, strlen(body), body);
+    conn->outLength = (size_t) length < sizeof(conn->out) ? (size_t) length : sizeof(conn->out) - 1;
+    conn->outSent = 0;
+    conn->inFlight = kind;
+    conn->sentAt = bench_now_ns();
+    flush_request(conn);
+}
+
+static void send_join(SimPlayer* p) {
+    char body[128];
+    // the browser sends the game id under this key when joining
+    snprintf(body, sizeof(body), "{\"messageType\":%d,\"gameId\":null,\"playerId\":null,\"game_id\":\"%s\"}",
+             JOIN_GAME, p->game->gameId);
+    send_request(&p->command, STAT_JOIN, body);
+}
+
+static void send_poll(SimPlayer* p) {
+    SimGame* g = p->game;
+    char body[160];
+    int length = snprintf(body, sizeof(body), "{\"messageType\":%d,\"gameId\":\"%s\",\"playerId\":\"%s\"",
+                          GAME_STATE_REQUEST, g->gameId, p->playerId);
+    int kind = STAT_POLL;
+    if (!fullPolls && p->lastSeenVersion >= 0) {
+        snprintf(body + length, sizeof(body) - length, ",\"lastSeenVersion\":%lld}", p->lastSeenVersion);
+        if (p->lastSeenVersion == g->version)
+            kind = STAT_LONG_POLL;
+    } else {
+        snprintf(body + length, sizeof(body) - length, "}");
+    }
+    send_request(&p->poll, kind, body);
+}
+
+static void send_move(Worker* w, SimGame* g, uint64_t now) {
+    MoveList moves;
+    generate_legal_moves(&g->position, &moves);
+    Move move = moves.moves[bench_random(&w->rng) % moves.count];
+    g->pendingMove = move;
+    g->lastMoveSentAt = now;
+
+    int from = MOVE_FROM(move);
+    int to = MOVE_TO(move);
+    char body[192];
+    int length = snprintf(body, sizeof(body),
+                          "{\"messageType\":%d,\"gameId\":\"%s\",\"playerId\":\"%s\","
+                          "\"move\":{\"from\":[%d,%d],\"to\":[%d,%d]}",
+                          MOVE_PIECE, g->gameId, g->players[g->position.sideToMove].playerId,
+                          SQUARE_X(from), SQUARE_Y(from), SQUARE_X(to), SQUARE_Y(to));
+    if (IS_PROMOTION(move))
+        snprintf(body + length, sizeof(body) - length, ",\"promotion\":%d}", PROMOTION_PIECE(move));
+    else
+        snprintf(body + length, sizeof(body) - length, "}");
+    send_request(&g->players[g->position.sideToMove].command, STAT_MOVE, body);
+}
+
+static void send_disconnect(SimPlayer* p) {
+    char body[128];
+    snprintf(body, sizeof(body), "{\"messageType\":%d,\"gameId\":\"%s\",\"playerId\":\"%s\"}",
+             DISCONNECT, p->game->gameId, p->playerId);
+    send_request(&p->command, STAT_DISCONNECT, body);
+}
+
+static void start_game(Worker* w, SimGame* g) {
+    snprintf(g->gameId, sizeof(g->gameId), "%x.%x.%x", (unsigned int) getpid() & 0xffff, w->index & 0x3f,
+             w->nextGameId++ & 0xffffff);
+    g->phase = GAME_JOINING;
+    for (int c = 0; c < 2; c++) {
+        g->players[c].playerId[0] = '\0';
+        g->players[c].lastSeenVersion = NO_VERSION;
+    }
+    // white joins first and creates the game, black joins once white is in
+    send_join(&g->players[0]);
+}
+
+static void maybe_restart(Worker* w, SimGame* g) {
+    if (g->phase != GAME_ENDING || g->pendingDisconnects > 0)
+        return;
+    if (g->players[0].poll.inFlight != -1 || g->players[1].poll.inFlight != -1)
+        return;
+    if (!atomic_load_explicit(&stopping, memory_order_relaxed))
+        start_game(w, g);
+}
+
+static void end_game(Worker* w, SimGame* g, uint64_t now) {
+    if (g->phase == GAME_PLAYING)
+        w->gamesPlayed++;
+    g->phase = GAME_ENDING;
+    g->pendingDisconnects = 0;
+    g->endedAt = now;
+    // only the side to move ever sends, so both command connections are idle here
+    for (int c = 0; c < 2; c++) {
+        if (g->players[c].playerId[0] != '\0') {
+            send_disconnect(&g->players[c]);
+            g->pendingDisconnects++;
+        }
+    }
+    maybe_restart(w, g);
+}
+
+static void disconnect_done(Worker* w, SimGame* g, uint64_t now) {
+    if (--g->pendingDisconnects == 0)
+        g->endedAt = now;
+    maybe_restart(w, g);
+}
+
+// a request that will not be answered anymore, the connection is replaced and the game moves on
+static void drop_request(Worker* w, SimConnection* conn, uint64_t now) {
+    SimPlayer* p = conn->player;
+    SimGame* g = p->game;
+    int kind = conn->inFlight;
+    bool isPoll = conn == &p->poll;
+    // polls racing the end of a game find it gone and get no answer, that is expected
+    if (kind != -1 && !(isPoll && g->phase == GAME_ENDING))
+        w->errors++;
+    reconnect(w, conn);
+    if (kind == STAT_DISCONNECT)
+        disconnect_done(w, g, now);
+    else if (isPoll)
+        maybe_restart(w, g);
+    else if (kind != -1)
+        end_game(w, g, now);
+}
+
+static void on_response(Worker* w, SimConnection* conn, const char* body, uint64_t now) {
+    SimPlayer* p = conn->player;
+    SimGame* g = p->game;
+    int kind = conn->inFlight;
+    conn->inFlight = -1;
+    record(&w->stats[kind], now - conn->sentAt);
+    int messageType = (int) json_int(body, "\"messageType\":");
+
+    switch (kind) {
+        case STAT_JOIN:
+            json_string(body, "\"playerId\":\"", p->playerId, sizeof(p->playerId));
+            if (p->playerId[0] == '\0' || (messageType != WAIT_FOR_OTHER_PLAYER && messageType != GAME_STARTED)) {
+                w->errors++;
+                end_game(w, g, now);
+            } else if (p->color == WHITE) {
+                send_join(&g->players[1]);
+            } else {
+                g->phase = GAME_PLAYING;
+                position_init(&g->position);
+                g->version = json_int(body, "\"version\":");
+                g->plies = 0;
+                g->moveDueAt = now + thinkNs;
+                g->players[0].pollDueAt = now;
+                g->players[1].pollDueAt = now;
+            }
+            break;
+        case STAT_MOVE:
+            if (messageType == MOVE_ACCEPTED) {
+                UndoInfo undo;
+                make_move(&g->position, g->pendingMove, &undo);
+                g->version++;
+                if (++g->plies >= maxPlies)
+                    end_game(w, g, now);
+                else
+                    g->moveDueAt = now + thinkNs;
+            } else {
+                // anything but GAME_ENDED means the server disagreed about the move
+                if (messageType != GAME_ENDED)
+                    w->errors++;
+                end_game(w, g, now);
+            }
+            break;
+        case STAT_DISCONNECT:
+            if (messageType != PLAYER_DISCONNECTED)
+                w->errors++;
+            disconnect_done(w, g, now);
+            break;
+        default: {
+            long long version = json_int(body, "\"version\":");
+            if (version >= 0)
+                p->lastSeenVersion = version;
+            if (kind == STAT_LONG_POLL && (messageType == GAME_STATE_DELTA || messageType == GAME_ENDED) &&
+                g->lastMoveSentAt >= conn->sentAt)
+                record(&w->stats[STAT_WAKE], now - g->lastMoveSentAt);
+            if (messageType < 0)
+                w->errors++;
+            p->pollDueAt = now + pollIntervalNs;
+            maybe_restart(w, g);
+            break;
+        }
+    }
+}
+
+static void on_readable(Worker* w, SimConnection* conn) {
+    bool closed = false;
+    while (true) {
+        // one byte is kept for the terminator the body is searched with
+        ssize_t received = recv(conn->fd, conn->in + conn->inLength, sizeof(conn->in) - 1 - conn->inLength, 0);
+        if (received > 0) {
+            conn->inLength += received;
+            if (conn->inLength < sizeof(conn->in) - 1)
+                continue;
+        } else if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+            closed = true;
+        }
+        break;
+    }
+
+    conn->in[conn->inLength] = '\0';
+    char* headerEnd = strstr(conn->in, "\r\n\r\n");
+    if (headerEnd != nullptr && conn->inFlight != -1) {
+        long long contentLength = json_int(conn->in, "Content-Length: ");
+        size_t responseLength = headerEnd + 4 - conn->in + (contentLength > 0 ? contentLength : 0);
+        if (responseLength <= conn->inLength) {
+            char* body = headerEnd + 4;
+            char saved = conn->in[responseLength];
+            conn->in[responseLength] = '\0';
+            if (strncmp(conn->in, "HTTP/1.1 200", 12) != 0)
+                body = conn->in + responseLength;
+            on_response(w, conn, body, bench_now_ns());
+            conn->in[responseLength] = saved;
+            memmove(conn->in, conn->in + responseLength, conn->inLength - responseLength);
+            conn->inLength -= responseLength;
+            if (closed)
+                reconnect(w, conn);
+            return;
+        }
+    }
+
+    // a full buffer without a whole response cannot become one
+    if (closed || conn->inLength == sizeof(conn->in) - 1)
+        drop_request(w, conn, bench_now_ns());
+}
+
+static void run_schedule(Worker* w, uint64_t now) {
+    for (int i = 0; i < w->gameCount; i++) {
+        SimGame* g = &w->games[i];
+        for (int c = 0; c < 2; c++) {
+            SimPlayer* p = &g->players[c];
+            if (p->command.inFlight != -1 && now - p->command.sentAt > REQUEST_TIMEOUT_NS)
+                drop_request(w, &p->command, now);
+            if (p->poll.inFlight != -1 && now - p->poll.sentAt > REQUEST_TIMEOUT_NS)
+                drop_request(w, &p->poll, now);
+        }
+
+        if (g->phase == GAME_ENDING && g->pendingDisconnects == 0 && now - g->endedAt > END_GRACE_NS) {
+            for (int c = 0; c < 2; c++) {
+                if (g->players[c].poll.inFlight != -1)
+                    drop_request(w, &g->players[c].poll, now);
+            }
+        }
+        if (g->phase != GAME_PLAYING)
+            continue;
+
+        SimPlayer* mover = &g->players[g->position.sideToMove];
+        if (mover->command.inFlight == -1 && now >= g->moveDueAt)
+            send_move(w, g, now);
+        for (int c = 0; c < 2; c++) {
+            SimPlayer* p = &g->players[c];
+            if (p->poll.inFlight == -1 && now >= p->pollDueAt)
+                send_poll(p);
+        }
+    }
+}
+
+static int run_worker(void* arg) {
+    Worker* w = arg;
+    struct epoll_event events[MAX_EVENTS];
+    for (int i = 0; i < w->gameCount; i++)
+        start_game(w, &w->games[i]);
+
+    while (!atomic_load_explicit(&stopping, memory_order_relaxed)) {
+        int n = epoll_wait(w->epollFd, events, MAX_EVENTS, TICK_MS);
+        for (int i = 0; i < n; i++) {
+            SimConnection* conn = events[i].data.ptr;
+            if (events[i].events & EPOLLOUT)
+                flush_request(conn);
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                on_readable(w, conn);
+        }
+        run_schedule(w, bench_now_ns());
+    }
+    return 0;
+}
+
+static bool setup_worker(Worker* w, int index, int first, int count) {
+    w->index = index;
+    w->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    w->games = calloc(count, sizeof(SimGame));
+    w->gameCount = count;
+    w->rng = 0x9E3779B97F4A7C15ULL * (index + 1);
+    w->nextGameId = first;
+    for (int i = 0; i < count; i++) {
+        SimGame* g = &w->games[i];
+        for (int c = 0; c < 2; c++) {
+            SimPlayer* p = &g->players[c];
+            p->game = g;
+            p->color = c == 0 ? WHITE : BLACK;
+            if (!open_connection(w, &p->command, p) || !open_connection(w, &p->poll, p))
+                return false;
+        }
+    }
+    return true;
+}
+
+// false if the page cannot be read or has no system call counter, the report then leaves it out
+static bool scrape_metrics(ServerCounters* counters) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*) &serverAddress, sizeof(serverAddress)) < 0) {
+        if (fd >= 0)
+            close(fd);
+        return false;
+    }
+    const char* request = "GET /metrics HTTP/1.1\r\nConnection: close\r\n\r\n";
+    bool sent = write(fd, request, strlen(request)) == (ssize_t) strlen(request);
+
+    static char text[METRICS_BUFFER];
+    size_t length = 0;
+    ssize_t n;
+    while (sent && length < sizeof(text) - 1 && (n = read(fd, text + length, sizeof(text) - 1 - length)) > 0)
+        length += n;
+    close(fd);
+    text[length] = '\0';
+
+    // every message type has its own request counter, the system calls are one total
+    bool found = false;
+    *counters = (ServerCounters) {0, 0};
+    for (const char* line = strstr(text, "\nchess_"); line != nullptr; line = strstr(line + 1, "\nchess_")) {
+        const char* value = strchr(line + 1, ' ');
+        if (value == nullptr)
+            break;
+        if (strncmp(line + 1, "chess_requests_total{", 21) == 0) {
+            counters->requests += strtoull(value + 1, nullptr, 10);
+        } else if (strncmp(line + 1, "chess_network_syscalls_total ", 29) == 0) {
+            counters->syscalls = strtoull(value + 1, nullptr, 10);
+            found = true;
+        }
+    }
+    return found;
+}
+
+static void report(Worker* workers, int count, double seconds, const ServerCounters* before,
+                   const ServerCounters* after) {
+    printf("%d games, %d threads, %.1f s, think %.0f ms, %s polls every %.0f ms\n", gameCount, threadCount, seconds,
+           (double) thinkNs / 1e6, fullPolls ? "full" : "long", (double) pollIntervalNs / 1e6);
+    printf("%-12s %10s %10s %10s %10s %10s %10s\n", "kind", "count", "per s", "p50 us", "p99 us", "p999 us",
+           "max us");
+
+    size_t requests = 0;
+    size_t games = 0;
+    size_t errors = 0;
+    for (int kind = 0; kind < STAT_KINDS; kind++) {
+        Samples all = {nullptr, 0, 0};
+        for (int i = 0; i < count; i++) {
+            for (size_t s = 0; s < workers[i].stats[kind].count; s++)
+                record(&all, (uint64_t) workers[i].stats[kind].samples[s] * 1000);
+        }
+        if (kind != STAT_WAKE)
+            requests += all.count;
+        if (all.count == 0) {
+            printf("%-12s %10d\n", STAT_NAMES[kind], 0);
+            continue;
+        }
+        qsort(all.samples, all.count, sizeof(uint32_t), compare_samples);
+        printf("%-12s %10zu %10.0f %10u %10u %10u %10u\n", STAT_NAMES[kind], all.count, (double) all.count / seconds,
+               all.samples[all.count * 50 / 100], all.samples[all.count * 99 / 100],
+               all.samples[all.count * 999 / 1000], all.samples[all.count - 1]);
+        free(all.samples);
+    }
+    for (int i = 0; i < count; i++) {
+        games += workers[i].gamesPlayed;
+        errors += workers[i].errors;
+    }
+    printf("%zu requests, %.0f per s, %zu games played, %zu errors\n", requests, (double) requests / seconds, games,
+           errors);
+    if (before != nullptr && after != nullptr && after->requests > before->requests) {
+        uint64_t served = after->requests - before->requests;
+        printf("server: %llu requests, %.2f system calls per request\n", (unsigned long long) served,
+               (double) (after->syscalls - before->syscalls) / (double) served);
+    }
+}
+
+int main(int argc, char** argv) {
+    int opt;
+    while ((opt = getopt(argc, argv, "g:d:t:i:Fm:T:h:p:")) != -1) {
+        switch (opt) {
+            case 'g':
+                gameCount = atoi(optarg);
+                break;
+            case 'd':
+                duration = atof(optarg);
+                break;
+            case 't':
+                thinkNs = (uint64_t) (atof(optarg) * 1e6);
+                break;
+            case 'i':
+                pollIntervalNs = (uint64_t) (atof(optarg) * 1e6);
+                break;
+            case 'F':
+                fullPolls = true;
+                break;
+            case 'm':
+                maxPlies = atoi(optarg);
+                break;
+            case 'T':
+                threadCount = atoi(optarg);
+                break;
+            case 'h':
+                host = optarg;
+                break;
+            case 'p':
+                port = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "usage: %s [-g games] [-d seconds] [-t think ms] [-i poll interval ms] [-F] "
+                                "[-m plies] [-T threads] [-h host] [-p port]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (gameCount < 1 || threadCount < 1 || threadCount > MAX_THREADS || maxPlies < 1 || duration <= 0) {
+        fprintf(stderr, "invalid arguments\n");
+        return EXIT_FAILURE;
+    }
+    if (threadCount > gameCount)
+        threadCount = gameCount;
+
+    struct addrinfo hints = {.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
+    struct addrinfo* address;
+    if (getaddrinfo(host, nullptr, &hints, &address) != 0) {
+        fprintf(stderr, "cannot resolve %s\n", host);
+        return EXIT_FAILURE;
+    }
+    serverAddress = *(struct sockaddr_in*) address->ai_addr;
+    serverAddress.sin_port = htons(port);
+    freeaddrinfo(address);
+
+    // four connections per game quickly go past the default soft limit
+    struct rlimit limit;
+    getrlimit(RLIMIT_NOFILE, &limit);
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+
+    bitboard_init();
+    static Worker workers[MAX_THREADS];
+    for (int i = 0; i < threadCount; i++) {
+        int first = gameCount * i / threadCount;
+        int last = gameCount * (i + 1) / threadCount;
+        if (!setup_worker(&workers[i], i, first, last - first))
+            return EXIT_FAILURE;
+    }
+
+    ServerCounters before;
+    ServerCounters after;
+    bool scraped = scrape_metrics(&before);
+
+    thrd_t threads[MAX_THREADS];
+    uint64_t start = bench_now_ns();
+    for (int i = 0; i < threadCount; i++)
+        thrd_create(&threads[i], run_worker, &workers[i]);
+    struct timespec sleep = {.tv_sec = (time_t) duration, .tv_nsec = (long) ((duration - (time_t) duration) * 1e9)};
+    thrd_sleep(&sleep, nullptr);
+    atomic_store(&stopping, true);
+    for (int i = 0; i < threadCount; i++)
+        thrd_join(threads[i], nullptr);
+
+    double seconds = (double) (bench_now_ns() - start) / 1e9;
+    scraped = scraped && scrape_metrics(&after);
+    report(workers, threadCount, seconds, scraped ? &before : nullptr, scraped ? &after : nullptr);
+    return 0;
+}
@@ -0,0 +1,72 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include "../movegen.h"
+#include "bench.h"
+
+typedef struct {
+    const char* name;
+    const char* fen;
+    int depths;
+    uint64_t expected[6];
+} PerftCase;
+
+/*
+ * Counts the leaf nodes of the legal move tree for the usual reference
+ * positions (chessprogramming.org "Perft Results") and compares them with the
+ * published numbers. Any mismatch means the generator is wrong somewhere.
+ * An optional argument caps the depth, e.g. "perft 3" for a quick check.
+ */
+static const PerftCase cases[] = {
+        {"startpos",  "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+                5, {20, 400, 8902, 197281, 4865609}},
+        {"kiwipete",  "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+                4, {48, 2039, 97862, 4085603}},
+        {"position3", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+                5, {14, 191, 2812, 43238, 674624}},
+        {"position4", "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+                4, {6, 264, 9467, 422333}},
+        {"position5", "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+                4, {44, 1486, 62379, 2103487}},
+        {"position6", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+                4, {46, 2079, 89890, 3894594}},
+};
+
+int main(int argc, char** argv) {
+    int max_depth = argc > 1 ? atoi(argv[1]) : 6;
+    int failures = 0;
+    uint64_t total_nodes = 0;
+    uint64_t total_ns = 0;
+
+    bitboard_init();
+
+    printf("%-10s %5s %12s %12s %14s %s\n", "position", "depth", "nodes", "expected", "nodes/s", "");
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        Position pos;
+        if (!position_from_fen(&pos, cases[i].fen)) {
+            printf("%-10s invalid fen\n", cases[i].name);
+            failures++;
+            continue;
+        }
+
+        for (int depth = 1; depth <= cases[i].depths && depth <= max_depth; depth++) {
+            uint64_t start = bench_now_ns();
+            uint64_t nodes = perft(&pos, depth);
+            uint64_t elapsed = bench_now_ns() - start;
+            bool ok = nodes == cases[i].expected[depth - 1];
+
+            total_nodes += nodes;
+            total_ns += elapsed;
+            if (!ok)
+                failures++;
+
+            printf("%-10s %5d %12lu %12lu %14.0f %s\n", cases[i].name, depth, nodes, cases[i].expected[depth - 1],
+                   (double) nodes * 1e9 / (double) (elapsed ? elapsed : 1), ok ? "ok" : "FAIL");
+        }
+    }
+
+    printf("total %lu nodes, %.0f nodes/s, %d failures\n", total_nodes,
+           (double) total_nodes * 1e9 / (double) (total_ns ? total_ns : 1), failures);
+
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,346 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../movegen.h"
+#include "../san.h"
+#include "bench.h"
+
+#define MAX_THREADS 64
+#define MAX_FEN_LENGTH 128
+
+typedef struct {
+    // index of the game in its file, counted from 1
+    uint64_t game;
+    // half-moves played before the illegal one
+    int ply;
+    char san[SAN_MAX_LENGTH];
+} Failure;
+
+// one thread's share of the file, whole games only
+typedef struct {
+    const char* data;
+    size_t start;
+    size_t end;
+    uint64_t games;
+    uint64_t moves;
+    Failure* failures;
+    int failureCount;
+    int failureCapacity;
+} Chunk;
+
+// the game being read, reset at every result token or new tag section
+typedef struct {
+    bool started;
+    bool positioned;
+    bool failed;
+    int ply;
+    char fen[MAX_FEN_LENGTH];
+    Position position;
+} GameState;
+
+/*
+ * Replays PGN archives on the server's own board: every SAN move is resolved
+ * with san_parse, checked with find_legal_move the way handle_move_piece
+ * checks a client's move, and played with make_move. The file is mapped and
+ * cut into one chunk per thread at game boundaries, so big archives are read
+ * straight from the page cache by all cores at once. Prints the first illegal
+ * move of every game that has one, then games/s and moves/s.
+ */
+
+static void add_failure(Chunk* chunk, GameState* game, const char* san, size_t length) {
+    if (chunk->failureCount == chunk->failureCapacity) {
+        chunk->failureCapacity = chunk->failureCapacity == 0 ? 64 : chunk->failureCapacity * 2;
+        chunk->failures = realloc(chunk->failures, sizeof(Failure) * chunk->failureCapacity);
+    }
+    Failure* failure = &chunk->failures[chunk->failureCount++];
+    failure->game = chunk->games + 1;
+    failure->ply = game->ply;
+    if (length >= SAN_MAX_LENGTH)
+        length = SAN_MAX_LENGTH - 1;
+    memcpy(failure->san, san, length);
+    failure->san[length] = '\0';
+    game->failed = true;
+}
+
+static void finish_game(Chunk* chunk, GameState* game) {
+    if (game->started || game->positioned)
+        chunk->games++;
+    game->started = false;
+    game->positioned = false;
+    game->failed = false;
+    game->ply = 0;
+    game->fen[0] = '\0';
+}
+
+static void play_san(Chunk* chunk, GameState* game, const char* san, size_t length) {
+    if (!game->positioned) {
+        game->positioned = true;
+        if (game->fen[0] == '\0')
+            position_init(&game->position);
+        else if (!position_from_fen(&game->position, game->fen))
+            add_failure(chunk, game, "FEN", 3);
+    }
+    if (game->failed)
+        return;
+
+    Move move = san_parse(&game->position, san, length);
+    // the same check a client's move goes through, so the archive exercises the server's rules
+    if (move != NO_MOVE) {
+        int promotion = IS_PROMOTION(move) ? PROMOTION_PIECE(move) : QUEEN;
+        move = find_legal_move(&game->position, MOVE_FROM(move), MOVE_TO(move), promotion);
+    }
+    if (move == NO_MOVE) {
+        add_failure(chunk, game, san, length);
+        return;
+    }
+
+    UndoInfo undo;
+    make_move(&game->position, move, &undo);
+    game->ply++;
+    chunk->moves++;
+}
+
+static size_t read_tag(GameState* game, const char* data, size_t at, size_t end) {
+    // [Name "value"], only FEN changes how the game is replayed
+    size_t close = at;
+    while (close < end && data[close] != ']' && data[close] != '\n')
+        close++;
+    if (close - at > 6 && memcmp(data + at, "[FEN \"", 6) == 0) {
+        size_t value = at + 6;
+        size_t value_end = value;
+        while (value_end < close && data[value_end] != '"')
+            value_end++;
+        size_t length = value_end - value < MAX_FEN_LENGTH ? value_end - value : MAX_FEN_LENGTH - 1;
+        memcpy(game->fen, data + value, length);
+        game->fen[length] = '\0';
+    }
+    return close < end ? close + 1 : end;
+}
+
+static size_t skip_variation(const char* data, size_t at, size_t end) {
+    int depth = 0;
+    while (at < end) {
+        char c = data[at++];
+        if (c == '(') {
+            depth++;
+        } else if (c == ')') {
+            if (--depth == 0)
+                return at;
+        } else if (c == '{') {
+            // comments may hold parentheses of their own
+            while (at < end && data[at] != '}')
+                at++;
+            at++;
+        }
+    }
+    return end;
+}
+
+static int replay_chunk(void* arg) {
+    Chunk* chunk = arg;
+    const char* data = chunk->data;
+    size_t end = chunk->end;
+    GameState game = {};
+    bool line_start = true;
+
+    for (size_t at = chunk->start; at < end;) {
+        char c = data[at];
+        if (c == '\n') {
+            line_start = true;
+            at++;
+            continue;
+        }
+        if (c == ' ' || c == '\t' || c == '\r') {
+            at++;
+            continue;
+        }
+        bool at_line_start = line_start;
+        line_start = false;
+
+        if (c == '[' && at_line_start) {
+            // a tag after moves starts the next game even if the last one had no result
+            if (game.positioned)
+                finish_game(chunk, &game);
+            game.started = true;
+            at = read_tag(&game, data, at, end);
+        } else if (c == '{') {
+            while (at < end && data[at] != '}')
+                at++;
+            at++;
+        } else if (c == ';' || (c == '%' && at_line_start)) {
+            while (at < end && data[at] != '\n')
+                at++;
+        } else if (c == '(') {
+            at = skip_variation(data, at, end);
+        } else {
+            size_t token = at;
+            while (at < end && data[at] != ' ' && data[at] != '\n' && data[at] != '\r' && data[at] != '\t' &&
+                   data[at] != '{' && data[at] != '(' && data[at] != ')' && data[at] != ';')
+                at++;
+            size_t length = at - token;
+            const char* text = data + token;
+
+            if ((length == 3 && (memcmp(text, "1-0", 3) == 0 || memcmp(text, "0-1", 3) == 0)) ||
+                (length == 7 && memcmp(text, "1/2-1/2", 7) == 0) || (length == 1 && text[0] == '*')) {
+                finish_game(chunk, &game);
+            } else if (text[0] == '$' || text[0] == ')') {
+                // NAGs and stray closing parentheses
+            } else {
+                // move numbers, "12." or "12...", may be glued to the move that follows
+                size_t skip = 0;
+                if (text[0] >= '1' && text[0] <= '9') {
+                    while (skip < length && text[skip] >= '0' && text[skip] <= '9')
+                        skip++;
+                    while (skip < length && text[skip] == '.')
+                        skip++;
+                }
+                if (skip < length)
+                    play_san(chunk, &game, text + skip, length - skip);
+            }
+        }
+    }
+    finish_game(chunk, &game);
+    return 0;
+}
+
+static size_t next_game(const char* data, size_t at, size_t length) {
+    // a game starts with its tag section, the first tag right after a newline
+    while (at < length) {
+        const char* line = memchr(data + at, '\n', length - at);
+        if (line == nullptr)
+            return length;
+        at = (size_t) (line - data) + 1;
+        if (at >= length || data[at] != '[')
+            continue;
+        // the first tag of a section, not one following another tag
+        size_t previous = at - 1;
+        if (previous > 0 && data[previous - 1] == '\r')
+            previous--;
+        if (previous == 0 || data[previous - 1] != ']')
+            return at;
+    }
+    return length;
+}
+
+static bool replay_file(const char* path, int thread_count, bool quiet, uint64_t* games, uint64_t* moves,
+                        uint64_t* illegal) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        perror(path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror(path);
+        close(fd);
+        return false;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return true;
+    }
+    size_t length = (size_t) st.st_size;
+    const char* data = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap has failed");
+        return false;
+    }
+    madvise((void*) data, length, MADV_SEQUENTIAL);
+
+    Chunk chunks[MAX_THREADS] = {};
+    size_t start = 0;
+    for (int i = 0; i < thread_count; i++) {
+        chunks[i].data = data;
+        chunks[i].start = start;
+        chunks[i].end = i == thread_count - 1 ? length : next_game(data, length / thread_count * (i + 1), length);
+        if (chunks[i].end < start)
+            chunks[i].end = start;
+        start = chunks[i].end;
+    }
+
+    thrd_t threads[MAX_THREADS];
+    bool started[MAX_THREADS] = {};
+    for (int i = 1; i < thread_count; i++)
+        started[i] = thrd_create(&threads[i], replay_chunk, &chunks[i]) == thrd_success;
+    // a chunk whose thread could not be started is replayed here instead
+    for (int i = 0; i < thread_count; i++) {
+        if (!started[i])
+            replay_chunk(&chunks[i]);
+    }
+    for (int i = 1; i < thread_count; i++) {
+        if (started[i])
+            thrd_join(threads[i], nullptr);
+    }
+
+    // game numbers are per chunk until here
+    uint64_t offset = 0;
+    for (int i = 0; i < thread_count; i++) {
+        for (int j = 0; j < chunks[i].failureCount; j++) {
+            Failure* failure = &chunks[i].failures[j];
+            if (!quiet)
+                printf("%s: game %llu, move %d%s %s is illegal\n", path, (unsigned long long) (offset + failure->game),
+                       failure->ply / 2 + 1, failure->ply % 2 == 0 ? "." : "...", failure->san);
+        }
+        offset += chunks[i].games;
+        *games += chunks[i].games;
+        *moves += chunks[i].moves;
+        *illegal += (uint64_t) chunks[i].failureCount;
+        free(chunks[i].failures);
+    }
+
+    munmap((void*) data, length);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    // -t sets the number of threads, all cores by default, -q leaves out the per-game lines
+    int thread_count = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    bool quiet = false;
+    int option;
+    while ((option = getopt(argc, argv, "t:q")) != -1) {
+        switch (option) {
+            case 't':
+                thread_count = atoi(optarg);
+                break;
+            case 'q':
+                quiet = true;
+                break;
+            default:
+                printf("usage: %s [-t threads] [-q] file.pgn...\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc) {
+        printf("usage: %s [-t threads] [-q] file.pgn...\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    if (thread_count < 1)
+        thread_count = 1;
+    if (thread_count > MAX_THREADS)
+        thread_count = MAX_THREADS;
+
+    bitboard_init();
+
+    uint64_t games = 0;
+    uint64_t moves = 0;
+    uint64_t illegal = 0;
+    uint64_t start = bench_now_ns();
+    for (int i = optind; i < argc; i++) {
+        if (!replay_file(argv[i], thread_count, quiet, &games, &moves, &illegal))
+            return EXIT_FAILURE;
+    }
+    uint64_t elapsed = bench_now_ns() - start;
+    double seconds = (double) (elapsed ? elapsed : 1) / 1e9;
+
+    printf("%llu games, %llu moves, %llu with an illegal move in %.3f s on %d threads: %.0f games/s, %.0f moves/s\n",
+           (unsigned long long) games, (unsigned long long) moves, (unsigned long long) illegal, seconds,
+           thread_count, (double) games / seconds, (double) moves / seconds);
+    return illegal == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <string.h>
+#include "protocol.h"
+#include "chess_rules.h"
+#include "movegen.h"
+#include "matchmaking.h"
+
+// bounds checked cursor over a received payload
+typedef struct {
+    const uint8_t* data;
+    size_t length;
+    size_t offset;
+    bool failed;
+} Reader;
+
+static unsigned int read_uint(Reader* reader, int bytes);
+
+static void read_string(Reader* reader, char* value, size_t size);
+
+static uint8_t* write_uint(uint8_t* at, uint64_t value, int bytes);
+
+static uint8_t* write_string(uint8_t* at, const char* value);
+
+static uint8_t wire_square(int square);
+
+static uint8_t* write_state(uint8_t* at, const Message* message);
+
+unsigned int read_uint(Reader* reader, int bytes) {
+    if (reader->length - reader->offset < (size_t) bytes) {
+        reader->failed = true;
+        return 0;
+    }
+
+    unsigned int value = 0;
+    for (int i = 0; i < bytes; i++)
+        value = value << 8 | reader->data[reader->offset++];
+    return value;
+}
+
+void read_string(Reader* reader, char* value, size_t size) {
+    size_t length = read_uint(reader, 1);
+    if (reader->failed || length >= size || reader->length - reader->offset < length) {
+        reader->failed = true;
+        value[0] = '\0';
+        return;
+    }
+
+    memcpy(value, reader->data + reader->offset, length);
+    value[length] = '\0';
+    reader->offset += length;
+}
+
+bool decode_binary_request(const uint8_t* payload, size_t length, Request* request) {
+    Reader reader = {payload, length, 0, false};
+    request->messageType = (int) read_uint(&reader, 2);
+    request->gameId[0] = '\0';
+    request->playerId[0] = '\0';
+    request->lastSeenVersion = NO_VERSION;
+    request->promotion = QUEEN;
+    request->bucket = 0;
+
+    switch (request->messageType) {
+        case JOIN_GAME:
+        case JOIN_COMPUTER_GAME:
+            read_string(&reader, request->gameId, sizeof(request->gameId));
+            break;
+        case GAME_STATE_REQUEST: {
+            read_string(&reader, request->gameId, sizeof(request->gameId));
+            read_string(&reader, request->playerId, sizeof(request->playerId));
+            unsigned int version = read_uint(&reader, 4);
+            if (version != BINARY_NO_VERSION)
+                request->lastSeenVersion = version;
+            break;
+        }
+        case MOVE_PIECE: {
+            read_string(&reader, request->gameId, sizeof(request->gameId));
+            read_string(&reader, request->playerId, sizeof(request->playerId));
+            unsigned int from = read_uint(&reader, 1);
+            unsigned int to = read_uint(&reader, 1);
+            unsigned int promotion = read_uint(&reader, 1);
+            // out of range squares land off the board and are refused as illegal moves
+            request->fromX = (int) (from & 7);
+            request->fromY = (int) (from >> 3);
+            request->toX = (int) (to & 7);
+            request->toY = (int) (to >> 3);
+            if (promotion != 0)
+                request->promotion = (int) promotion;
+            break;
+        }
+        case DISCONNECT:
+            read_string(&reader, request->gameId, sizeof(request->gameId));
+            read_string(&reader, request->playerId, sizeof(request->playerId));
+            break;
+        case WATCH_GAME: {
+            read_string(&reader, request->gameId, sizeof(request->gameId));
+            unsigned int version = read_uint(&reader, 4);
+            if (version != BINARY_NO_VERSION)
+                request->lastSeenVersion = version;
+            break;
+        }
+        case FIND_MATCH:
+            request->bucket = (int) read_uint(&reader, 1);
+            if (request->bucket >= MATCH_BUCKETS)
+                reader.failed = true;
+            break;
+        default:
+            break;
+    }
+
+    if (reader.failed)
+        printf("malformed binary message\n");
+    return !reader.failed;
+}
+
+uint8_t* write_uint(uint8_t* at, uint64_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--)
+        *at++ = (uint8_t) (value >> (8 * i));
+    return at;
+}
+
+uint8_t* write_string(uint8_t* at, const char* value) {
+    size_t length = strlen(value);
+    *at++ = (uint8_t) length;
+    memcpy(at, value, length);
+    return at + length;
+}
+
+uint8_t wire_square(int square) {
+    return (uint8_t) (SQUARE_Y(square) * 8 + SQUARE_X(square));
+}
+
+void write_packed_board(uint8_t* board, const Position* position) {
+    for (int i = 0; i < BINARY_BOARD_SIZE; i++) {
+        int y = i / 4;
+        int x = i % 4 * 2;
+        board[i] = (uint8_t) (piece_at(position, SQUARE(x, y)) | piece_at(position, SQUARE(x + 1, y)) << 4);
+    }
+}
+
+void encode_binary_message(ByteBuffer* out, const Message* message) {
+    // ids are short and the delta is capped, so the worst case is known up front
+    byte_buffer_reserve(out, 2 + 2 * 256 + 24 + BINARY_BOARD_SIZE + 3 * message->moveCount);
+    uint8_t* start = (uint8_t*) out->data + out->length;
+    uint8_t* at = write_uint(start, message->messageType, 2);
+    at = write_string(at, message->gameId);
+    at = write_string(at, message->playerId);
+
+    switch (message->messageType) {
+        case WAIT_FOR_OTHER_PLAYER:
+        case GAME_STARTED:
+            at = write_uint(at, message->playerColor, 1);
+            at = write_uint(at, message->version, 4);
+            break;
+        case GAME_STATE_RESPONSE:
+            at = write_uint(at, message->currentTurn, 1);
+            at = write_uint(at, message->playerColor, 1);
+            at = write_state(at, message);
+            break;
+        case GAME_ENDED:
+            at = write_uint(at, message->winner, 1);
+            at = write_state(at, message);
+            break;
+        case GAME_STATE_DELTA:
+            at = write_uint(at, message->currentTurn, 1);
+            at = write_uint(at, message->playerColor, 1);
+            at = write_uint(at, message->baseVersion, 4);
+            at = write_uint(at, message->version, 4);
+            at = write_uint(at, message->position->hash, 8);
+            at = write_uint(at, message->moveCount, 1);
+            for (int i = 0; i < message->moveCount; i++) {
+                Move move = message->moves[i].move;
+                *at++ = wire_square(MOVE_FROM(move));
+                *at++ = wire_square(MOVE_TO(move));
+                *at++ = (uint8_t) (IS_PROMOTION(move) ? PROMOTION_PIECE(move) : 0);
+            }
+            break;
+        case GAME_STATE_UNCHANGED:
+            at = write_uint(at, message->version, 4);
+            break;
+        case SPECTATOR_STATE:
+            at = write_uint(at, message->currentTurn, 1);
+            // -1 while the game goes on truncates to 0xff
+            at = write_uint(at, message->winner, 1);
+            at = write_state(at, message);
+            break;
+        default:
+            break;
+    }
+
+    out->length += at - start;
+}
+
+uint8_t* write_state(uint8_t* at, const Message* message) {
+    if (message->state != nullptr) {
+        memcpy(at, message->state, message->stateLength);
+        return at + message->stateLength;
+    }
+    at = write_uint(at, message->version, 4);
+    write_packed_board(at, message->position);
+    return write_uint(at + BINARY_BOARD_SIZE, message->position->hash, 8);
+}
+
+void encode_binary_state(ByteBuffer* out, unsigned int version, const Position* position) {
+    byte_buffer_reserve(out, 4 + BINARY_BOARD_SIZE + 8);
+    uint8_t* start = (uint8_t*) out->data + out->length;
+    Message message = {.version = version, .position = position};
+    out->length += write_state(start, &message) - start;
+}
+
+size_t binary_frame_begin(ByteBuffer* out) {
+    byte_buffer_reserve(out, BINARY_FRAME_HEADER);
+    out->length += BINARY_FRAME_HEADER;
+    return out->length;
+}
+
+size_t binary_frame_end(ByteBuffer* out, size_t payloadStart) {
+    size_t start = payloadStart - BINARY_FRAME_HEADER;
+    write_uint((uint8_t*) out->data + start, out->length - payloadStart, BINARY_FRAME_HEADER);
+    return start;
+}
+
+size_t binary_write_frame_header(ByteBuffer* out, size_t payloadLength) {
+    size_t start = binary_frame_begin(out) - BINARY_FRAME_HEADER;
+    write_uint((uint8_t*) out->data + start, payloadLength, BINARY_FRAME_HEADER);
+    return start;
+}
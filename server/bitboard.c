@@ -0,0 +1,386 @@
+#include <stdio.h>
+#include <string.h>
+#include "bitboard.h"
+#include "common.h"
+#include "zobrist.h"
+
+#ifdef __BMI2__
+#include <immintrin.h>
+#endif
+
+#define ROOK_TABLE_SIZE 102400
+#define BISHOP_TABLE_SIZE 5248
+
+typedef struct {
+    Bitboard mask;
+    Bitboard magic;
+    Bitboard* attacks;
+    int shift;
+} SliderEntry;
+
+static Bitboard knightTable[64];
+static Bitboard kingTable[64];
+static Bitboard pawnTable[2][64];
+
+static Bitboard betweenTable[64][64];
+static Bitboard lineTable[64][64];
+
+static SliderEntry rookEntries[64];
+static SliderEntry bishopEntries[64];
+static Bitboard rookAttackTable[ROOK_TABLE_SIZE];
+static Bitboard bishopAttackTable[BISHOP_TABLE_SIZE];
+
+static const int rookDirections[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+static const int bishopDirections[4][2] = {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
+
+static Bitboard step_attacks(int sq, const int steps[][2], int count);
+
+static Bitboard sliding_attacks(int sq, Bitboard occupied, const int directions[4][2]);
+
+static void init_slider(SliderEntry* entries, Bitboard* table, const int directions[4][2]);
+
+static inline size_t slider_index(const SliderEntry* entry, Bitboard occupied) {
+#ifdef __BMI2__
+    return _pext_u64(occupied, entry->mask);
+#else
+    return ((occupied & entry->mask) * entry->magic) >> entry->shift;
+#endif
+}
+
+Bitboard step_attacks(int sq, const int steps[][2], int count) {
+    Bitboard attacks = 0;
+    int file = sq & 7;
+    int rank = sq >> 3;
+    for (int i = 0; i < count; i++) {
+        int f = file + steps[i][0];
+        int r = rank + steps[i][1];
+        if (f >= 0 && f < 8 && r >= 0 && r < 8)
+            attacks |= BIT(r * 8 + f);
+    }
+    return attacks;
+}
+
+Bitboard sliding_attacks(int sq, Bitboard occupied, const int directions[4][2]) {
+    Bitboard attacks = 0;
+    for (int d = 0; d < 4; d++) {
+        int f = (sq & 7) + directions[d][0];
+        int r = (sq >> 3) + directions[d][1];
+        while (f >= 0 && f < 8 && r >= 0 && r < 8) {
+            attacks |= BIT(r * 8 + f);
+            if (occupied & BIT(r * 8 + f))
+                break;
+            f += directions[d][0];
+            r += directions[d][1];
+        }
+    }
+    return attacks;
+}
+
+void init_slider(SliderEntry* entries, Bitboard* table, const int directions[4][2]) {
+    static Bitboard occupancies[4096];
+    static Bitboard references[4096];
+#ifndef __BMI2__
+    // state of the magic search, kept across squares and across the rook and bishop calls,
+    // an attempt counter restarting at 0 would find the epochs the rook search left behind
+    static int epoch[4096];
+    static int attempt = 0;
+    uint64_t seed = 0x2137A5F3C0FFEEULL;
+#endif
+    size_t offset = 0;
+
+    for (int sq = 0; sq < 64; sq++) {
+        // edge squares never block anything, leave them out of the relevant occupancy
+        Bitboard edges = ((RANK_1 | RANK_8) & ~(RANK_1 << (8 * (sq >> 3)))) |
+                         ((FILE_A | FILE_H) & ~(FILE_A << (sq & 7)));
+        SliderEntry* entry = &entries[sq];
+        entry->mask = sliding_attacks(sq, 0, directions) & ~edges;
+        entry->shift = 64 - __builtin_popcountll(entry->mask);
+        entry->attacks = table + offset;
+
+        int size = 0;
+        Bitboard subset = 0;
+        do {
+            occupancies[size] = subset;
+            references[size] = sliding_attacks(sq, subset, directions);
+            size++;
+            subset = (subset - entry->mask) & entry->mask;
+        } while (subset != 0);
+        offset += size;
+
+#ifdef __BMI2__
+        for (int i = 0; i < size; i++) {
+            entry->attacks[slider_index(entry, occupancies[i])] = references[i];
+        }
+#else
+        // search for a multiplier that maps every relevant occupancy without destructive collisions
+        for (int i = 0; i < size;) {
+            entry->magic = 0;
+            while (__builtin_popcountll((entry->mask * entry->magic) >> 56) < 6) {
+                uint64_t r[3];
+                for (int k = 0; k < 3; k++) {
+                    seed ^= seed >> 12;
+                    seed ^= seed << 25;
+                    seed ^= seed >> 27;
+                    r[k] = seed * 0x2545F4914F6CDD1DULL;
+                }
+                entry->magic = r[0] & r[1] & r[2];
+            }
+
+            attempt++;
+            for (i = 0; i < size; i++) {
+                size_t index = slider_index(entry, occupancies[i]);
+                if (epoch[index] < attempt) {
+                    epoch[index] = attempt;
+                    entry->attacks[index] = references[i];
+                } else if (entry->attacks[index] != references[i]) {
+                    break;
+                }
+            }
+        }
+#endif
+    }
+}
+
+void bitboard_init() {
+    static bool initialized = false;
+    if (initialized)
+        return;
+    initialized = true;
+
+    static const int knightSteps[8][2] = {{1, 2}, {2, 1}, {2, -1}, {1, -2}, {-1, -2}, {-2, -1}, {-2, 1}, {-1, 2}};
+    static const int kingSteps[8][2] = {{1, 0}, {1, 1}, {0, 1}, {-1, 1}, {-1, 0}, {-1, -1}, {0, -1}, {1, -1}};
+    static const int whitePawnSteps[2][2] = {{-1, 1}, {1, 1}};
+    static const int blackPawnSteps[2][2] = {{-1, -1}, {1, -1}};
+
+    for (int sq = 0; sq < 64; sq++) {
+        knightTable[sq] = step_attacks(sq, knightSteps, 8);
+        kingTable[sq] = step_attacks(sq, kingSteps, 8);
+        pawnTable[WHITE][sq] = step_attacks(sq, whitePawnSteps, 2);
+        pawnTable[BLACK][sq] = step_attacks(sq, blackPawnSteps, 2);
+    }
+
+    zobrist_init();
+    init_slider(rookEntries, rookAttackTable, rookDirections);
+    init_slider(bishopEntries, bishopAttackTable, bishopDirections);
+
+    for (int a = 0; a < 64; a++) {
+        for (int b = 0; b < 64; b++) {
+            if (a == b)
+                continue;
+            if (rook_attacks(a, 0) & BIT(b)) {
+                betweenTable[a][b] = rook_attacks(a, BIT(b)) & rook_attacks(b, BIT(a));
+                lineTable[a][b] = (rook_attacks(a, 0) & rook_attacks(b, 0)) | BIT(a) | BIT(b);
+            } else if (bishop_attacks(a, 0) & BIT(b)) {
+                betweenTable[a][b] = bishop_attacks(a, BIT(b)) & bishop_attacks(b, BIT(a));
+                lineTable[a][b] = (bishop_attacks(a, 0) & bishop_attacks(b, 0)) | BIT(a) | BIT(b);
+            }
+        }
+    }
+}
+
+Bitboard knight_attacks(int sq) {
+    return knightTable[sq];
+}
+
+Bitboard king_attacks(int sq) {
+    return kingTable[sq];
+}
+
+Bitboard pawn_attacks(int color, int sq) {
+    return pawnTable[color][sq];
+}
+
+Bitboard bishop_attacks(int sq, Bitboard occupied) {
+    const SliderEntry* entry = &bishopEntries[sq];
+    return entry->attacks[slider_index(entry, occupied)];
+}
+
+Bitboard rook_attacks(int sq, Bitboard occupied) {
+    const SliderEntry* entry = &rookEntries[sq];
+    return entry->attacks[slider_index(entry, occupied)];
+}
+
+Bitboard queen_attacks(int sq, Bitboard occupied) {
+    return bishop_attacks(sq, occupied) | rook_attacks(sq, occupied);
+}
+
+Bitboard between_squares(int a, int b) {
+    return betweenTable[a][b];
+}
+
+Bitboard line_through(int a, int b) {
+    return lineTable[a][b];
+}
+
+void position_init(Position* pos) {
+    int board[8][8];
+    init_board(board);
+    position_set_board(pos, board);
+    pos->castlingRights = WHITE_KINGSIDE | WHITE_QUEENSIDE | BLACK_KINGSIDE | BLACK_QUEENSIDE;
+    pos->hash = position_hash(pos);
+}
+
+void position_set_board(Position* pos, int board[8][8]) {
+    memset(pos, 0, sizeof(Position));
+    pos->sideToMove = WHITE;
+    pos->epSquare = NO_SQUARE;
+    pos->fullmoveNumber = 1;
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            if (get_piece_type(board[y][x]) != EMPTY)
+                position_put_piece(pos, SQUARE(x, y), board[y][x]);
+        }
+    }
+    pos->hash = position_hash(pos);
+}
+
+bool position_from_fen(Position* pos, const char* fen) {
+    static const char pieceLetters[] = "pnbrqk";
+    memset(pos, 0, sizeof(Position));
+    pos->epSquare = NO_SQUARE;
+    pos->fullmoveNumber = 1;
+
+    int rank = 7;
+    int file = 0;
+    const char* c = fen;
+    for (; *c != '\0' && *c != ' '; c++) {
+        if (*c == '/') {
+            rank--;
+            file = 0;
+        } else if (*c >= '1' && *c <= '8') {
+            file += *c - '0';
+        } else {
+            const char* letter = strchr(pieceLetters, *c | 0x20);
+            if (letter == NULL || rank < 0 || file > 7)
+                return false;
+            int color = *c >= 'a' ? BLACK : WHITE;
+            position_put_piece(pos, rank * 8 + file, MAKE_PIECE(PAWN + (int) (letter - pieceLetters), color));
+            file++;
+        }
+    }
+    if (*c++ != ' ')
+        return false;
+
+    pos->sideToMove = *c == 'b' ? BLACK : WHITE;
+    c++;
+    while (*c == ' ')
+        c++;
+
+    for (; *c != '\0' && *c != ' '; c++) {
+        switch (*c) {
+            case 'K':
+                pos->castlingRights |= WHITE_KINGSIDE;
+                break;
+            case 'Q':
+                pos->castlingRights |= WHITE_QUEENSIDE;
+                break;
+            case 'k':
+                pos->castlingRights |= BLACK_KINGSIDE;
+                break;
+            case 'q':
+                pos->castlingRights |= BLACK_QUEENSIDE;
+                break;
+            default:
+                break;
+        }
+    }
+    while (*c == ' ')
+        c++;
+
+    if (*c >= 'a' && *c <= 'h' && c[1] >= '1' && c[1] <= '8') {
+        int ep = (c[1] - '1') * 8 + (*c - 'a');
+        // same rule as make_move: only remember squares an enemy pawn can actually take on
+        if (pawn_attacks(!pos->sideToMove, ep) & pos->pieces[pos->sideToMove][PIECE_INDEX(PAWN)])
+            pos->epSquare = (int8_t) ep;
+        c += 2;
+    } else if (*c == '-') {
+        c++;
+    }
+
+    int halfmove;
+    int fullmove;
+    if (sscanf(c, "%d %d", &halfmove, &fullmove) == 2) {
+        pos->halfmoveClock = halfmove;
+        pos->fullmoveNumber = fullmove;
+    }
+    pos->hash = position_hash(pos);
+
+    return __builtin_popcountll(pos->pieces[WHITE][PIECE_INDEX(KING)]) == 1 &&
+           __builtin_popcountll(pos->pieces[BLACK][PIECE_INDEX(KING)]) == 1;
+}
+
+void position_to_board(const Position* pos, int board[8][8]) {
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            board[y][x] = pos->squares[SQUARE(x, y)];
+        }
+    }
+}
+
+void position_put_piece(Position* pos, int sq, int piece) {
+    int color = get_color(piece);
+    pos->pieces[color][PIECE_INDEX(get_piece_type(piece))] |= BIT(sq);
+    pos->occupied[color] |= BIT(sq);
+    pos->hash ^= zobrist.pieces[color][PIECE_INDEX(get_piece_type(piece))][sq];
+    pos->squares[sq] = piece;
+}
+
+void position_remove_piece(Position* pos, int sq) {
+    int piece = pos->squares[sq];
+    int color = get_color(piece);
+    pos->pieces[color][PIECE_INDEX(get_piece_type(piece))] &= ~BIT(sq);
+    pos->occupied[color] &= ~BIT(sq);
+    pos->hash ^= zobrist.pieces[color][PIECE_INDEX(get_piece_type(piece))][sq];
+    pos->squares[sq] = EMPTY;
+}
+
+void position_move_piece(Position* pos, int from, int to) {
+    int piece = pos->squares[from];
+    if (pos->squares[to] != EMPTY)
+        position_remove_piece(pos, to);
+    position_remove_piece(pos, from);
+    position_put_piece(pos, to, piece);
+}
+
+Bitboard piece_targets(const Position* pos, int sq) {
+    int piece = pos->squares[sq];
+    int color = get_color(piece);
+    Bitboard occupied = all_pieces(pos);
+    Bitboard targets;
+
+    switch (get_piece_type(piece)) {
+        case PAWN: {
+            Bitboard empty = ~occupied;
+            Bitboard single;
+            Bitboard twice;
+            if (color == WHITE) {
+                single = BIT(sq) << 8 & empty;
+                twice = (single & RANK_3) << 8 & empty;
+            } else {
+                single = BIT(sq) >> 8 & empty;
+                twice = (single & RANK_6) >> 8 & empty;
+            }
+            targets = single | twice | (pawn_attacks(color, sq) & pos->occupied[!color]);
+            break;
+        }
+        case KNIGHT:
+            targets = knight_attacks(sq);
+            break;
+        case BISHOP:
+            targets = bishop_attacks(sq, occupied);
+            break;
+        case ROOK:
+            targets = rook_attacks(sq, occupied);
+            break;
+        case QUEEN:
+            targets = queen_attacks(sq, occupied);
+            break;
+        case KING:
+            targets = king_attacks(sq);
+            break;
+        default:
+            return 0;
+    }
+
+    return targets & ~pos->occupied[color];
+}
@@ -0,0 +1,100 @@
+#ifndef SERVER_BITBOARD_H
+#define SERVER_BITBOARD_H
+
+#include <stdint.h>
+#include "chess_rules.h"
+
+typedef uint64_t Bitboard;
+
+/*
+ * Squares are numbered a1 = 0 ... h8 = 63. The wire format keeps the board as
+ * rows from black's back rank down, so board[y][x] lives on square (7 - y) * 8 + x.
+ */
+#define SQUARE(x, y) ((7 - (y)) * 8 + (x))
+#define SQUARE_X(sq) ((sq) & 7)
+#define SQUARE_Y(sq) (7 - ((sq) >> 3))
+#define BIT(sq) (1ULL << (sq))
+
+#define FILE_A 0x0101010101010101ULL
+#define FILE_H 0x8080808080808080ULL
+#define RANK_1 0x00000000000000FFULL
+#define RANK_3 0x0000000000FF0000ULL
+#define RANK_6 0x0000FF0000000000ULL
+#define RANK_8 0xFF00000000000000ULL
+
+#define PIECE_TYPES 6
+#define PIECE_INDEX(type) ((type) - PAWN)
+#define MAKE_PIECE(type, color) ((type) | (color) << 3)
+
+#define WHITE_KINGSIDE 1
+#define WHITE_QUEENSIDE 2
+#define BLACK_KINGSIDE 4
+#define BLACK_QUEENSIDE 8
+
+#define NO_SQUARE (-1)
+
+typedef struct {
+    // one mask per color and piece type, indexed with PIECE_INDEX
+    Bitboard pieces[2][PIECE_TYPES];
+    Bitboard occupied[2];
+    // Zobrist key of the whole position, kept up to date by every piece and move update
+    uint64_t hash;
+    // piece code in the chess_rules encoding for every square, answers "what is on sq" without a scan
+    uint8_t squares[64];
+    uint8_t sideToMove;
+    uint8_t castlingRights;
+    // square behind a pawn that just moved two squares, only set when an enemy pawn can take it
+    int8_t epSquare;
+    uint16_t halfmoveClock;
+    uint16_t fullmoveNumber;
+} Position;
+
+void bitboard_init();
+
+void position_init(Position* pos);
+
+void position_set_board(Position* pos, int board[8][8]);
+
+bool position_from_fen(Position* pos, const char* fen);
+
+void position_to_board(const Position* pos, int board[8][8]);
+
+void position_put_piece(Position* pos, int sq, int piece);
+
+void position_remove_piece(Position* pos, int sq);
+
+void position_move_piece(Position* pos, int from, int to);
+
+Bitboard piece_targets(const Position* pos, int sq);
+
+Bitboard knight_attacks(int sq);
+
+Bitboard king_attacks(int sq);
+
+Bitboard pawn_attacks(int color, int sq);
+
+Bitboard bishop_attacks(int sq, Bitboard occupied);
+
+Bitboard rook_attacks(int sq, Bitboard occupied);
+
+Bitboard queen_attacks(int sq, Bitboard occupied);
+
+Bitboard between_squares(int a, int b);
+
+Bitboard line_through(int a, int b);
+
+static inline int pop_lsb(Bitboard* b) {
+    int sq = __builtin_ctzll(*b);
+    *b &= *b - 1;
+    return sq;
+}
+
+static inline int piece_at(const Position* pos, int sq) {
+    return pos->squares[sq];
+}
+
+static inline Bitboard all_pieces(const Position* pos) {
+    return pos->occupied[WHITE] | pos->occupied[BLACK];
+}
+
+#endif //SERVER_BITBOARD_H
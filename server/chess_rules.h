@@ -17,6 +17,8 @@ enum Piece {
 
 #define WHITE 0
 #define BLACK 1
+// winner value for games that end without one
+#define DRAW 2
 
 void init_board(int board[8][8]);
 
@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "computer.h"
+#include "engine.h"
+
+typedef struct ComputerJob {
+    struct ComputerJob* next;
+    char gameId[MAX_GAME_ID_LENGTH + 1];
+    uint64_t generation;
+    // the game as it was when the search was queued, the move is only played if it is still there
+    Position position;
+    int moveCount;
+    int historyCount;
+    uint64_t history[ENGINE_MAX_HISTORY];
+} ComputerJob;
+
+static mtx_t queueLock;
+static cnd_t queueReady;
+static ComputerJob* queueHead = nullptr;
+static ComputerJob* queueTail = nullptr;
+static int queued = 0;
+static int searching = 0;
+static int threadCount = 0;
+
+static atomic_ullong searches = 0;
+static atomic_ullong nodes = 0;
+static atomic_ullong searchNs = 0;
+static atomic_ullong depths = 0;
+
+static int run_computer(void* arg);
+
+static uint64_t fair_budget(int waiting);
+
+static void play_move(const ComputerJob* job, const SearchResult* result);
+
+bool computer_start(int threads) {
+    engine_init(COMPUTER_TABLE_BYTES);
+    mtx_init(&queueLock, mtx_plain);
+    cnd_init(&queueReady);
+
+    for (int i = 0; i < threads; i++) {
+        thrd_t thread;
+        if (thrd_create(&thread, run_computer, nullptr) != thrd_success) {
+            printf("failed to start computer thread %d\n", i);
+            return false;
+        }
+        thrd_detach(thread);
+        threadCount++;
+    }
+    return true;
+}
+
+void computer_play(GameStatus* gameStatus) {
+    Player* p = gameStatus->players[gameStatus->position.sideToMove];
+    if (threadCount == 0 || gameStatus->winner != -1 || gameStatus->computerThinking || p == nullptr ||
+        !is_computer(p))
+        return;
+    gameStatus->computerThinking = true;
+
+    ComputerJob* job = malloc(sizeof(ComputerJob));
+    job->next = nullptr;
+    strcpy(job->gameId, gameStatus->gameId);
+    job->generation = gameStatus->generation;
+    job->position = gameStatus->position;
+    job->moveCount = gameStatus->moveCount;
+
+    // the search only needs the positions a repetition can reach back to
+    int count = gameStatus->position.halfmoveClock;
+    if (count > gameStatus->moveCount)
+        count = gameStatus->moveCount;
+    if (count > ENGINE_MAX_HISTORY)
+        count = ENGINE_MAX_HISTORY;
+    for (int back = count; back > 0; back--) {
+        int ply = gameStatus->moveCount - back;
+        job->history[count - back] = ply == 0 ? gameStatus->startHash : gameStatus->moves[ply - 1].hash;
+    }
+    job->historyCount = count;
+
+    mtx_lock(&queueLock);
+    if (queueTail != nullptr)
+        queueTail->next = job;
+    else
+        queueHead = job;
+    queueTail = job;
+    queued++;
+    cnd_signal(&queueReady);
+    mtx_unlock(&queueLock);
+}
+
+int run_computer(void* arg) {
+    (void) arg;
+    // on Linux the nice value is per thread, the event loops keep theirs
+    if (setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), COMPUTER_NICE) < 0)
+        perror("setpriority has failed");
+
+    for (;;) {
+        mtx_lock(&queueLock);
+        while (queueHead == nullptr)
+            cnd_wait(&queueReady, &queueLock);
+        ComputerJob* job = queueHead;
+        queueHead = job->next;
+        if (queueHead == nullptr)
+            queueTail = nullptr;
+        queued--;
+        int waiting = queued + searching + 1;
+        searching++;
+        mtx_unlock(&queueLock);
+
+        SearchResult result = engine_search(&job->position, job->history, job->historyCount, fair_budget(waiting));
+
+        mtx_lock(&queueLock);
+        searching--;
+        mtx_unlock(&queueLock);
+
+        // reported through /metrics only, a printf per move would take the stdout lock on every search thread
+        atomic_fetch_add(&searches, 1);
+        atomic_fetch_add(&nodes, result.nodes);
+        atomic_fetch_add(&searchNs, result.elapsedNs);
+        atomic_fetch_add(&depths, (unsigned long long) result.depth);
+
+        play_move(job, &result);
+        free(job);
+    }
+    return 0;
+}
+
+uint64_t fair_budget(int waiting) {
+    // every game queued or being searched gets the same slice of the threads
+    uint64_t budget = (uint64_t) COMPUTER_MOVE_BUDGET_MS * threadCount / waiting;
+    if (budget > COMPUTER_MOVE_BUDGET_MS)
+        budget = COMPUTER_MOVE_BUDGET_MS;
+    if (budget < COMPUTER_MIN_BUDGET_MS)
+        budget = COMPUTER_MIN_BUDGET_MS;
+    return budget * 1000000ULL;
+}
+
+void play_move(const ComputerJob* job, const SearchResult* result) {
+    mtx_t* lock = game_lock(job->gameId);
+    mtx_lock(lock);
+    // the game may have been freed, or freed and started again under the same id, while the search ran;
+    // a new game has a search of its own to clear its flag
+    GameStatus* gameStatus = find_game(job->gameId);
+    if (gameStatus != nullptr && gameStatus->generation == job->generation) {
+        gameStatus->computerThinking = false;
+        if (gameStatus->winner == -1 && gameStatus->moveCount == job->moveCount &&
+            gameStatus->position.hash == job->position.hash && result->best != NO_MOVE) {
+            apply_move(gameStatus, result->best);
+            mark_game_changed(gameStatus);
+        } else {
+            // not the position that was searched, look again if it is still the computer's turn
+            computer_play(gameStatus);
+        }
+    }
+    mtx_unlock(lock);
+}
+
+void collect_computer_stats(ComputerStats* stats) {
+    stats->searches = atomic_load(&searches);
+    stats->nodes = atomic_load(&nodes);
+    stats->searchNs = atomic_load(&searchNs);
+    stats->depths = atomic_load(&depths);
+    mtx_lock(&queueLock);
+    stats->queued = queued;
+    mtx_unlock(&queueLock);
+}
@@ -0,0 +1,46 @@
+#ifndef SERVER_COMPUTER_H
+#define SERVER_COMPUTER_H
+
+#include <stdint.h>
+#include "game.h"
+
+// time one computer move may take while it is the only game waiting for one
+#define COMPUTER_MOVE_BUDGET_MS 250
+// the least a move gets however many games share the search threads
+#define COMPUTER_MIN_BUDGET_MS 20
+// search threads run this much nicer than the event loops, a busy engine never delays a request
+#define COMPUTER_NICE 5
+#define COMPUTER_TABLE_BYTES (32 << 20)
+
+typedef struct {
+    unsigned long long searches;
+    unsigned long long nodes;
+    unsigned long long searchNs;
+    // sum of the depths reached, divided by searches it is the mean depth
+    unsigned long long depths;
+    // games waiting for a search thread right now
+    int queued;
+} ComputerStats;
+
+/*
+ * The computer opponent. Searching takes far longer than any request may, so
+ * it happens on a pool of its own threads: computer_play copies the position
+ * into a job under the game's shard lock and returns at once, a search thread
+ * runs engine_search on the copy and takes the lock again only to play the
+ * move it found, which wakes the player's long poll like any other move.
+ *
+ * Jobs are served first come, first served. Each gets an equal share of the
+ * pool: with more games waiting than threads the budget of a move shrinks
+ * (down to COMPUTER_MIN_BUDGET_MS), so many games keep moving at a steady pace
+ * instead of some waiting for others' full searches.
+ */
+
+// starts the search threads, without them computer games can be joined but the computer never moves
+bool computer_start(int threads);
+
+// queues a search if it is the computer's turn in the game and none is queued yet, called under the game lock
+void computer_play(GameStatus* gameStatus);
+
+void collect_computer_stats(ComputerStats* stats);
+
+#endif //SERVER_COMPUTER_H
@@ -1,404 +1,875 @@
 #include <stdio.h>
+#include <errno.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <stdlib.h>
 #include <unistd.h>
-#include <cjson/cJSON.h>
 #include <time.h>
 #include <threads.h>
 #include "connection.h"
+#include "event_loop.h"
 #include "common.h"
 #include "game.h"
 #include "chess_rules.h"
+#include "http.h"
+#include "protocol.h"
+#include "journal.h"
+#include "archive.h"
+#include "metrics.h"
+#include "shared_buffer.h"
+#include "computer.h"
+#include "matchmaking.h"
 
-static char HTTP_HEADER[] = "HTTP/1.1 200 OK\r\nAccess-Control-Allow-Origin: *\r\nContent-Type: application/json\r\nContent-Length: %d\r\n\r\n";
-#define MAX_MESSAGE_LENGTH 2048
+// past this many moves the whole board is smaller than the delta
+#define MAX_DELTA_MOVES 16
+// one batch per worker thread covers every spectator of a game
+#define MAX_WAKE_BATCHES 64
 
-enum MESSAGE_TYPE_OUT {
-    WAIT_FOR_OTHER_PLAYER = 0,
-    GAME_STARTED,
-    GAME_STATE_RESPONSE,
-    MOVE_ACCEPTED,
-    GAME_ENDED,
-    PLAYER_DISCONNECTED,
-    OPPONENT_DISCONNECTED
-};
+// spectators of one game living on the same event loop, handed over under a single inbox lock
+typedef struct {
+    EventLoop* loop;
+    Connection* head;
+    Connection* tail;
+} WakeBatch;
 
-enum MESSAGE_TYPE_IN {
-    JOIN_GAME = 128,
-    GAME_STATE_REQUEST,
-    MOVE_PIECE,
-    DISCONNECT,
-    EXIT_SERVER = 42069
-};
+// spectator frames are encoded here before being copied into their shared buffer
+static thread_local ByteBuffer frameScratch = {nullptr, 0, 0};
 
-static ssize_t readfull_header(int descriptor, char* buffer, int sizetoread);
+static void process_requests(Connection* conn);
 
-static int extract_content_length(char* buffer);
+static size_t frame_http_request(Connection* conn);
 
-static char* readfull_body(int descriptor, char* buffer, int sizetoread);
+static size_t frame_binary_request(Connection* conn);
 
-static void write_http_response(int conn_fd, char* response);
+static void reject_request(Connection* conn);
 
-static int extract_string(cJSON* root, char* key, char* value);
+static bool decode_request(Connection* conn, size_t length, Request* request);
 
-static cJSON* prepare_json(int messageType, char* gameId, char* playerId);
+static void dispatch_request(Connection* conn, const Request* request);
 
-static void handle_join_game(int conn_fd, cJSON* message);
+static ConnectionStatus flush_response(Connection* conn);
 
-static void handle_sync_state(int conn_fd, cJSON* root);
+static size_t begin_response(Connection* conn);
 
-static void handle_move_piece(int conn_fd, cJSON* root);
-static void send_game_ended(int conn_fd, GameStatus* g);
-static void handle_disconnect(int conn_fd, cJSON* root);
-static void send_opponent_disconnected(int conn_fd, GameStatus* g);
+static void queue_response(Connection* conn, size_t bodyStart);
 
-ssize_t readfull_header(int descriptor, char* buffer, int sizetoread) {
-    ssize_t offset = 0;
-    while (strstr(buffer, "\r\n\r\n") == NULL || offset == sizetoread) {
-        ssize_t read = recv(descriptor, buffer + offset, sizetoread - offset, MSG_PEEK);
-        if (read < 1) {
-            return offset;
-        }
-        offset += read;
-    }
-    int header_length = strstr(buffer, "\r\n\r\n") - buffer + 4;
-    recv(descriptor, buffer, header_length, 0);
-    return offset;
-}
+static void queue_segment(Connection* conn, size_t start);
 
-int extract_content_length(char* buffer) {
-    char* body_length_str = strstr(buffer, "Content-Length: ");
-    char* body_length_end = strstr(body_length_str, "\r\n");
-    body_length_str += strlen("Content-Length: ");
-    int body_length = strtol(body_length_str, &body_length_end, 10);
+static void queue_shared(Connection* conn, SharedBuffer* body);
 
-    return body_length;
-}
+static bool output_full(Connection* conn);
 
-char* readfull_body(int descriptor, char* buffer, int sizetoread) {
-    ssize_t offset = 0;
-    while (offset < sizetoread) {
-        ssize_t read = recv(descriptor, buffer + offset, sizetoread - offset, 0);
-        if (read < 1) {
-            return buffer;
-        }
-        offset += read;
+static void encode_message(Connection* conn, ByteBuffer* out, const Message* message);
+
+static void send_message(Connection* conn, const Message* message);
+
+static void send_metrics(Connection* conn);
+
+static void handle_join_game(Connection* conn, const Request* request);
+
+static void handle_join_computer_game(Connection* conn, const Request* request);
+
+static void handle_find_match(Connection* conn, const Request* request);
+
+static void send_seat(Connection* conn, GameStatus* g);
+
+static void handle_sync_state(Connection* conn, const Request* request);
+
+static void render_game_state(Connection* conn, ByteBuffer* out, GameStatus* g, Player* p, long long lastSeenVersion);
+
+static void refresh_game_cache(GameStatus* g);
+
+static void use_cached_state(Message* message, GameStatus* g, Protocol protocol);
+
+static void park_connection(Connection* conn, GameStatus* g, Player* p);
+
+static void unpark_connection(Connection* conn);
+
+static void wake_waiters(GameStatus* g);
+
+static void handle_watch_game(Connection* conn, const Request* request);
+
+static SharedBuffer* spectator_frame(GameStatus* g, Protocol protocol);
+
+static void wake_spectators(GameStatus* g);
+
+static void handle_move_piece(Connection* conn, const Request* request);
+static void game_ended_message(Message* message, GameStatus* g);
+static void handle_disconnect(Connection* conn, const Request* request);
+
+void handle_join_game(Connection* conn, const Request* request) {
+    GameStatus* g = create_or_join_game(request->gameId);
+    if (g == NULL) {
+        printf("Attempted to join a full game\n");
+        return;
     }
-    return buffer;
+    send_seat(conn, g);
 }
 
-void handle_join_game(int conn_fd, cJSON* message) {
-    char* game_id = malloc(sizeof(char) * 6);
-    if (extract_string(message, "game_id", game_id) < 0) {
-        printf("error parsing game_id\n");
-        exit(1);
+void handle_find_match(Connection* conn, const Request* request) {
+    // there is no game id to lock by yet, matchmaking hands the game back with its shard locked
+    GameStatus* g = find_match(request->bucket);
+    if (g == NULL) {
+        printf("Failed to open a game for matchmaking\n");
+        return;
     }
+    send_seat(conn, g);
+    mtx_unlock(g->lock);
+}
+
+void send_seat(Connection* conn, GameStatus* g) {
+    // the player who just joined, white waits in the game until black arrives
+    Player* p = g->players[1] == NULL ? g->players[0] : g->players[1];
+    int message_type = g->players[1] == NULL ? WAIT_FOR_OTHER_PLAYER : GAME_STARTED;
+    Message message = {.messageType = message_type, .gameId = g->gameId, .playerId = p->playerId};
+    message.playerColor = p->color;
+    message.version = g->version;
+    send_message(conn, &message);
+}
 
-    GameStatus* g = create_or_join_game(game_id);
+void handle_join_computer_game(Connection* conn, const Request* request) {
+    GameStatus* g = create_computer_game(request->gameId);
     if (g == NULL) {
-        printf("Attempted to join a full game\n");
+        printf("Attempted to start a computer game under a taken id\n");
         return;
     }
 
-    cJSON* resp = cJSON_CreateObject();
-    cJSON_AddStringToObject(resp, "gameId", game_id);
+    // the human always opens, the computer only starts thinking after their first move
+    Player* p = g->players[0];
+    Message message = {.messageType = GAME_STARTED, .gameId = g->gameId, .playerId = p->playerId};
+    message.playerColor = p->color;
+    message.version = g->version;
+    send_message(conn, &message);
+}
 
-    char id[6];
-    if (g->players[1] == NULL) {
-        cJSON_AddNumberToObject(resp, "messageType", WAIT_FOR_OTHER_PLAYER);
-        sprintf(id, "%s", g->players[0]->playerId);
-        cJSON_AddStringToObject(resp, "playerId", id);
-        cJSON_AddNumberToObject(resp, "playerColor", g->players[0]->color);
-    } else {
-        cJSON_AddNumberToObject(resp, "messageType", GAME_STARTED);
-        sprintf(id, "%s", g->players[1]->playerId);
-        cJSON_AddStringToObject(resp, "playerId", id);
-        cJSON_AddNumberToObject(resp, "playerColor", g->players[1]->color);
-    }
+size_t begin_response(Connection* conn) {
+    if (conn->protocol == PROTOCOL_BINARY)
+        return binary_frame_begin(&conn->out);
+    return http_response_begin(&conn->out);
+}
 
-    char* marshalled = cJSON_Print(resp);
-    write_http_response(conn_fd, marshalled);
+void queue_response(Connection* conn, size_t bodyStart) {
+    if (conn->protocol == PROTOCOL_BINARY)
+        queue_segment(conn, binary_frame_end(&conn->out, bodyStart));
+    else
+        queue_segment(conn, http_response_end(&conn->out, bodyStart, conn->keepAlive));
+}
 
-    cJSON_Delete(resp);
-    cJSON_free(marshalled);
+void queue_segment(Connection* conn, size_t start) {
+    OutputSegment* segment = &conn->outSegments[conn->outSegmentCount++];
+    segment->start = start;
+    segment->length = conn->out.length - start;
+    segment->shared = nullptr;
+    conn->outPending += segment->length;
 }
 
-void write_http_response(int conn_fd, char* response) {
-    char buffer[150] = {0};
-    sprintf(buffer, HTTP_HEADER, strlen(response));
-    send(conn_fd, buffer, strlen(buffer), 0);
-    send(conn_fd, response, strlen(response), 0);
+void queue_shared(Connection* conn, SharedBuffer* body) {
+    // the header is the connection's own, the body is sent straight from the shared buffer
+    if (conn->protocol == PROTOCOL_BINARY)
+        queue_segment(conn, binary_write_frame_header(&conn->out, body->length));
+    else
+        queue_segment(conn, http_write_header(&conn->out, body->length, conn->keepAlive));
+
+    OutputSegment* segment = &conn->outSegments[conn->outSegmentCount++];
+    segment->start = 0;
+    segment->length = body->length;
+    segment->shared = body;
+    conn->outPending += body->length;
 }
 
-void handle_sync_state(int conn_fd, cJSON* root) {
-    char game_id[6] = {0};
-    cJSON* game_id_json = cJSON_GetObjectItem(root, "gameId");
-    if (game_id_json == NULL) {
-        printf("error parsing game_id\n");
-        exit(1);
-    }
-    strcpy(game_id, game_id_json->valuestring);
+bool output_full(Connection* conn) {
+    // a response takes up to two segments, a header and a shared body
+    return conn->outPending > MAX_PENDING_OUTPUT || conn->outSegmentCount > MAX_OUTPUT_SEGMENTS - 2;
+}
 
-    char player_id[6] = {0};
-    cJSON* player_id_json = cJSON_GetObjectItem(root, "playerId");
-    if (player_id_json == NULL) {
-        printf("error parsing player_id\n");
-        exit(1);
-    }
-    strcpy(player_id, player_id_json->valuestring);
+void encode_message(Connection* conn, ByteBuffer* out, const Message* message) {
+    if (conn->protocol == PROTOCOL_BINARY)
+        encode_binary_message(out, message);
+    else
+        encode_json_message(out, message);
+}
+
+void send_message(Connection* conn, const Message* message) {
+    size_t body = begin_response(conn);
+    encode_message(conn, &conn->out, message);
+    queue_response(conn, body);
+}
+
+void send_metrics(Connection* conn) {
+    size_t body = http_response_begin(&conn->out);
+    metrics_render(&conn->out);
+    queue_segment(conn, http_text_response_end(&conn->out, body, conn->keepAlive));
+}
 
-    GameStatus* g = find_game(game_id);
+void handle_sync_state(Connection* conn, const Request* request) {
+    GameStatus* g = find_game(request->gameId);
     if (g == NULL) {
         printf("Attempted to check status of a non-existent game\n");
         return;
     }
 
-    if (g->winner != -1) {
-        send_game_ended(conn_fd, g);
+    Player* p = find_player(g, request->playerId);
+    if (p == nullptr) {
+        printf("Attempted to check status as an unknown player\n");
         return;
     }
+    // a game recovered from the journal on the computer's turn gets its move once the player is back
+    computer_play(g);
 
-    Player* p = find_player(g, player_id);
-    p->lastHeartbeat = time(NULL);
-
-    Player* other = get_the_other_player(g, p);
-    if (other != NULL && other->disconnected) {
-        send_opponent_disconnected(conn_fd, g);
-        printf("Discovered disconnected opponent, sending message\n");
+    // a client that already saw the current version waits for the next change instead of re-polling
+    if (request->lastSeenVersion == g->version && g->winner == -1) {
+        park_connection(conn, g, p);
         return;
     }
 
-    if (g->players[0] == nullptr || g->players[1] == nullptr) {
-        cJSON* resp = cJSON_CreateObject();
-        cJSON_AddNumberToObject(resp, "messageType", WAIT_FOR_OTHER_PLAYER);
-        cJSON_AddStringToObject(resp, "gameId", g->gameId);
-        cJSON_AddStringToObject(resp, "playerId", player_id);
-        char* marshalled = cJSON_Print(resp);
-        write_http_response(conn_fd, marshalled);
+    size_t body = begin_response(conn);
+    render_game_state(conn, &conn->out, g, p, request->lastSeenVersion);
+    queue_response(conn, body);
+}
 
-        cJSON_Delete(resp);
-        cJSON_free(marshalled);
+void render_game_state(Connection* conn, ByteBuffer* out, GameStatus* g, Player* p, long long lastSeenVersion) {
+    Message message = {.messageType = GAME_STATE_RESPONSE, .gameId = g->gameId, .playerId = p->playerId};
+    message.playerColor = p->color;
+    message.currentTurn = g->position.sideToMove;
+    message.version = g->version;
+    message.position = &g->position;
 
-        return;
+    if (g->winner != -1) {
+        game_ended_message(&message, g);
+    } else {
+        touch_player(g, p);
+
+        Player* other = get_the_other_player(g, p);
+        if (other != NULL && other->disconnected) {
+            printf("Discovered disconnected opponent, sending message\n");
+            message.messageType = OPPONENT_DISCONNECTED;
+            message.playerId = g->players[0]->playerId;
+        } else if (g->players[0] == nullptr || g->players[1] == nullptr) {
+            message.messageType = WAIT_FOR_OTHER_PLAYER;
+        } else if (lastSeenVersion == g->version) {
+            // a long poll that timed out only needs to hear that nothing happened
+            message.messageType = GAME_STATE_UNCHANGED;
+        } else if (lastSeenVersion != NO_VERSION && lastSeenVersion < g->version) {
+            // clients that are a few moves behind replay them, anything else (joins, unknown versions) gets the board
+            int first_move = first_move_since(g, (unsigned int) lastSeenVersion);
+            if (first_move < g->moveCount && g->moveCount - first_move <= MAX_DELTA_MOVES) {
+                message.messageType = GAME_STATE_DELTA;
+                message.baseVersion = (unsigned int) lastSeenVersion;
+                message.moves = g->moves + first_move;
+                message.moveCount = g->moveCount - first_move;
+            }
+        }
     }
 
-    cJSON* resp = cJSON_CreateObject();
-    cJSON_AddNumberToObject(resp, "messageType", GAME_STATE_RESPONSE);
-    cJSON_AddStringToObject(resp, "gameId", g->gameId);
-    cJSON_AddStringToObject(resp, "playerId", player_id);
-    cJSON_AddNumberToObject(resp, "currentTurn", g->currentTurn);
+    if (message.messageType == GAME_STATE_RESPONSE || message.messageType == GAME_ENDED)
+        use_cached_state(&message, g, conn->protocol);
+    encode_message(conn, out, &message);
+}
 
-    cJSON_AddNumberToObject(resp, "playerColor", p->color);
+void refresh_game_cache(GameStatus* g) {
+    if (g->cacheVersion == g->version)
+        return;
 
-    serialize_board(resp, g->board);
+    // every change to the board, the turn, the winner or the players bumps the version
+    for (int i = 0; i < 2; i++) {
+        g->cachedState[i].length = 0;
+        shared_buffer_release(g->spectatorFrames[i]);
+        g->spectatorFrames[i] = nullptr;
+    }
+    g->cacheVersion = g->version;
+}
 
-    char* marshalled = cJSON_Print(resp);
-    write_http_response(conn_fd, marshalled);
+void use_cached_state(Message* message, GameStatus* g, Protocol protocol) {
+    refresh_game_cache(g);
+    ByteBuffer* state = &g->cachedState[protocol];
+    if (state->length == 0) {
+        if (protocol == PROTOCOL_BINARY)
+            encode_binary_state(state, g->version, &g->position);
+        else
+            encode_json_state(state, g->version, &g->position);
+        metrics_add(&metrics_local()->stateCacheMisses, 1);
+    } else {
+        metrics_add(&metrics_local()->stateCacheHits, 1);
+    }
 
-    cJSON_Delete(resp);
-    cJSON_free(marshalled);
+    // only the fields in front of it are written per response, the rest is a copy
+    message->state = state->data;
+    message->stateLength = state->length;
 }
 
-void handle_move_piece(int conn_fd, cJSON* root) {
-    char game_id[6] = {0};
-    if (extract_string(root, "gameId", game_id) < 0) {
-        printf("error parsing game_id\n");
-        return;
+void park_connection(Connection* conn, GameStatus* g, Player* p) {
+    Connection** list = p != nullptr ? &g->waiters : &g->spectators;
+    conn->parked = true;
+    conn->parkedLock = g->lock;
+    conn->parkedAt = time(NULL);
+    conn->parkedGame = g;
+    conn->parkedPlayer = p;
+    conn->parkedVersion = g->version;
+    conn->waitPrev = nullptr;
+    conn->waitNext = *list;
+    if (*list != nullptr)
+        (*list)->waitPrev = conn;
+    *list = conn;
+    if (p != nullptr)
+        p->pendingPolls++;
+    else
+        metrics_add(&metrics_local()->spectatorsParked, 1);
+}
+
+void unpark_connection(Connection* conn) {
+    GameStatus* g = conn->parkedGame;
+    if (conn->waitPrev != nullptr)
+        conn->waitPrev->waitNext = conn->waitNext;
+    else if (conn->parkedPlayer != nullptr)
+        g->waiters = conn->waitNext;
+    else
+        g->spectators = conn->waitNext;
+    if (conn->waitNext != nullptr)
+        conn->waitNext->waitPrev = conn->waitPrev;
+
+    if (conn->parkedPlayer != nullptr) {
+        // the player was reachable for as long as the request stayed parked
+        conn->parkedPlayer->pendingPolls--;
+        touch_player(g, conn->parkedPlayer);
+    } else {
+        metrics_add(&metrics_local()->spectatorsUnparked, 1);
     }
-    GameStatus* g = find_game(game_id);
-    if (g == nullptr) {
-        printf("game not found\n");
-        return;
+
+    conn->parkedGame = nullptr;
+    conn->parkedPlayer = nullptr;
+    conn->waitPrev = nullptr;
+    conn->waitNext = nullptr;
+}
+
+void wake_waiters(GameStatus* g) {
+    // runs under the game lock on whichever thread changed the game, the owning loops send the answers
+    while (g->waiters != nullptr) {
+        Connection* conn = g->waiters;
+        Player* p = conn->parkedPlayer;
+        unpark_connection(conn);
+        conn->wakeBody.length = 0;
+        render_game_state(conn, &conn->wakeBody, g, p, conn->parkedVersion);
+        event_loop_wake(conn->loop, conn);
     }
 
-    char player_id[6] = {0};
-    if (extract_string(root, "playerId", player_id) < 0) {
-        printf("error parsing playerId\n");
+    // the players hear first, watchers cost them one shared serialization and an inbox lock per loop
+    if (g->spectators != nullptr)
+        wake_spectators(g);
+}
+
+void handle_watch_game(Connection* conn, const Request* request) {
+    GameStatus* g = find_game(request->gameId);
+    if (g == NULL) {
+        printf("Attempted to watch a non-existent game\n");
         return;
     }
 
-    Player* p = find_player(g, player_id);
-    p->lastHeartbeat = time(NULL);
-    if (p->color != g->currentTurn) {
-        printf("wrong player turn\n");
+    // spectators long-poll like players, but they are not waited for and never count as heartbeats
+    if (request->lastSeenVersion == g->version && g->winner == -1) {
+        park_connection(conn, g, nullptr);
         return;
     }
 
-    cJSON* move = cJSON_GetObjectItem(root, "move");
-    cJSON* from = cJSON_GetObjectItem(move, "from");
-    cJSON* to = cJSON_GetObjectItem(move, "to");
+    queue_shared(conn, shared_buffer_retain(spectator_frame(g, conn->protocol)));
+}
 
-    int from_x = cJSON_GetArrayItem(from, 0)->valueint;
-    int from_y = cJSON_GetArrayItem(from, 1)->valueint;
+SharedBuffer* spectator_frame(GameStatus* g, Protocol protocol) {
+    // connections that still send the frames of an older version hold references of their own
+    refresh_game_cache(g);
+    if (g->spectatorFrames[protocol] == nullptr) {
+        // the same full state for everyone, a watcher that fell behind simply gets the newest one
+        Message message = {.messageType = SPECTATOR_STATE, .gameId = g->gameId, .playerId = ""};
+        message.currentTurn = g->position.sideToMove;
+        message.winner = g->winner;
+        message.version = g->version;
+        message.position = &g->position;
+        use_cached_state(&message, g, protocol);
+
+        frameScratch.length = 0;
+        if (protocol == PROTOCOL_BINARY)
+            encode_binary_message(&frameScratch, &message);
+        else
+            encode_json_message(&frameScratch, &message);
+        g->spectatorFrames[protocol] = shared_buffer_create(frameScratch.data, frameScratch.length);
+    }
+    return g->spectatorFrames[protocol];
+}
 
-    int to_x = cJSON_GetArrayItem(to, 0)->valueint;
-    int to_y = cJSON_GetArrayItem(to, 1)->valueint;
+void wake_spectators(GameStatus* g) {
+    WakeBatch batches[MAX_WAKE_BATCHES];
+    int batch_count = 0;
+
+    while (g->spectators != nullptr) {
+        Connection* conn = g->spectators;
+        unpark_connection(conn);
+        conn->wakeShared = shared_buffer_retain(spectator_frame(g, conn->protocol));
+        // parked connections are in no inbox, and only the shard lock holder can queue them
+        conn->wakeNext = nullptr;
+
+        int i = 0;
+        while (i < batch_count && batches[i].loop != conn->loop)
+            i++;
+        if (i == MAX_WAKE_BATCHES) {
+            event_loop_wake(conn->loop, conn);
+        } else if (i == batch_count) {
+            batches[batch_count++] = (WakeBatch) {conn->loop, conn, conn};
+        } else {
+            batches[i].tail->wakeNext = conn;
+            batches[i].tail = conn;
+        }
+    }
 
-    if (!is_move_valid(g, from_x, from_y, to_x, to_y)) {
-        cJSON *resp = prepare_json(GAME_STATE_RESPONSE, game_id, player_id);
+    for (int i = 0; i < batch_count; i++)
+        event_loop_wake_all(batches[i].loop, batches[i].head, batches[i].tail);
+}
 
-        serialize_board(resp, g->board);
-        cJSON_AddNumberToObject(resp, "playerColor", p->color);
-        cJSON_AddNumberToObject(resp, "currentTurn", g->currentTurn);
+bool connection_expire_long_poll(Connection* conn) {
+    mtx_lock(conn->parkedLock);
+    GameStatus* g = conn->parkedGame;
+    Player* p = conn->parkedPlayer;
+    if (g != nullptr) {
+        unpark_connection(conn);
+        if (p != nullptr) {
+            conn->wakeBody.length = 0;
+            render_game_state(conn, &conn->wakeBody, g, p, conn->parkedVersion);
+        } else {
+            conn->wakeShared = shared_buffer_retain(spectator_frame(g, conn->protocol));
+        }
+    }
+    mtx_unlock(conn->parkedLock);
 
-        char* marshalled = cJSON_Print(resp);
-        write_http_response(conn_fd, marshalled);
+    if (g == nullptr)
+        return false;
 
-        cJSON_Delete(resp);
-        cJSON_free(marshalled);
+    connection_resume(conn);
+    return true;
+}
 
+void connection_resume(Connection* conn) {
+    if (conn->sending) {
+        // appending could move the output the kernel is still sending from, the answer is queued once it is done
+        conn->resumePending = true;
+        conn->parked = false;
+        conn->parkedLock = nullptr;
         return;
     }
+    if (conn->wakeShared != nullptr) {
+        // the segment takes over the reference
+        queue_shared(conn, conn->wakeShared);
+        conn->wakeShared = nullptr;
+    } else {
+        size_t body = begin_response(conn);
+        byte_buffer_append(&conn->out, conn->wakeBody.data, conn->wakeBody.length);
+        queue_response(conn, body);
+    }
+    conn->parked = false;
+    conn->parkedLock = nullptr;
 
-    int piece = g->board[from_y][from_x];
-    int targetPiece = g->board[to_y][to_x];
-    g->board[from_y][from_x] = EMPTY;
-    g->board[to_y][to_x] = piece;
-    g->currentTurn = !g->currentTurn;
+    // the parked request is answered now, honour its Connection header
+    if (!conn->keepAlive)
+        conn->closeAfterWrite = true;
+}
 
-    if (get_piece_type(targetPiece) == KING) {
-        g->winner = p->color;
-        send_game_ended(conn_fd, g);
+void handle_move_piece(Connection* conn, const Request* request) {
+    GameStatus* g = find_game(request->gameId);
+    if (g == nullptr) {
+        printf("game not found\n");
         return;
     }
 
-    cJSON* resp = prepare_json(MOVE_ACCEPTED, game_id, player_id);
-    char* marshalled = cJSON_Print(resp);
-    write_http_response(conn_fd, marshalled);
-
-    cJSON_Delete(resp);
-    cJSON_free(marshalled);
-}
+    Player* p = find_player(g, request->playerId);
+    if (p == nullptr) {
+        printf("unknown player\n");
+        return;
+    }
+    touch_player(g, p);
+    if (p->color != g->position.sideToMove) {
+        printf("wrong player turn\n");
+        return;
+    }
 
-int extract_string(cJSON* root, char* key, char* value) {
-    cJSON* json = cJSON_GetObjectItem(root, key);
-    if (json == NULL) {
-        printf("error parsing %s\n", key);
-        return -1;
+    Message message = {.messageType = MOVE_ACCEPTED, .gameId = g->gameId, .playerId = p->playerId};
+    Move legal_move = find_move(g, request->fromX, request->fromY, request->toX, request->toY, request->promotion);
+    if (legal_move == NO_MOVE) {
+        message.messageType = GAME_STATE_RESPONSE;
+        message.playerColor = p->color;
+        message.currentTurn = g->position.sideToMove;
+        message.version = g->version;
+        message.position = &g->position;
+        use_cached_state(&message, g, conn->protocol);
+        send_message(conn, &message);
+        return;
     }
-    strcpy(value, json->valuestring);
-    return 1;
-}
 
-cJSON* prepare_json(int messageType, char* gameId, char* playerId) {
-    cJSON* resp = cJSON_CreateObject();
-    cJSON_AddNumberToObject(resp, "messageType", messageType);
-    cJSON_AddStringToObject(resp, "gameId", gameId);
-    cJSON_AddStringToObject(resp, "playerId", playerId);
+    apply_move(g, legal_move);
+    mark_game_changed(g);
+    computer_play(g);
 
-    return resp;
+    if (g->winner != -1) {
+        game_ended_message(&message, g);
+        use_cached_state(&message, g, conn->protocol);
+    }
+    send_message(conn, &message);
 }
 
-void send_game_ended(int conn_fd, GameStatus* g) {
-    cJSON* resp = prepare_json(GAME_ENDED, g->gameId, g->players[0]->playerId);
-    cJSON_AddNumberToObject(resp, "winner", g->winner);
-    serialize_board(resp, g->board);
-    char* marshalled = cJSON_Print(resp);
-    write_http_response(conn_fd, marshalled);
-
-    cJSON_Delete(resp);
-    cJSON_free(marshalled);
+void game_ended_message(Message* message, GameStatus* g) {
+    *message = (Message) {.messageType = GAME_ENDED, .gameId = g->gameId, .playerId = g->players[0]->playerId};
+    message->winner = g->winner;
+    message->version = g->version;
+    message->position = &g->position;
 }
 
-void handle_disconnect(int conn_fd, cJSON* root) {
-    char game_id[6] = {0};
-    if (extract_string(root, "gameId", game_id) < 0) {
-        printf("error parsing game_id\n");
-        return;
-    }
-    GameStatus* g = find_game(game_id);
+void handle_disconnect(Connection* conn, const Request* request) {
+    GameStatus* g = find_game(request->gameId);
     if (g == nullptr) {
         printf("game not found\n");
         return;
     }
 
-    char player_id[6] = {0};
-    if (extract_string(root, "playerId", player_id) < 0) {
-        printf("error parsing playerId\n");
+    Player* p = find_player(g, request->playerId);
+    if (p == nullptr) {
+        printf("unknown player\n");
         return;
     }
-
-    Player* p = find_player(g, player_id);
-    p->disconnected = true;
-
-    if (g->players[0]->disconnected && g->players[1]->disconnected) {
+    disconnect_player(g, p);
+    // answers the opponent's parked request before the game can go away
+    mark_game_changed(g);
+
+    // the request still holds both ids, the game may be freed below
+    Message message = {.messageType = PLAYER_DISCONNECTED, .gameId = request->gameId, .playerId = request->playerId};
+    // the computer never leaves, a game against it is over once its only human is gone
+    if (g->players[0]->disconnected &&
+        (g->players[1] == NULL || g->players[1]->disconnected || is_computer(g->players[1]))) {
         printf("Both players disconnected, deleting game\n");
         free_game(g);
     }
 
-    cJSON* resp = prepare_json(PLAYER_DISCONNECTED, game_id, player_id);
-    char* marshalled = cJSON_Print(resp);
-    write_http_response(conn_fd, marshalled);
+    send_message(conn, &message);
+}
+
+void connections_init() {
+    set_game_changed_listener(wake_waiters);
+}
 
-    cJSON_Delete(resp);
-    cJSON_free(marshalled);
+Connection* connection_create(int fd, EventLoop* loop, Protocol protocol) {
+    Connection* conn = malloc(sizeof(Connection));
+    conn->fd = fd;
+    conn->protocol = protocol;
+    conn->keepAlive = true;
+    conn->closeAfterWrite = false;
+    conn->peerClosed = false;
+    conn->lastActivity = time(NULL);
+    conn->loop = loop;
+    conn->list = nullptr;
+    conn->listPrev = nullptr;
+    conn->listNext = nullptr;
+    conn->parked = false;
+    conn->parkedLock = nullptr;
+    conn->parkedAt = 0;
+    conn->parkedGame = nullptr;
+    conn->parkedPlayer = nullptr;
+    conn->parkedVersion = 0;
+    conn->waitPrev = nullptr;
+    conn->waitNext = nullptr;
+    conn->wakeBody = (ByteBuffer) {nullptr, 0, 0};
+    conn->wakeShared = nullptr;
+    conn->wakeQueued = false;
+    conn->wakeNext = nullptr;
+    http_parser_reset(&conn->parser);
+    conn->inLength = 0;
+    conn->out = (ByteBuffer) {nullptr, 0, 0};
+    conn->outSegmentCount = 0;
+    conn->outSegmentIndex = 0;
+    conn->outOffset = 0;
+    conn->outPending = 0;
+    conn->sending = false;
+    conn->resumePending = false;
+    conn->receiving = false;
+    conn->closing = false;
+    conn->closeQueued = false;
+    conn->pendingOps = 0;
+
+    metrics_add(&metrics_local()->connectionsOpened, 1);
+    return conn;
 }
 
-void send_opponent_disconnected(int conn_fd, GameStatus* g) {
-    cJSON* resp = prepare_json(OPPONENT_DISCONNECTED, g->gameId, g->players[0]->playerId);
-    char* marshalled = cJSON_Print(resp);
-    write_http_response(conn_fd, marshalled);
+void process_requests(Connection* conn) {
+    // a parked request holds back the ones pipelined behind it so responses stay in order
+    while (!conn->closeAfterWrite && !conn->parked && !conn->sending) {
+        if (output_full(conn))
+            return;
+
+        size_t request_length =
+                conn->protocol == PROTOCOL_BINARY ? frame_binary_request(conn) : frame_http_request(conn);
+        if (request_length == 0)
+            return;
+
+        int before = conn->outSegmentCount;
+        if (conn->protocol == PROTOCOL_HTTP && http_is_get(&conn->parser, conn->in, "/metrics")) {
+            send_metrics(conn);
+        } else {
+            // two timestamp reads and a few stores to this thread's own counters, small next to any handler
+            uint64_t start = metrics_clock();
+            Request request;
+            if (decode_request(conn, request_length, &request)) {
+                dispatch_request(conn, &request);
+                metrics_record_request(request.messageType, metrics_clock() - start);
+            } else {
+                metrics_add(&metrics_local()->parseFailures, 1);
+            }
+        }
+        conn->lastActivity = time(NULL);
+        if (!conn->parked && (conn->outSegmentCount == before || !conn->keepAlive)) {
+            // either the handler refused to answer or the client asked us to hang up
+            conn->closeAfterWrite = true;
+        }
 
-    cJSON_Delete(resp);
-    cJSON_free(marshalled);
+        // pipelined requests that arrived in the same read move to the front of the buffer
+        conn->inLength -= request_length;
+        memmove(conn->in, conn->in + request_length, conn->inLength);
+        http_parser_reset(&conn->parser);
+    }
 }
 
-void handle_connection(int conn_fd) {
-    char buffer[MAX_MESSAGE_LENGTH] = {0};
-    printf("Accepted connection.\n");
+size_t frame_http_request(Connection* conn) {
+    HttpParseResult result = http_parse_request(&conn->parser, conn->in, conn->inLength, MAX_MESSAGE_LENGTH);
+    if (result == HTTP_INCOMPLETE)
+        return 0;
+    if (result == HTTP_INVALID) {
+        reject_request(conn);
+        return 0;
+    }
 
-    int n = readfull_header(conn_fd, buffer, MAX_MESSAGE_LENGTH);
+    conn->keepAlive = conn->parser.keepAlive;
+    return conn->parser.headerLength + conn->parser.contentLength;
+}
 
-    if (n < 0) {
-        perror("receive has failed");
-        close(conn_fd);
-        return;
+size_t frame_binary_request(Connection* conn) {
+    if (conn->inLength < BINARY_FRAME_HEADER)
+        return 0;
+
+    size_t length = BINARY_FRAME_HEADER + ((unsigned char) conn->in[0] << 8 | (unsigned char) conn->in[1]);
+    if (length > MAX_MESSAGE_LENGTH) {
+        // there is no error frame, a client that cannot be framed is hung up on
+        printf("binary frame of %zu bytes is too long\n", length);
+        metrics_add(&metrics_local()->parseFailures, 1);
+        conn->closeAfterWrite = true;
+        return 0;
     }
+    return conn->inLength >= length ? length : 0;
+}
 
-    int body_length = extract_content_length(buffer);
-    printf("Body length: %d\n", body_length);
+void reject_request(Connection* conn) {
+    printf("rejecting malformed request with status %d\n", conn->parser.errorStatus);
+    metrics_add(&metrics_local()->parseFailures, 1);
+    queue_segment(conn, http_write_error(&conn->out, conn->parser.errorStatus));
+    // the rest of the stream cannot be framed anymore
+    conn->closeAfterWrite = true;
+}
 
-    bzero(buffer, MAX_MESSAGE_LENGTH);
-    char* request_body = readfull_body(conn_fd, buffer, body_length);
-    printf("HTTP request body: %s\n", request_body);
+ConnectionStatus connection_on_readable(Connection* conn) {
+    for (;;) {
+        process_requests(conn);
+        if (conn->closeAfterWrite || conn->peerClosed)
+            break;
+        if (output_full(conn)) {
+            ConnectionStatus status = flush_response(conn);
+            if (status == CONNECTION_CLOSED || conn->outSegmentCount != 0)
+                return status;
+            continue;
+        }
 
-    cJSON* root = cJSON_Parse(request_body);
-    if (root == NULL) {
-        printf("error parsing JSON body\n");
-        exit(1);
+        // a parked connection keeps reading so a client hanging up is noticed right away
+        size_t space = MAX_MESSAGE_LENGTH - conn->inLength;
+        if (space == 0)
+            break;
+        ssize_t read = recv(conn->fd, conn->in + conn->inLength, space, 0);
+        metrics_add(&metrics_local()->syscalls, 1);
+        if (read < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            perror("receive has failed");
+            return CONNECTION_CLOSED;
+        }
+        if (read == 0) {
+            // answer whatever the client already sent, then hang up
+            conn->peerClosed = true;
+            break;
+        }
+
+        conn->inLength += read;
+        metrics_add(&metrics_local()->bytesReceived, read);
+    }
+
+    return flush_response(conn);
+}
+
+ConnectionStatus connection_on_writable(Connection* conn) {
+    if (conn->outSegmentCount == 0)
+        return CONNECTION_OPEN;
+
+    ConnectionStatus status = flush_response(conn);
+    if (status == CONNECTION_OPEN && conn->outSegmentCount == 0) {
+        // output drained, resume any pipelined requests we stopped reading
+        return connection_on_readable(conn);
+    }
+    return status;
+}
+
+ConnectionStatus flush_response(Connection* conn) {
+    while (conn->outSegmentIndex < conn->outSegmentCount) {
+        // every queued response goes out in one vectored send, the gaps in front of the headers are skipped
+        struct iovec iov[MAX_OUTPUT_SEGMENTS];
+        int count = connection_output(conn, iov);
+
+        // sendmsg is writev with flags, MSG_NOSIGNAL keeps a vanished peer from raising SIGPIPE
+        struct msghdr message = {.msg_iov = iov, .msg_iovlen = count};
+        ssize_t sent = sendmsg(conn->fd, &message, MSG_NOSIGNAL);
+        metrics_add(&metrics_local()->syscalls, 1);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return CONNECTION_OPEN;
+            perror("send has failed");
+            return CONNECTION_CLOSED;
+        }
+        connection_sent(conn, (size_t) sent);
     }
 
-    cJSON* message_type = cJSON_GetObjectItem(root, "messageType");
-    if (message_type == NULL) {
-        printf("malformed message: %s\n", request_body);
-        exit(1);
+    if (conn->closeAfterWrite || conn->peerClosed)
+        return CONNECTION_CLOSED;
+    return CONNECTION_OPEN;
+}
+
+void connection_process(Connection* conn) {
+    process_requests(conn);
+}
+
+int connection_output(Connection* conn, struct iovec* iov) {
+    int count = 0;
+    for (int i = conn->outSegmentIndex; i < conn->outSegmentCount; i++) {
+        OutputSegment* segment = &conn->outSegments[i];
+        size_t skip = i == conn->outSegmentIndex ? conn->outOffset : 0;
+        char* base = segment->shared != nullptr ? segment->shared->data : conn->out.data + segment->start;
+        iov[count].iov_base = base + skip;
+        iov[count].iov_len = segment->length - skip;
+        count++;
+    }
+    return count;
+}
+
+void connection_sent(Connection* conn, size_t sent) {
+    conn->outPending -= sent;
+    metrics_add(&metrics_local()->bytesSent, sent);
+    while (sent > 0) {
+        size_t left = conn->outSegments[conn->outSegmentIndex].length - conn->outOffset;
+        if (sent < left) {
+            conn->outOffset += sent;
+            break;
+        }
+        sent -= left;
+        shared_buffer_release(conn->outSegments[conn->outSegmentIndex].shared);
+        conn->outSegmentIndex++;
+        conn->outOffset = 0;
     }
+    if (conn->outSegmentIndex < conn->outSegmentCount)
+        return;
 
-    switch (message_type->valueint) {
+    conn->out.length = 0;
+    conn->outSegmentCount = 0;
+    conn->outSegmentIndex = 0;
+    conn->outOffset = 0;
+    if (conn->resumePending && !conn->sending) {
+        conn->resumePending = false;
+        connection_resume(conn);
+    }
+}
+
+void connection_detach(Connection* conn) {
+    if (conn->parked) {
+        mtx_lock(conn->parkedLock);
+        if (conn->parkedGame != nullptr)
+            unpark_connection(conn);
+        mtx_unlock(conn->parkedLock);
+        conn->parked = false;
+        conn->parkedLock = nullptr;
+    }
+    // off the waiter list nobody can queue it again, drop an answer that is still in flight
+    event_loop_cancel_wake(conn->loop, conn);
+    shared_buffer_release(conn->wakeShared);
+    conn->wakeShared = nullptr;
+    conn->resumePending = false;
+}
+
+void connection_destroy(Connection* conn) {
+    connection_detach(conn);
+    for (int i = conn->outSegmentIndex; i < conn->outSegmentCount; i++)
+        shared_buffer_release(conn->outSegments[i].shared);
+    // an io_uring loop may have closed the descriptor already
+    if (conn->fd >= 0) {
+        close(conn->fd);
+        metrics_add(&metrics_local()->syscalls, 1);
+    }
+    metrics_add(&metrics_local()->connectionsClosed, 1);
+    byte_buffer_free(&conn->wakeBody);
+    byte_buffer_free(&conn->out);
+    free(conn);
+}
+
+bool decode_request(Connection* conn, size_t length, Request* request) {
+    // the body is decoded where it was received, the next pipelined request may follow right behind it
+    if (conn->protocol == PROTOCOL_BINARY)
+        return decode_binary_request((const uint8_t*) conn->in + BINARY_FRAME_HEADER, length - BINARY_FRAME_HEADER,
+                                     request);
+
+    const char* request_body = conn->in + conn->parser.headerLength;
+    size_t body_length = conn->parser.contentLength;
+    return decode_json_request(request_body, body_length, request);
+}
+
+void dispatch_request(Connection* conn, const Request* request) {
+    // everything a request touches belongs to one game, its shard lock covers the whole handler
+    mtx_t* lock = request->gameId[0] != '\0' ? game_lock(request->gameId) : nullptr;
+    if (lock != nullptr)
+        mtx_lock(lock);
+
+    switch (request->messageType) {
         case JOIN_GAME:
-            handle_join_game(conn_fd, root);
+            handle_join_game(conn, request);
             break;
         case GAME_STATE_REQUEST:
-            handle_sync_state(conn_fd, root);
+            handle_sync_state(conn, request);
             break;
         case MOVE_PIECE:
-            handle_move_piece(conn_fd, root);
+            handle_move_piece(conn, request);
             break;
         case DISCONNECT:
-            handle_disconnect(conn_fd, root);
+            handle_disconnect(conn, request);
+            break;
+        case WATCH_GAME:
+            handle_watch_game(conn, request);
+            break;
+        case JOIN_COMPUTER_GAME:
+            handle_join_computer_game(conn, request);
+            break;
+        case FIND_MATCH:
+            handle_find_match(conn, request);
             break;
         case EXIT_SERVER:
             printf("Exiting server\n");
+            // no shard lock is held here, so the writer can collect the last changes
+            journal_close();
+            archive_close();
             exit(0);
         default:
-            printf("unknown message type: %d\n", message_type->valueint);
-            exit(1);
+            printf("unknown message type: %d\n", request->messageType);
+            break;
     }
 
-    mark_disconnected_players();
-
-    cJSON_Delete(root);
-
-    shutdown(conn_fd, SHUT_RDWR);
+    if (lock != nullptr)
+        mtx_unlock(lock);
 }
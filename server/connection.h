@@ -5,6 +5,131 @@
 #ifndef SERVER_CONNECTION_H
 #define SERVER_CONNECTION_H
 
-void handle_connection(int descriptor);
+#include <stddef.h>
+#include <time.h>
+#include <threads.h>
+#include <sys/uio.h>
+#include "game.h"
+#include "http.h"
+#include "json_writer.h"
+#include "protocol.h"
+
+#define MAX_MESSAGE_LENGTH 2048
+// stop reading pipelined requests until the client drains this much output
+#define MAX_PENDING_OUTPUT 65536
+// responses queued per connection before pipelined requests are held back
+#define MAX_OUTPUT_SEGMENTS 64
+#define CONNECTION_IDLE_TIMEOUT 15
+// parked state requests are answered with the unchanged state after this many seconds
+#define LONG_POLL_TIMEOUT 10
+
+typedef enum {
+    CONNECTION_OPEN,
+    CONNECTION_CLOSED
+} ConnectionStatus;
+
+struct EventLoop;
+struct ConnectionList;
+
+struct SharedBuffer;
+
+// one framed response (header immediately followed by body) inside the output buffer
+typedef struct {
+    size_t start;
+    size_t length;
+    // or a body shared with other connections, sent from there and released once it went out
+    struct SharedBuffer* shared;
+} OutputSegment;
+
+typedef struct Connection {
+    int fd;
+    // HTTP/JSON or length-prefixed binary frames, fixed by the port the client connected to
+    Protocol protocol;
+    bool keepAlive;
+    bool closeAfterWrite;
+    bool peerClosed;
+    time_t lastActivity;
+
+    // the event loop keeps every connection on exactly one of its lists
+    struct EventLoop* loop;
+    struct ConnectionList* list;
+    struct Connection* listPrev;
+    struct Connection* listNext;
+
+    // owned by the connection's thread: a state request is waiting and later requests are held back
+    bool parked;
+    mtx_t* parkedLock;
+    time_t parkedAt;
+
+    // guarded by parkedLock, cleared by whichever thread answers the parked request
+    GameStatus* parkedGame;
+    // nullptr for a spectator, who waits on the game's spectator list instead
+    Player* parkedPlayer;
+    unsigned int parkedVersion;
+    struct Connection* waitPrev;
+    struct Connection* waitNext;
+
+    // body of the answer produced on another thread, handed over through the owning loop's inbox
+    ByteBuffer wakeBody;
+    // a spectator is handed a reference to the game's shared frame instead
+    struct SharedBuffer* wakeShared;
+    bool wakeQueued;
+    struct Connection* wakeNext;
+
+    // request bytes received so far, the parser remembers how far it got through them
+    char in[MAX_MESSAGE_LENGTH];
+    size_t inLength;
+    HttpParser parser;
+
+    // serialized responses waiting to be flushed, in request order, sent together with one sendmsg
+    ByteBuffer out;
+    OutputSegment outSegments[MAX_OUTPUT_SEGMENTS];
+    int outSegmentCount;
+    // first segment not fully sent yet and how much of it already went out
+    int outSegmentIndex;
+    size_t outOffset;
+    size_t outPending;
+
+    // a completion-based loop has a send of the queued output in flight, the output must not move until it is done
+    bool sending;
+    // the parked request was answered during that send, the answer is queued once the send is done
+    bool resumePending;
+    // owned by an io_uring loop: a recv is armed, the connection is being closed and how many operations still
+    // point at it, it is freed when the last one completes
+    bool receiving;
+    bool closing;
+    bool closeQueued;
+    int pendingOps;
+} Connection;
+
+Connection* connection_create(int fd, struct EventLoop* loop, Protocol protocol);
+
+ConnectionStatus connection_on_readable(Connection* conn);
+
+ConnectionStatus connection_on_writable(Connection* conn);
+
+// completion-based loops do the reads and writes themselves and use the next three instead of the two above
+
+// runs the requests received so far, unless a send is in flight
+void connection_process(Connection* conn);
+
+// points iov at the output still to be sent, at most MAX_OUTPUT_SEGMENTS entries, returns how many it used
+int connection_output(Connection* conn, struct iovec* iov);
+
+// accounts for sent bytes of that output, as many as a sendmsg of it returned
+void connection_sent(Connection* conn, size_t sent);
+
+// answers a parked request with the current state, false if another thread already answered it
+bool connection_expire_long_poll(Connection* conn);
+
+// owning thread: queue the response another thread prepared for a parked request
+void connection_resume(Connection* conn);
+
+// stops other threads from reaching the connection, for a loop that cannot free it until its I/O completes
+void connection_detach(Connection* conn);
+
+void connection_destroy(Connection* conn);
+
+void connections_init();
 
 #endif //SERVER_CONNECTION_H
@@ -0,0 +1,430 @@
+#include <stdlib.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "engine.h"
+#include "chess_rules.h"
+
+#define INFINITE_SCORE 32000
+// the clock is read once per this many nodes, a few microseconds of search at most
+#define TIME_CHECK_NODES 2048
+#define KILLER_SCORE (1 << 15)
+#define CAPTURE_SCORE (1 << 16)
+#define TABLE_MOVE_SCORE (1 << 20)
+// side material without pawns below which kings stop hiding and head for the centre
+#define ENDGAME_MATERIAL 1300
+
+enum Bound {
+    BOUND_EXACT = 1,
+    BOUND_LOWER,
+    BOUND_UPPER
+};
+
+typedef struct {
+    _Atomic uint64_t check;
+    _Atomic uint64_t data;
+} TableEntry;
+
+// data packs the best move, the score, the depth it was searched to and what kind of bound the score is
+#define ENTRY(move, score, depth, bound) \
+    ((uint64_t) (move) | (uint64_t) (uint16_t) (score) << 16 | (uint64_t) (depth) << 32 | (uint64_t) (bound) << 40)
+#define ENTRY_MOVE(data) ((Move) ((data) & 0xffff))
+#define ENTRY_SCORE(data) ((int) (int16_t) ((data) >> 16 & 0xffff))
+#define ENTRY_DEPTH(data) ((int) ((data) >> 32 & 0xff))
+#define ENTRY_BOUND(data) ((int) ((data) >> 40 & 3))
+
+typedef struct {
+    Position position;
+    // hashes of the positions before the current one, the game's history followed by the line being searched
+    uint64_t hashes[ENGINE_MAX_HISTORY + ENGINE_MAX_PLY];
+    int hashCount;
+    Move killers[ENGINE_MAX_PLY][2];
+    // best move at the root so far, searched first by the next iteration
+    Move best;
+    uint64_t nodes;
+    uint64_t deadline;
+    bool stopped;
+} Search;
+
+static TableEntry* table = nullptr;
+static uint64_t tableMask = 0;
+
+static const int PIECE_VALUES[PIECE_TYPES] = {100, 320, 330, 500, 900, 0};
+
+// bonuses by square from white's side, a8 first, after Tomasz Michniewski's simplified evaluation function
+static const int8_t PIECE_SQUARES[PIECE_TYPES][64] = {
+        {0,   0,   0,   0,   0,   0,   0,   0,
+                50,  50,  50,  50,  50,  50,  50,  50,
+                10,  10,  20,  30,  30,  20,  10,  10,
+                5,   5,   10,  25,  25,  10,  5,   5,
+                0,   0,   0,   20,  20,  0,   0,   0,
+                5,   -5,  -10, 0,   0,   -10, -5,  5,
+                5,   10,  10,  -20, -20, 10,  10,  5,
+                0,   0,   0,   0,   0,   0,   0,   0},
+        {-50, -40, -30, -30, -30, -30, -40, -50,
+                -40, -20, 0,   0,   0,   0,   -20, -40,
+                -30, 0,   10,  15,  15,  10,  0,   -30,
+                -30, 5,   15,  20,  20,  15,  5,   -30,
+                -30, 0,   15,  20,  20,  15,  0,   -30,
+                -30, 5,   10,  15,  15,  10,  5,   -30,
+                -40, -20, 0,   5,   5,   0,   -20, -40,
+                -50, -40, -30, -30, -30, -30, -40, -50},
+        {-20, -10, -10, -10, -10, -10, -10, -20,
+                -10, 0,   0,   0,   0,   0,   0,   -10,
+                -10, 0,   5,   10,  10,  5,   0,   -10,
+                -10, 5,   5,   10,  10,  5,   5,   -10,
+                -10, 0,   10,  10,  10,  10,  0,   -10,
+                -10, 10,  10,  10,  10,  10,  10,  -10,
+                -10, 5,   0,   0,   0,   0,   5,   -10,
+                -20, -10, -10, -10, -10, -10, -10, -20},
+        {0,   0,   0,   0,   0,   0,   0,   0,
+                5,   10,  10,  10,  10,  10,  10,  5,
+                -5,  0,   0,   0,   0,   0,   0,   -5,
+                -5,  0,   0,   0,   0,   0,   0,   -5,
+                -5,  0,   0,   0,   0,   0,   0,   -5,
+                -5,  0,   0,   0,   0,   0,   0,   -5,
+                -5,  0,   0,   0,   0,   0,   0,   -5,
+                0,   0,   0,   5,   5,   0,   0,   0},
+        {-20, -10, -10, -5,  -5,  -10, -10, -20,
+                -10, 0,   0,   0,   0,   0,   0,   -10,
+                -10, 0,   5,   5,   5,   5,   0,   -10,
+                -5,  0,   5,   5,   5,   5,   0,   -5,
+                0,   0,   5,   5,   5,   5,   0,   -5,
+                -10, 5,   5,   5,   5,   5,   0,   -10,
+                -10, 0,   5,   0,   0,   0,   0,   -10,
+                -20, -10, -10, -5,  -5,  -10, -10, -20},
+        {-30, -40, -40, -50, -50, -40, -40, -30,
+                -30, -40, -40, -50, -50, -40, -40, -30,
+                -30, -40, -40, -50, -50, -40, -40, -30,
+                -30, -40, -40, -50, -50, -40, -40, -30,
+                -20, -30, -30, -40, -40, -30, -30, -20,
+                -10, -20, -20, -20, -20, -20, -20, -10,
+                20,  20,  0,   0,   0,   0,   20,  20,
+                20,  30,  10,  0,   0,   10,  30,  20},
+};
+
+static const int8_t KING_ENDGAME_SQUARES[64] = {
+        -50, -40, -30, -20, -20, -30, -40, -50,
+        -30, -20, -10, 0,   0,   -10, -20, -30,
+        -30, -10, 20,  30,  30,  20,  -10, -30,
+        -30, -10, 30,  40,  40,  30,  -10, -30,
+        -30, -10, 30,  40,  40,  30,  -10, -30,
+        -30, -10, 20,  30,  30,  20,  -10, -30,
+        -30, -30, 0,   0,   0,   0,   -30, -30,
+        -50, -30, -30, -30, -30, -30, -30, -50,
+};
+
+static uint64_t now_ns();
+
+static int alpha_beta(Search* s, int depth, int alpha, int beta, int ply);
+
+static int quiescence(Search* s, int alpha, int beta, int ply);
+
+static bool out_of_time(Search* s);
+
+static bool is_repetition(const Search* s);
+
+static void score_moves(const Search* s, const MoveList* moves, int* scores, Move tableMove, int ply);
+
+static Move next_move(MoveList* moves, int* scores, int index);
+
+static bool probe_table(uint64_t hash, uint64_t* data);
+
+static void store_table(uint64_t hash, Move move, int score, int depth, int bound);
+
+static int score_to_table(int score, int ply);
+
+static int score_from_table(int score, int ply);
+
+void engine_init(size_t tableBytes) {
+    size_t entries = 1;
+    while (entries * 2 * sizeof(TableEntry) <= tableBytes)
+        entries *= 2;
+    // zeroed entries only match the all-zero hash, which no position has
+    table = calloc(entries, sizeof(TableEntry));
+    tableMask = entries - 1;
+}
+
+uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int engine_evaluate(const Position* pos) {
+    int score[2] = {0, 0};
+    int material[2] = {0, 0};
+    for (int color = 0; color < 2; color++) {
+        for (int type = 0; type < PIECE_TYPES; type++) {
+            Bitboard pieces = pos->pieces[color][type];
+            while (pieces != 0) {
+                int sq = pop_lsb(&pieces);
+                // the tables are drawn for white, black reads them upside down
+                int index = color == WHITE ? sq ^ 56 : sq;
+                score[color] += PIECE_VALUES[type] + PIECE_SQUARES[type][index];
+                if (type != PIECE_INDEX(PAWN))
+                    material[color] += PIECE_VALUES[type];
+            }
+        }
+    }
+
+    if (material[WHITE] <= ENDGAME_MATERIAL && material[BLACK] <= ENDGAME_MATERIAL) {
+        for (int color = 0; color < 2; color++) {
+            int king = __builtin_ctzll(pos->pieces[color][PIECE_INDEX(KING)]);
+            int index = color == WHITE ? king ^ 56 : king;
+            score[color] += KING_ENDGAME_SQUARES[index] - PIECE_SQUARES[PIECE_INDEX(KING)][index];
+        }
+    }
+
+    return pos->sideToMove == WHITE ? score[WHITE] - score[BLACK] : score[BLACK] - score[WHITE];
+}
+
+SearchResult engine_search(const Position* root, const uint64_t* history, int historyCount, uint64_t budgetNs) {
+    uint64_t start = now_ns();
+    SearchResult result = {NO_MOVE, 0, 0, 0, 0};
+
+    MoveList moves;
+    generate_legal_moves(root, &moves);
+    if (moves.count == 0)
+        return result;
+    // something to play even if the first iteration does not finish
+    result.best = moves.moves[0];
+
+    Search s;
+    s.position = *root;
+    if (historyCount > ENGINE_MAX_HISTORY) {
+        history += historyCount - ENGINE_MAX_HISTORY;
+        historyCount = ENGINE_MAX_HISTORY;
+    }
+    for (int i = 0; i < historyCount; i++)
+        s.hashes[i] = history[i];
+    s.hashCount = historyCount;
+    for (int i = 0; i < ENGINE_MAX_PLY; i++)
+        s.killers[i][0] = s.killers[i][1] = NO_MOVE;
+    s.best = NO_MOVE;
+    s.nodes = 0;
+    s.deadline = start + budgetNs;
+    s.stopped = false;
+
+    for (int depth = 1; depth <= ENGINE_MAX_DEPTH; depth++) {
+        int score = alpha_beta(&s, depth, -INFINITE_SCORE, INFINITE_SCORE, 0);
+        // an unfinished iteration may not have looked at the best move yet
+        if (s.stopped)
+            break;
+        result.best = s.best;
+        result.score = score;
+        result.depth = depth;
+
+        // the next iteration takes several times as long as this one, do not start what cannot finish
+        if (moves.count == 1 || score >= ENGINE_MATE_BOUND || score <= -ENGINE_MATE_BOUND ||
+            now_ns() - start > budgetNs / 2)
+            break;
+    }
+
+    result.nodes = s.nodes;
+    result.elapsedNs = now_ns() - start;
+    return result;
+}
+
+int alpha_beta(Search* s, int depth, int alpha, int beta, int ply) {
+    Position* pos = &s->position;
+    if (ply > 0 && (pos->halfmoveClock >= 100 || is_repetition(s)))
+        return 0;
+    if (ply >= ENGINE_MAX_PLY - 1)
+        return engine_evaluate(pos);
+
+    bool in_check = is_in_check(pos);
+    // a check is followed one ply further, so the search does not stop right in front of a mate
+    if (in_check)
+        depth++;
+    if (depth <= 0)
+        return quiescence(s, alpha, beta, ply);
+    if (out_of_time(s))
+        return 0;
+
+    uint64_t data;
+    Move table_move = NO_MOVE;
+    if (probe_table(pos->hash, &data)) {
+        table_move = ENTRY_MOVE(data);
+        int score = score_from_table(ENTRY_SCORE(data), ply);
+        int bound = ENTRY_BOUND(data);
+        if (ply > 0 && ENTRY_DEPTH(data) >= depth &&
+            (bound == BOUND_EXACT || (bound == BOUND_LOWER && score >= beta) ||
+             (bound == BOUND_UPPER && score <= alpha)))
+            return score;
+    }
+    if (ply == 0 && s->best != NO_MOVE)
+        table_move = s->best;
+
+    MoveList moves;
+    generate_legal_moves(pos, &moves);
+    if (moves.count == 0)
+        return in_check ? -ENGINE_MATE + ply : 0;
+
+    int scores[MAX_MOVES];
+    score_moves(s, &moves, scores, table_move, ply);
+
+    int original_alpha = alpha;
+    int best_score = -INFINITE_SCORE;
+    Move best_move = NO_MOVE;
+    for (int i = 0; i < moves.count; i++) {
+        Move move = next_move(&moves, scores, i);
+        UndoInfo undo;
+        s->hashes[s->hashCount++] = pos->hash;
+        make_move(pos, move, &undo);
+        int score = -alpha_beta(s, depth - 1, -beta, -alpha, ply + 1);
+        unmake_move(pos, move, &undo);
+        s->hashCount--;
+        if (s->stopped)
+            return 0;
+
+        if (score > best_score) {
+            best_score = score;
+            best_move = move;
+            if (ply == 0)
+                s->best = move;
+        }
+        if (score > alpha)
+            alpha = score;
+        if (alpha >= beta) {
+            // a quiet move that refuted this line is tried early in its sibling lines too
+            if (!IS_CAPTURE(move) && s->killers[ply][0] != move) {
+                s->killers[ply][1] = s->killers[ply][0];
+                s->killers[ply][0] = move;
+            }
+            break;
+        }
+    }
+
+    int bound = best_score >= beta ? BOUND_LOWER : best_score > original_alpha ? BOUND_EXACT : BOUND_UPPER;
+    store_table(pos->hash, best_move, score_to_table(best_score, ply), depth, bound);
+    return best_score;
+}
+
+int quiescence(Search* s, int alpha, int beta, int ply) {
+    Position* pos = &s->position;
+    if (out_of_time(s))
+        return 0;
+
+    // the side to move can usually do at least as well as standing still, so that is a lower bound
+    int stand_pat = engine_evaluate(pos);
+    if (stand_pat >= beta || ply >= ENGINE_MAX_PLY - 1)
+        return stand_pat;
+    if (stand_pat > alpha)
+        alpha = stand_pat;
+
+    MoveList moves;
+    generate_legal_moves(pos, &moves);
+    int scores[MAX_MOVES];
+    score_moves(s, &moves, scores, NO_MOVE, ply);
+
+    for (int i = 0; i < moves.count; i++) {
+        Move move = next_move(&moves, scores, i);
+        // quiet moves sort last, the rest of the list has nothing left to resolve
+        if (!IS_CAPTURE(move) && !IS_PROMOTION(move))
+            break;
+
+        UndoInfo undo;
+        make_move(pos, move, &undo);
+        int score = -quiescence(s, -beta, -alpha, ply + 1);
+        unmake_move(pos, move, &undo);
+        if (s->stopped)
+            return 0;
+
+        if (score >= beta)
+            return score;
+        if (score > alpha)
+            alpha = score;
+    }
+    return alpha;
+}
+
+bool out_of_time(Search* s) {
+    if ((++s->nodes & (TIME_CHECK_NODES - 1)) == 0 && now_ns() >= s->deadline)
+        s->stopped = true;
+    return s->stopped;
+}
+
+bool is_repetition(const Search* s) {
+    // only positions since the last capture or pawn move can repeat, and only every other one has our side to move
+    int limit = s->position.halfmoveClock < s->hashCount ? s->position.halfmoveClock : s->hashCount;
+    for (int back = 2; back <= limit; back += 2) {
+        if (s->hashes[s->hashCount - back] == s->position.hash)
+            return true;
+    }
+    return false;
+}
+
+void score_moves(const Search* s, const MoveList* moves, int* scores, Move tableMove, int ply) {
+    for (int i = 0; i < moves->count; i++) {
+        Move move = moves->moves[i];
+        int score = 0;
+        if (move == tableMove) {
+            score = TABLE_MOVE_SCORE;
+        } else if (IS_CAPTURE(move) || IS_PROMOTION(move)) {
+            // most valuable victim first, taken by the least valuable attacker
+            int victim = piece_at(&s->position, MOVE_TO(move)) & 7;
+            int attacker = piece_at(&s->position, MOVE_FROM(move)) & 7;
+            int victim_value = victim != EMPTY ? PIECE_VALUES[PIECE_INDEX(victim)] : IS_CAPTURE(move) ? 100 : 0;
+            if (IS_PROMOTION(move))
+                victim_value += PIECE_VALUES[PIECE_INDEX(PROMOTION_PIECE(move))];
+            score = CAPTURE_SCORE + victim_value * 8 - attacker;
+        } else if (move == s->killers[ply][0]) {
+            score = KILLER_SCORE;
+        } else if (move == s->killers[ply][1]) {
+            score = KILLER_SCORE - 1;
+        }
+        scores[i] = score;
+    }
+}
+
+Move next_move(MoveList* moves, int* scores, int index) {
+    // a selection sort one step at a time, most nodes cut off after the first few moves
+    int best = index;
+    for (int i = index + 1; i < moves->count; i++) {
+        if (scores[i] > scores[best])
+            best = i;
+    }
+    Move move = moves->moves[best];
+    int score = scores[best];
+    moves->moves[best] = moves->moves[index];
+    scores[best] = scores[index];
+    moves->moves[index] = move;
+    scores[index] = score;
+    return move;
+}
+
+bool probe_table(uint64_t hash, uint64_t* data) {
+    TableEntry* entry = &table[hash & tableMask];
+    *data = atomic_load_explicit(&entry->data, memory_order_relaxed);
+    uint64_t check = atomic_load_explicit(&entry->check, memory_order_relaxed);
+    return (check ^ *data) == hash;
+}
+
+void store_table(uint64_t hash, Move move, int score, int depth, int bound) {
+    TableEntry* entry = &table[hash & tableMask];
+    uint64_t data;
+    // a deeper result for the same position is worth more than a shallower bound
+    if (probe_table(hash, &data) && ENTRY_DEPTH(data) > depth && bound != BOUND_EXACT)
+        return;
+
+    data = ENTRY(move, score, depth, bound);
+    atomic_store_explicit(&entry->check, hash ^ data, memory_order_relaxed);
+    atomic_store_explicit(&entry->data, data, memory_order_relaxed);
+}
+
+int score_to_table(int score, int ply) {
+    // mates are stored as distance from the position, not from the root of whichever search found them
+    if (score >= ENGINE_MATE_BOUND)
+        return score + ply;
+    if (score <= -ENGINE_MATE_BOUND)
+        return score - ply;
+    return score;
+}
+
+int score_from_table(int score, int ply) {
+    if (score >= ENGINE_MATE_BOUND)
+        return score - ply;
+    if (score <= -ENGINE_MATE_BOUND)
+        return score + ply;
+    return score;
+}
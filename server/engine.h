@@ -0,0 +1,48 @@
+#ifndef SERVER_ENGINE_H
+#define SERVER_ENGINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "bitboard.h"
+#include "movegen.h"
+
+// deepest iteration a search starts
+#define ENGINE_MAX_DEPTH 32
+// longest line followed from the root, check extensions and captures included
+#define ENGINE_MAX_PLY 96
+// earlier positions of the game a repetition can reach back to, the fifty-move rule bounds them
+#define ENGINE_MAX_HISTORY 128
+// a score beyond ENGINE_MATE_BOUND is a forced mate, ENGINE_MATE minus the plies it takes
+#define ENGINE_MATE 30000
+#define ENGINE_MATE_BOUND (ENGINE_MATE - ENGINE_MAX_PLY)
+
+typedef struct {
+    // NO_MOVE only when the side to move has no legal move
+    Move best;
+    // centipawns from the point of view of the side to move
+    int score;
+    // last iteration that finished
+    int depth;
+    uint64_t nodes;
+    uint64_t elapsedNs;
+} SearchResult;
+
+/*
+ * Iterative-deepening alpha-beta with a quiescence search over captures.
+ * Every search runs on its own copy of the position, so any number of them
+ * can run at once; they share one transposition table that is read and
+ * written without locks. An entry is stored as key ^ data next to data, a
+ * slot torn by two threads writing at once no longer matches its key and is
+ * simply a miss.
+ */
+
+// allocates the shared transposition table, tableBytes is rounded down to a power of two entries
+void engine_init(size_t tableBytes);
+
+// history holds the hashes of the positions before the root since the last capture or pawn move, oldest first
+SearchResult engine_search(const Position* root, const uint64_t* history, int historyCount, uint64_t budgetNs);
+
+// material and piece placement in centipawns, from the point of view of the side to move
+int engine_evaluate(const Position* pos);
+
+#endif //SERVER_ENGINE_H
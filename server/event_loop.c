@@ -0,0 +1,805 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <threads.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include "event_loop.h"
+#include "connection.h"
+#include "common.h"
+#include "metrics.h"
+#include "uring.h"
+
+#define MAX_EVENTS 256
+// epoll_wait wakes up at least this often to expire idle connections and game timers
+#define SWEEP_INTERVAL_MS 1000
+// io_uring backend: submission queue entries, receive buffers of MAX_MESSAGE_LENGTH bytes each shared by all
+// connections of the loop, and how many sends can be prepared before they have to be submitted
+#define URING_ENTRIES 1024
+#define URING_BUFFERS 512
+#define URING_BUFFER_GROUP 0
+#define URING_SEND_BATCH 128
+#define URING_SEND_VECTORS 2048
+
+typedef struct ConnectionList {
+    Connection* head;
+    Connection* tail;
+} ConnectionList;
+
+// one per port, registered with epoll by its own address; every loop shares the same listening sockets
+typedef struct {
+    int fd;
+    Protocol protocol;
+    // io_uring backend: the multishot accept is running
+    bool armed;
+} Listener;
+
+// what a completion is for, kept in the low bits of its user data, the rest is the connection if there is one
+typedef enum {
+    URING_RECV,
+    URING_SEND,
+    URING_CLOSE,
+    URING_CANCEL,
+    URING_ACCEPT_HTTP,
+    URING_ACCEPT_BINARY,
+    URING_WAKE
+} UringOp;
+
+#define URING_OP_MASK 7ULL
+
+struct EventLoop {
+    IoBackend backend;
+    int epollFd;
+    Listener http;
+    Listener binary;
+    // least recently active first
+    ConnectionList idle;
+    // parked long-polls, oldest first
+    ConnectionList parked;
+    // connections with a response queued from outside their own event
+    ConnectionList ready;
+    time_t lastSweep;
+
+    // parked connections answered by other threads, guarded by inboxLock and signalled through wakeFd
+    int wakeFd;
+    mtx_t inboxLock;
+    Connection* inboxHead;
+    Connection* inboxTail;
+
+    // io_uring backend only
+    Uring ring;
+    UringBuffers buffers;
+    uint64_t wakeCount;
+    // messages of the sends queued since the last submit, the kernel has copied them once it is done
+    struct msghdr sendHeaders[URING_SEND_BATCH];
+    struct iovec sendVectors[URING_SEND_VECTORS];
+    int sendHeaderCount;
+    int sendVectorCount;
+};
+
+// loop run by the calling thread, wakes from inside it need no eventfd round trip
+static thread_local EventLoop* currentLoop = nullptr;
+
+static bool epoll_setup(EventLoop* loop);
+
+static bool add_listener(EventLoop* loop, Listener* listener);
+
+static void epoll_run(EventLoop* loop);
+
+static void accept_connections(EventLoop* loop, Listener* listener);
+
+static void handle_connection_event(EventLoop* loop, Connection* conn, uint32_t events);
+
+static bool uring_setup(EventLoop* loop);
+
+static void uring_run(EventLoop* loop);
+
+static void reserve(EventLoop* loop, unsigned count);
+
+static int submit(EventLoop* loop, bool wait);
+
+static uint64_t user_data(Connection* conn, UringOp op);
+
+static void arm_accept(EventLoop* loop, Listener* listener);
+
+static void arm_wake(EventLoop* loop);
+
+static void arm_recv(EventLoop* loop, Connection* conn);
+
+static void queue_send(EventLoop* loop, Connection* conn);
+
+static void queue_close(EventLoop* loop, Connection* conn);
+
+static void handle_completion(EventLoop* loop, uint64_t data, int result, unsigned flags);
+
+static void on_accepted(EventLoop* loop, Listener* listener, int result, unsigned flags);
+
+static void on_received(EventLoop* loop, Connection* conn, int result, unsigned flags);
+
+static void on_sent(EventLoop* loop, Connection* conn, int result);
+
+static void finish_operation(Connection* conn);
+
+static void serve_connection(EventLoop* loop, Connection* conn);
+
+static void after_connection_callback(EventLoop* loop, Connection* conn, ConnectionStatus status,
+                                      time_t last_activity);
+
+static void list_append(ConnectionList* list, Connection* conn);
+
+static void list_remove(Connection* conn);
+
+static void close_connection(Connection* conn);
+
+static void mark_ready(EventLoop* loop, Connection* conn);
+
+static void signal_inbox(EventLoop* loop, bool wasEmpty);
+
+static void run_inbox(EventLoop* loop);
+
+static void run_ready_connections(EventLoop* loop);
+
+static void expire_connections(EventLoop* loop);
+
+bool event_loop_backend_available(IoBackend backend) {
+    if (backend == IO_BACKEND_EPOLL)
+        return true;
+
+    // the setup flags the loop uses need Linux 6.1, which also has multishot accept and buffer rings
+    Uring ring;
+    if (!uring_init(&ring, 1))
+        return false;
+    uring_exit(&ring);
+    return true;
+}
+
+EventLoop* event_loop_create(int httpFd, int binaryFd, IoBackend backend) {
+    // io_uring reads the eventfd for the loop, which has to block rather than fail with EAGAIN
+    int wakeFd = eventfd(0, (backend == IO_BACKEND_EPOLL ? EFD_NONBLOCK : 0) | EFD_CLOEXEC);
+    if (wakeFd < 0) {
+        perror("eventfd has failed");
+        return nullptr;
+    }
+
+    EventLoop* loop = malloc(sizeof(EventLoop));
+    loop->backend = backend;
+    loop->epollFd = -1;
+    loop->http = (Listener) {httpFd, PROTOCOL_HTTP, false};
+    loop->binary = (Listener) {binaryFd, PROTOCOL_BINARY, false};
+    loop->idle = (ConnectionList) {nullptr, nullptr};
+    loop->parked = (ConnectionList) {nullptr, nullptr};
+    loop->ready = (ConnectionList) {nullptr, nullptr};
+    loop->lastSweep = time(NULL);
+    loop->wakeFd = wakeFd;
+    mtx_init(&loop->inboxLock, mtx_plain);
+    loop->inboxHead = nullptr;
+    loop->inboxTail = nullptr;
+
+    if (!(backend == IO_BACKEND_URING ? uring_setup(loop) : epoll_setup(loop))) {
+        close(wakeFd);
+        mtx_destroy(&loop->inboxLock);
+        free(loop);
+        return nullptr;
+    }
+    return loop;
+}
+
+bool epoll_setup(EventLoop* loop) {
+    loop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (loop->epollFd < 0) {
+        perror("epoll_create1 has failed");
+        return false;
+    }
+
+    // the loop itself marks its eventfd
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLET, .data.ptr = loop};
+    if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, loop->wakeFd, &ev) < 0 || !add_listener(loop, &loop->http) ||
+        !add_listener(loop, &loop->binary)) {
+        perror("epoll_ctl has failed");
+        close(loop->epollFd);
+        return false;
+    }
+    return true;
+}
+
+bool add_listener(EventLoop* loop, Listener* listener) {
+    // a new connection wakes one of the loops waiting on the socket instead of all of them
+    struct epoll_event ev = {.events = EPOLLIN | EPOLLET | EPOLLEXCLUSIVE, .data.ptr = listener};
+    return epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, listener->fd, &ev) == 0;
+}
+
+void accept_connections(EventLoop* loop, Listener* listener) {
+    // edge-triggered: drain the whole accept queue before going back to epoll_wait, another loop may get there
+    // first and leave this one with EAGAIN
+    for (;;) {
+        struct sockaddr_in client_sockaddr_in;
+        socklen_t len = sizeof(client_sockaddr_in);
+
+        int conn_fd = accept4(listener->fd, (struct sockaddr*) &client_sockaddr_in, &len,
+                              SOCK_NONBLOCK | SOCK_CLOEXEC);
+        metrics_add(&metrics_local()->syscalls, 1);
+        if (conn_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                perror("accept has failed");
+            return;
+        }
+
+        Connection* conn = connection_create(conn_fd, loop, listener->protocol);
+        list_append(&loop->idle, conn);
+        struct epoll_event ev = {.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET, .data.ptr = conn};
+        metrics_add(&metrics_local()->syscalls, 1);
+        if (epoll_ctl(loop->epollFd, EPOLL_CTL_ADD, conn_fd, &ev) < 0) {
+            perror("epoll_ctl has failed");
+            close_connection(conn);
+        }
+    }
+}
+
+void handle_connection_event(EventLoop* loop, Connection* conn, uint32_t events) {
+    ConnectionStatus status = CONNECTION_OPEN;
+    time_t last_activity = conn->lastActivity;
+
+    if (events & EPOLLERR) {
+        status = CONNECTION_CLOSED;
+    }
+
+    if (status == CONNECTION_OPEN && events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) {
+        status = connection_on_readable(conn);
+    }
+
+    if (status == CONNECTION_OPEN && events & EPOLLOUT) {
+        status = connection_on_writable(conn);
+    }
+
+    after_connection_callback(loop, conn, status, last_activity);
+}
+
+bool uring_setup(EventLoop* loop) {
+    if (!uring_init(&loop->ring, URING_ENTRIES)) {
+        perror("io_uring_setup has failed");
+        return false;
+    }
+    if (!uring_setup_buffers(&loop->ring, &loop->buffers, URING_BUFFERS, MAX_MESSAGE_LENGTH, URING_BUFFER_GROUP)) {
+        perror("cannot register the io_uring receive buffers");
+        uring_exit(&loop->ring);
+        return false;
+    }
+    loop->wakeCount = 0;
+    loop->sendHeaderCount = 0;
+    loop->sendVectorCount = 0;
+
+    // queued here, submitted by the first wait on the thread that runs the loop
+    arm_accept(loop, &loop->http);
+    arm_accept(loop, &loop->binary);
+    arm_wake(loop);
+    return true;
+}
+
+void reserve(EventLoop* loop, unsigned count) {
+    // room for count entries and one more send's messages, or everything queued so far goes to the kernel now
+    if (uring_space(&loop->ring) < count || loop->sendHeaderCount == URING_SEND_BATCH ||
+        loop->sendVectorCount > URING_SEND_VECTORS - MAX_OUTPUT_SEGMENTS)
+        submit(loop, false);
+}
+
+int submit(EventLoop* loop, bool wait) {
+    int result = uring_submit(&loop->ring, wait, SWEEP_INTERVAL_MS);
+    metrics_add(&metrics_local()->syscalls, 1);
+    // every entry is consumed, so the kernel has copied the messages they point at
+    if (uring_space(&loop->ring) == loop->ring.sqEntries) {
+        loop->sendHeaderCount = 0;
+        loop->sendVectorCount = 0;
+    }
+    return result;
+}
+
+uint64_t user_data(Connection* conn, UringOp op) {
+    // connections come from malloc, their low bits are free
+    return (uint64_t) (uintptr_t) conn | op;
+}
+
+void arm_accept(EventLoop* loop, Listener* listener) {
+    reserve(loop, 1);
+    struct io_uring_sqe* sqe = uring_get_sqe(&loop->ring);
+    // one entry keeps accepting until it fails, the new descriptors stay blocking since only the ring uses them
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listener->fd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = user_data(nullptr, listener == &loop->http ? URING_ACCEPT_HTTP : URING_ACCEPT_BINARY);
+    listener->armed = true;
+}
+
+void arm_wake(EventLoop* loop) {
+    reserve(loop, 1);
+    struct io_uring_sqe* sqe = uring_get_sqe(&loop->ring);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = loop->wakeFd;
+    sqe->addr = (uint64_t) (uintptr_t) &loop->wakeCount;
+    sqe->len = sizeof(loop->wakeCount);
+    sqe->user_data = user_data(nullptr, URING_WAKE);
+}
+
+void arm_recv(EventLoop* loop, Connection* conn) {
+    // a parked connection keeps reading so a client hanging up is noticed right away
+    size_t space = MAX_MESSAGE_LENGTH - conn->inLength;
+    if (conn->receiving || conn->closing || conn->closeAfterWrite || conn->peerClosed || space == 0)
+        return;
+
+    reserve(loop, 1);
+    struct io_uring_sqe* sqe = uring_get_sqe(&loop->ring);
+    // the kernel picks a buffer once data is there and fills no more of it than the request buffer has room for,
+    // the data is copied over on completion since requests are parsed where they lie
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->fd;
+    sqe->len = (uint32_t) space;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = user_data(conn, URING_RECV);
+    conn->receiving = true;
+    conn->pendingOps++;
+}
+
+void queue_send(EventLoop* loop, Connection* conn) {
+    bool last = conn->closeAfterWrite || conn->peerClosed;
+    // the send, the close linked behind it and the recv cancellation go in together
+    reserve(loop, 3);
+    struct iovec* iov = &loop->sendVectors[loop->sendVectorCount];
+    int count = connection_output(conn, iov);
+    loop->sendVectorCount += count;
+    struct msghdr* message = &loop->sendHeaders[loop->sendHeaderCount++];
+    *message = (struct msghdr) {.msg_iov = iov, .msg_iovlen = count};
+
+    struct io_uring_sqe* sqe = uring_get_sqe(&loop->ring);
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn->fd;
+    sqe->addr = (uint64_t) (uintptr_t) message;
+    sqe->len = 1;
+    // with MSG_WAITALL the kernel finishes a short send itself, a linked close runs only after all of it
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->user_data = user_data(conn, URING_SEND);
+    conn->sending = true;
+    conn->pendingOps++;
+
+    if (last) {
+        sqe->flags |= IOSQE_IO_LINK;
+        queue_close(loop, conn);
+        close_connection(conn);
+    }
+}
+
+void queue_close(EventLoop* loop, Connection* conn) {
+    reserve(loop, 1);
+    struct io_uring_sqe* sqe = uring_get_sqe(&loop->ring);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = conn->fd;
+    sqe->user_data = user_data(conn, URING_CLOSE);
+    conn->closeQueued = true;
+    conn->pendingOps++;
+}
+
+void uring_run(EventLoop* loop) {
+    if (!uring_enable(&loop->ring)) {
+        perror("cannot enable the io_uring");
+        return;
+    }
+
+    for (;;) {
+        // everything queued since the last round goes in with the same call that waits for completions
+        int result = submit(loop, true);
+        if (result < 0 && result != -EINTR && result != -ETIME && result != -EBUSY) {
+            errno = -result;
+            perror("io_uring_enter has failed");
+            return;
+        }
+
+        struct io_uring_cqe* cqe;
+        while ((cqe = uring_peek(&loop->ring)) != nullptr) {
+            // copied out first, handling it may queue new entries
+            uint64_t data = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            uring_consume(&loop->ring);
+            handle_completion(loop, data, res, flags);
+        }
+
+        run_inbox(loop);
+        expire_connections(loop);
+        run_ready_connections(loop);
+    }
+}
+
+void handle_completion(EventLoop* loop, uint64_t data, int result, unsigned flags) {
+    Connection* conn = (Connection*) (uintptr_t) (data & ~URING_OP_MASK);
+    switch ((UringOp) (data & URING_OP_MASK)) {
+        case URING_ACCEPT_HTTP:
+            on_accepted(loop, &loop->http, result, flags);
+            break;
+        case URING_ACCEPT_BINARY:
+            on_accepted(loop, &loop->binary, result, flags);
+            break;
+        case URING_WAKE:
+            // the inbox is run after every batch of completions anyway
+            arm_wake(loop);
+            break;
+        case URING_RECV:
+            on_received(loop, conn, result, flags);
+            break;
+        case URING_SEND:
+            on_sent(loop, conn, result);
+            break;
+        case URING_CLOSE:
+            if (result == -ECANCELED) {
+                // the send linked in front of it failed, so the close never ran
+                close(conn->fd);
+                metrics_add(&metrics_local()->syscalls, 1);
+            } else if (result < 0) {
+                errno = -result;
+                perror("close has failed");
+            }
+            conn->fd = -1;
+            finish_operation(conn);
+            break;
+        case URING_CANCEL:
+            finish_operation(conn);
+            break;
+    }
+}
+
+void on_accepted(EventLoop* loop, Listener* listener, int result, unsigned flags) {
+    if (result >= 0) {
+        Connection* conn = connection_create(result, loop, listener->protocol);
+        list_append(&loop->idle, conn);
+        arm_recv(loop, conn);
+    } else if (result != -ECONNABORTED) {
+        errno = -result;
+        perror("accept has failed");
+    }
+
+    if (!(flags & IORING_CQE_F_MORE)) {
+        listener->armed = false;
+        // out of descriptors it would fail again right away, the next sweep tries again
+        if (result != -EMFILE && result != -ENFILE)
+            arm_accept(loop, listener);
+    }
+}
+
+void on_received(EventLoop* loop, Connection* conn, int result, unsigned flags) {
+    conn->receiving = false;
+    if (flags & IORING_CQE_F_BUFFER) {
+        unsigned short id = (unsigned short) (flags >> IORING_CQE_BUFFER_SHIFT);
+        // never more than the room the recv was armed with, only this thread takes input out in between
+        if (result > 0 && !conn->closing) {
+            memcpy(conn->in + conn->inLength, uring_buffer(&loop->buffers, id), (size_t) result);
+            conn->inLength += (size_t) result;
+            metrics_add(&metrics_local()->bytesReceived, (uint64_t) result);
+        }
+        uring_provide_buffer(&loop->buffers, id);
+    }
+    if (conn->closing) {
+        finish_operation(conn);
+        return;
+    }
+    conn->pendingOps--;
+
+    if (result == -ENOBUFS) {
+        // the same batch took every buffer, they are all back before this recv is submitted again
+        arm_recv(loop, conn);
+        return;
+    }
+    if (result < 0) {
+        errno = -result;
+        perror("receive has failed");
+        close_connection(conn);
+        return;
+    }
+    if (result == 0) {
+        // answer whatever the client already sent, then hang up
+        conn->peerClosed = true;
+    }
+    serve_connection(loop, conn);
+}
+
+void on_sent(EventLoop* loop, Connection* conn, int result) {
+    conn->sending = false;
+    // whatever a failed send left is released with the connection
+    if (result > 0)
+        connection_sent(conn, (size_t) result);
+    if (conn->closing) {
+        if (!conn->closeQueued)
+            queue_close(loop, conn);
+        finish_operation(conn);
+        return;
+    }
+    conn->pendingOps--;
+
+    if (result < 0) {
+        errno = -result;
+        perror("send has failed");
+        close_connection(conn);
+        return;
+    }
+    serve_connection(loop, conn);
+}
+
+void finish_operation(Connection* conn) {
+    if (--conn->pendingOps == 0 && conn->closing)
+        connection_destroy(conn);
+}
+
+void serve_connection(EventLoop* loop, Connection* conn) {
+    // input arrived, a send completed or a woken answer was queued: run what can run and send what it produced
+    time_t last_activity = conn->lastActivity;
+    connection_process(conn);
+    if (!conn->sending) {
+        if (conn->outSegmentIndex < conn->outSegmentCount) {
+            queue_send(loop, conn);
+            if (conn->closing)
+                return;
+        } else if (conn->closeAfterWrite || conn->peerClosed) {
+            close_connection(conn);
+            return;
+        }
+    }
+    arm_recv(loop, conn);
+    after_connection_callback(loop, conn, CONNECTION_OPEN, last_activity);
+}
+
+void after_connection_callback(EventLoop* loop, Connection* conn, ConnectionStatus status, time_t last_activity) {
+    if (status == CONNECTION_CLOSED) {
+        close_connection(conn);
+        return;
+    }
+
+    if (conn->parked) {
+        if (conn->list != &loop->parked) {
+            list_remove(conn);
+            list_append(&loop->parked, conn);
+        }
+        return;
+    }
+
+    if (conn->list != &loop->idle || conn->lastActivity != last_activity) {
+        // served a request, move to the back of the idle list
+        list_remove(conn);
+        list_append(&loop->idle, conn);
+    }
+}
+
+void event_loop_wake(EventLoop* loop, Connection* conn) {
+    mtx_lock(&loop->inboxLock);
+    bool was_empty = loop->inboxHead == nullptr;
+    if (!conn->wakeQueued) {
+        conn->wakeQueued = true;
+        conn->wakeNext = nullptr;
+        if (loop->inboxTail != nullptr)
+            loop->inboxTail->wakeNext = conn;
+        else
+            loop->inboxHead = conn;
+        loop->inboxTail = conn;
+    }
+    mtx_unlock(&loop->inboxLock);
+    signal_inbox(loop, was_empty);
+}
+
+void event_loop_wake_all(EventLoop* loop, Connection* head, Connection* tail) {
+    mtx_lock(&loop->inboxLock);
+    bool was_empty = loop->inboxHead == nullptr;
+    for (Connection* c = head; c != nullptr; c = c->wakeNext)
+        c->wakeQueued = true;
+    if (loop->inboxTail != nullptr)
+        loop->inboxTail->wakeNext = head;
+    else
+        loop->inboxHead = head;
+    loop->inboxTail = tail;
+    mtx_unlock(&loop->inboxLock);
+    signal_inbox(loop, was_empty);
+}
+
+void signal_inbox(EventLoop* loop, bool wasEmpty) {
+    // a non-empty inbox already has a wakeup on the way
+    if (wasEmpty && loop != currentLoop) {
+        uint64_t one = 1;
+        metrics_add(&metrics_local()->syscalls, 1);
+        if (write(loop->wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+            perror("eventfd write has failed");
+    }
+}
+
+void event_loop_cancel_wake(EventLoop* loop, Connection* conn) {
+    mtx_lock(&loop->inboxLock);
+    if (conn->wakeQueued) {
+        Connection* prev = nullptr;
+        for (Connection* c = loop->inboxHead; c != conn; c = c->wakeNext)
+            prev = c;
+        if (prev != nullptr)
+            prev->wakeNext = conn->wakeNext;
+        else
+            loop->inboxHead = conn->wakeNext;
+        if (loop->inboxTail == conn)
+            loop->inboxTail = prev;
+        conn->wakeQueued = false;
+        conn->wakeNext = nullptr;
+    }
+    mtx_unlock(&loop->inboxLock);
+}
+
+void mark_ready(EventLoop* loop, Connection* conn) {
+    if (conn->list == &loop->ready)
+        return;
+
+    list_remove(conn);
+    list_append(&loop->ready, conn);
+}
+
+void run_inbox(EventLoop* loop) {
+    mtx_lock(&loop->inboxLock);
+    Connection* conn = loop->inboxHead;
+    loop->inboxHead = nullptr;
+    loop->inboxTail = nullptr;
+    for (Connection* c = conn; c != nullptr; c = c->wakeNext)
+        c->wakeQueued = false;
+    mtx_unlock(&loop->inboxLock);
+
+    // only this thread closes its connections, so the detached chain stays valid
+    while (conn != nullptr) {
+        Connection* next = conn->wakeNext;
+        conn->wakeNext = nullptr;
+        connection_resume(conn);
+        mark_ready(loop, conn);
+        conn = next;
+    }
+}
+
+void list_append(ConnectionList* list, Connection* conn) {
+    conn->list = list;
+    conn->listPrev = list->tail;
+    conn->listNext = nullptr;
+    if (list->tail != nullptr)
+        list->tail->listNext = conn;
+    else
+        list->head = conn;
+    list->tail = conn;
+}
+
+void list_remove(Connection* conn) {
+    ConnectionList* list = conn->list;
+    if (list == nullptr)
+        return;
+
+    if (conn->listPrev != nullptr)
+        conn->listPrev->listNext = conn->listNext;
+    else
+        list->head = conn->listNext;
+    if (conn->listNext != nullptr)
+        conn->listNext->listPrev = conn->listPrev;
+    else
+        list->tail = conn->listPrev;
+    conn->list = nullptr;
+    conn->listPrev = nullptr;
+    conn->listNext = nullptr;
+}
+
+void close_connection(Connection* conn) {
+    list_remove(conn);
+    EventLoop* loop = conn->loop;
+    if (loop->backend == IO_BACKEND_EPOLL) {
+        // closing the descriptor also drops it from the epoll set
+        connection_destroy(conn);
+        return;
+    }
+
+    // the ring may still be reading or sending, the memory stays until every operation on it has completed
+    if (conn->closing)
+        return;
+    conn->closing = true;
+    connection_detach(conn);
+    reserve(loop, 2);
+    if (conn->receiving) {
+        struct io_uring_sqe* sqe = uring_get_sqe(&loop->ring);
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = user_data(conn, URING_RECV);
+        sqe->user_data = user_data(conn, URING_CANCEL);
+        conn->pendingOps++;
+    }
+    // a send in flight queues the close when it completes
+    if (!conn->sending && !conn->closeQueued)
+        queue_close(loop, conn);
+}
+
+void run_ready_connections(EventLoop* loop) {
+    // a woken connection has its response queued, flush it and carry on with pipelined requests
+    while (loop->ready.head != nullptr) {
+        Connection* conn = loop->ready.head;
+        time_t last_activity = conn->lastActivity;
+        list_remove(conn);
+
+        if (loop->backend == IO_BACKEND_URING) {
+            serve_connection(loop, conn);
+            continue;
+        }
+        ConnectionStatus status = connection_on_readable(conn);
+        after_connection_callback(loop, conn, status, last_activity);
+    }
+}
+
+void expire_connections(EventLoop* loop) {
+    time_t now = time(NULL);
+    if (now == loop->lastSweep)
+        return;
+    loop->lastSweep = now;
+
+    // both lists are ordered by age, so stop at the first connection that is still fresh
+    while (loop->parked.head != nullptr && now - loop->parked.head->parkedAt >= LONG_POLL_TIMEOUT) {
+        Connection* conn = loop->parked.head;
+        // lost the race with a wake from another thread, its answer is already in the inbox
+        if (connection_expire_long_poll(conn))
+            mark_ready(loop, conn);
+        else
+            run_inbox(loop);
+    }
+
+    while (loop->idle.head != nullptr && now - loop->idle.head->lastActivity >= CONNECTION_IDLE_TIMEOUT) {
+        close_connection(loop->idle.head);
+    }
+
+    if (loop->backend == IO_BACKEND_URING) {
+        // an accept that ran out of descriptors stopped, some may have been closed since
+        if (!loop->http.armed)
+            arm_accept(loop, &loop->http);
+        if (!loop->binary.armed)
+            arm_accept(loop, &loop->binary);
+    }
+
+    expire_game_timers();
+}
+
+void event_loop_run(EventLoop* loop) {
+    currentLoop = loop;
+    if (loop->backend == IO_BACKEND_URING)
+        uring_run(loop);
+    else
+        epoll_run(loop);
+}
+
+void epoll_run(EventLoop* loop) {
+    struct epoll_event events[MAX_EVENTS];
+
+    for (;;) {
+        int n = epoll_wait(loop->epollFd, events, MAX_EVENTS, SWEEP_INTERVAL_MS);
+        metrics_add(&metrics_local()->syscalls, 1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait has failed");
+            return;
+        }
+
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.ptr == &loop->http || events[i].data.ptr == &loop->binary) {
+                accept_connections(loop, events[i].data.ptr);
+                continue;
+            }
+            if (events[i].data.ptr == loop) {
+                uint64_t count;
+                do {
+                    metrics_add(&metrics_local()->syscalls, 1);
+                } while (read(loop->wakeFd, &count, sizeof(count)) > 0);
+                continue;
+            }
+            handle_connection_event(loop, events[i].data.ptr, events[i].events);
+        }
+
+        run_inbox(loop);
+        expire_connections(loop);
+        run_ready_connections(loop);
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef SERVER_EVENT_LOOP_H
+#define SERVER_EVENT_LOOP_H
+
+#include "connection.h"
+
+typedef struct EventLoop EventLoop;
+
+typedef enum {
+    // readiness through epoll, then accept, recv and sendmsg called directly
+    IO_BACKEND_EPOLL,
+    // accepts, receives, sends and closes queued on an io_uring, one io_uring_enter per loop iteration
+    IO_BACKEND_URING
+} IoBackend;
+
+// whether this kernel lets the process use the backend, epoll always works
+bool event_loop_backend_available(IoBackend backend);
+
+// every loop accepts HTTP/JSON clients on one socket and binary protocol clients on the other
+EventLoop* event_loop_create(int httpFd, int binaryFd, IoBackend backend);
+
+void event_loop_run(EventLoop* loop);
+
+// hand a parked connection whose answer is in wakeBody, or wakeShared for spectators, back to its loop, callable from any thread
+void event_loop_wake(EventLoop* loop, Connection* conn);
+
+// same for a chain of connections linked through wakeNext, none of them queued yet, under one inbox lock
+void event_loop_wake_all(EventLoop* loop, Connection* head, Connection* tail);
+
+// owning thread only, forget a wake that has not been delivered yet
+void event_loop_cancel_wake(EventLoop* loop, Connection* conn);
+
+#endif //SERVER_EVENT_LOOP_H
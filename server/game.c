@@ -7,283 +7,499 @@
 #include <string.h>
 #include <time.h>
 #include <threads.h>
+#include <stdatomic.h>
+#include <stdalign.h>
+#include <stddef.h>
 #include "game.h"
 #include "chess_rules.h"
 #include "common.h"
+#include "game_table.h"
+#include "slab.h"
+#include "journal.h"
+#include "archive.h"
+#include "shared_buffer.h"
+#include "metrics.h"
+#include "matchmaking.h"
+
+#define INITIAL_GAME_CAPACITY 1024
+// games are spread over the shards by the top bits of their id hash
+#define GAME_SHARD_BITS 6
+#define GAME_SHARDS (1 << GAME_SHARD_BITS)
+#define TIMER_CHECK_INTERVAL 1
+#define INITIAL_MOVE_CAPACITY 64
+// games carved out of one slab block, a block is about 24 KiB
+#define GAMES_PER_SLAB 64
+
+typedef struct {
+    alignas(64) mtx_t lock;
+    GameTable games;
+    // storage for the games of this shard, only touched under its lock
+    Slab pool;
+    // heartbeat and cleanup deadlines of the games in this shard
+    TimerWheel timers;
+    // last generation handed to a game of this shard
+    uint64_t generations;
+    // changes not yet collected by the journal writer
+    ByteBuffer journal;
+    // records of freed games not yet collected by the archive writer
+    ByteBuffer archive;
+} GameShard;
+
+static GameShard shards[GAME_SHARDS];
+static atomic_llong lastTimerCheck = 0;
+static GameChangedListener gameChangedListener = nullptr;
+// off until recovery is done, so replaying the journal does not log it again
+static bool journaling = false;
+// on once archive_open has started its writer
+static bool archiving = false;
+
+static GameStatus* init_game(const char* gameId);
+
+static GameShard* find_shard(const char* gameId);
+
+static Player* add_player(GameStatus* gameStatus, int color);
+
+static void count_player(Player* player);
+
+static void update_game_timer(GameStatus* gameStatus);
+
+static void expire_game(Timer* timer, void* arg);
+
+static bool is_threefold_repetition(const GameStatus* gameStatus);
+
+static void log_change(GameStatus* gameStatus, int type, const char* playerId, Move move, int disconnected);
+
+static void drain_journal(GameShard* shard, ByteBuffer* batch);
+
+static void snapshot_game(GameStatus* gameStatus, void* arg);
+
+
+GameStatus* init_game(const char* gameId) {
+    GameShard* shard = find_shard(gameId);
+    GameStatus* gameStatus = slab_alloc(&shard->pool);
+    if (gameStatus == nullptr)
+        return nullptr;
 
-#define MAX_GAMES 100
+    strcpy(gameStatus->gameId, gameId);
+    gameStatus->lock = &shard->lock;
+    gameStatus->players[0] = NULL;
+    gameStatus->players[1] = NULL;
+    gameStatus->winner = -1;
+    gameStatus->version = 0;
+    gameStatus->moves = nullptr;
+    gameStatus->moveCount = 0;
+    gameStatus->moveCapacity = 0;
+    gameStatus->waiters = nullptr;
+    gameStatus->spectators = nullptr;
+    for (int i = 0; i < 2; i++) {
+        gameStatus->cachedState[i] = (ByteBuffer) {nullptr, 0, 0};
+        gameStatus->spectatorFrames[i] = nullptr;
+    }
+    gameStatus->cacheVersion = 0;
+    gameStatus->computerThinking = false;
+    gameStatus->generation = ++shard->generations;
+    gameStatus->matchBucket = -1;
+    gameStatus->matchQueued = false;
+    timer_init(&gameStatus->timer);
+    gameStatus->abandonedAt = 0;
+    position_init(&gameStatus->position);
+    gameStatus->startHash = gameStatus->position.hash;
+    add_player(gameStatus, WHITE);
+    log_change(gameStatus, JOURNAL_CREATE, gameStatus->players[0]->playerId, NO_MOVE, 0);
+
+    game_table_insert(&shard->games, gameStatus);
+    metrics_add(&metrics_local()->gamesCreated, 1);
+    update_game_timer(gameStatus);
+
+    return gameStatus;
+}
+
+GameStatus* create_or_join_game(const char* gameId) {
+    if (strlen(gameId) > MAX_GAME_ID_LENGTH)
+        return nullptr;
 
-static GameStatus* games[MAX_GAMES];
+    GameStatus* gameStatus = find_game(gameId);
 
-static GameStatus* init_game(char* gameId, Player* firstPlayer);
+    // game exists, add a player
+    if (gameStatus != NULL && gameStatus->players[1] == NULL) {
+        assert(gameStatus->players[0]->color == WHITE);
+        add_player(gameStatus, BLACK);
+        leave_match_queue(gameStatus);
+        log_change(gameStatus, JOURNAL_JOIN, gameStatus->players[1]->playerId, NO_MOVE, 0);
+        update_game_timer(gameStatus);
+        mark_game_changed(gameStatus);
+        return gameStatus;
+    }
 
-static bool check_pawn(int fromX, int fromY, int toX, int toY, int color, int board[8][8]);
+    // game exists, but is full
+    if (gameStatus != NULL) {
+        return nullptr;
+    }
 
-static bool check_knight(int fromX, int fromY, int toX, int toY, int color, int board[8][8]);
+    //game does not exist, create a new one
+    return init_game(gameId);
+}
 
-static bool check_bishop(int fromX, int fromY, int toX, int toY, int color, int board[8][8]);
+GameStatus* create_game(const char* gameId) {
+    if (strlen(gameId) > MAX_GAME_ID_LENGTH || find_game(gameId) != nullptr)
+        return nullptr;
+    return init_game(gameId);
+}
 
-static bool check_rook(int fromX, int fromY, int toX, int toY, int color, int board[8][8]);
+GameStatus* create_computer_game(const char* gameId) {
+    GameStatus* gameStatus = create_game(gameId);
+    if (gameStatus == nullptr)
+        return nullptr;
+    // logged as an ordinary join, recovery restores the seat by its id
+    Player* computer = add_player(gameStatus, BLACK);
+    set_player_id(computer, COMPUTER_PLAYER_ID);
+    log_change(gameStatus, JOURNAL_JOIN, computer->playerId, NO_MOVE, 0);
+    update_game_timer(gameStatus);
+    mark_game_changed(gameStatus);
+    return gameStatus;
+}
 
-static bool check_queen(int fromX, int fromY, int toX, int toY, int color, int board[8][8]);
+Player* add_player(GameStatus* gameStatus, int color) {
+    Player* p = &gameStatus->seats[color == WHITE ? 0 : 1];
+    Player* other = gameStatus->players[color == WHITE ? 1 : 0];
+    // players are told apart by id alone, so the two in a game must not share one
+    do {
+        bzero(p->playerId, 6);
+        sprintf(p->playerId, "%d", rand() % 1024);
+    } while (other != NULL && strcmp(other->playerId, p->playerId) == 0);
+    p->color = color;
+    p->disconnected = false;
+    p->lastHeartbeat = time(NULL);
+    p->pendingPolls = 0;
+    p->counted = false;
+    gameStatus->players[color == WHITE ? 0 : 1] = p;
+    count_player(p);
+    return p;
+}
 
-static bool check_king(int fromX, int fromY, int toX, int toY, int color, int board[8][8]);
+void set_player_id(Player* player, const char* playerId) {
+    strcpy(player->playerId, playerId);
+    count_player(player);
+}
 
-static bool is_occupied_by_friendly(int fromX, int fromY, int toX, int toY, int color, int board[8][8]);
+void count_player(Player* player) {
+    // called after every change that can move a seat in or out of the gauge
+    bool active = !player->disconnected && !is_computer(player);
+    if (active == player->counted)
+        return;
+    player->counted = active;
+    metrics_add(active ? &metrics_local()->playersJoined : &metrics_local()->playersLeft, 1);
+}
 
-GameStatus* init_game(char* gameId, Player* firstPlayer) {
-    int gameIndex = rand() % MAX_GAMES;
-    int i = gameIndex;
-    while (games[++i % MAX_GAMES] != NULL) {
-        if (i == gameIndex) {
-            printf("No free game slots\n");
-            exit(1);
-        }
+void init_games() {
+    bitboard_init();
+    for (int i = 0; i < GAME_SHARDS; i++) {
+        mtx_init(&shards[i].lock, mtx_plain);
+        game_table_init(&shards[i].games, INITIAL_GAME_CAPACITY / GAME_SHARDS);
+        slab_init(&shards[i].pool, sizeof(GameStatus), GAMES_PER_SLAB);
+        timer_wheel_init(&shards[i].timers, time(NULL));
+        shards[i].journal = (ByteBuffer) {nullptr, 0, 0};
+        shards[i].archive = (ByteBuffer) {nullptr, 0, 0};
+        shards[i].generations = 0;
     }
+}
 
-    GameStatus* gameStatus = malloc(sizeof(GameStatus));
-    gameStatus->gameId = gameId;
-    gameStatus->players[0] = firstPlayer;
-    gameStatus->players[1] = NULL;
-    gameStatus->currentTurn = WHITE;
-    gameStatus->winner = -1;
-    init_board(gameStatus->board);
+GameShard* find_shard(const char* gameId) {
+    // the table itself probes with the low bits, so pick the shard with the high ones
+    return &shards[hash_game_id(gameId) >> (64 - GAME_SHARD_BITS)];
+}
 
-    games[i % MAX_GAMES] = gameStatus;
+mtx_t* game_lock(const char* gameId) {
+    return &find_shard(gameId)->lock;
+}
 
-    return games[i % MAX_GAMES];
+GameStatus* find_game(const char* gameId) {
+    return game_table_find(&find_shard(gameId)->games, gameId);
 }
 
-bool check_pawn(int fromX, int fromY, int toX, int toY, int color, int board[8][8]) {
-    if (color == BLACK) {
-        if (fromY == 1 && toY == 3 && fromX == toX && board[2][fromX] == EMPTY && board[3][fromX] == EMPTY)
-            return true;
-        if (toY == fromY + 1 && fromX == toX && board[toY][toX] == EMPTY)
-            return true;
-        if (toY == fromY + 1 && (toX == fromX + 1 || toX == fromX - 1) && get_color(board[toY][toX]) == WHITE)
-            return true;
-    } else {
-        if (fromY == 6 && toY == 4 && fromX == toX && board[5][fromX] == EMPTY && board[4][fromX] == EMPTY)
-            return true;
-        if (toY == fromY - 1 && fromX == toX && board[toY][toX] == EMPTY)
-            return true;
-        if (toY == fromY - 1 && (toX == fromX + 1 || toX == fromX - 1) && get_color(board[toY][toX]) == BLACK)
-            return true;
+Player* find_player(GameStatus* gameStatus, const char* playerId) {
+    for (int i = 0; i < 2; i++) {
+        Player* p = gameStatus->players[i];
+        if (p != NULL && !is_computer(p) && strcmp(p->playerId, playerId) == 0)
+            return p;
     }
-
-    return false;
+    return nullptr;
 }
 
-bool check_knight(int fromX, int fromY, int toX, int toY, int color, int board[8][8]) {
-    if (toX == fromX + 1 && toY == fromY + 2)
-        return true;
-    if (toX == fromX + 2 && toY == fromY + 1)
-        return true;
-    if (toX == fromX + 2 && toY == fromY - 1)
-        return true;
-    if (toX == fromX + 1 && toY == fromY - 2)
-        return true;
-    if (toX == fromX - 1 && toY == fromY - 2)
-        return true;
-    if (toX == fromX - 2 && toY == fromY - 1)
-        return true;
-    if (toX == fromX - 2 && toY == fromY + 1)
-        return true;
-    if (toX == fromX - 1 && toY == fromY + 2)
-        return true;
-
-    return false;
+bool is_move_valid(GameStatus* gameStatus, int fromX, int fromY, int toX, int toY) {
+    return find_move(gameStatus, fromX, fromY, toX, toY, QUEEN) != NO_MOVE;
 }
 
-bool check_bishop(int fromX, int fromY, int toX, int toY, int color, int board[8][8]) {
-    if (abs(toX - fromX) != abs(toY - fromY))
-        return false;
+Move find_move(GameStatus* gameStatus, int fromX, int fromY, int toX, int toY, int promotion) {
+    if (fromX < 0 || fromX > 7 || fromY < 0 || fromY > 7 || toX < 0 || toX > 7 || toY < 0 || toY > 7)
+        return NO_MOVE;
 
-    int dx = (toX - fromX) / abs(toX - fromX);
-    int dy = (toY - fromY) / abs(toY - fromY);
+    return find_legal_move(&gameStatus->position, SQUARE(fromX, fromY), SQUARE(toX, toY), promotion);
+}
 
-    int x = fromX + dx;
-    int y = fromY + dy;
-    while (x != toX && y != toY) {
-        if (board[y][x] != EMPTY)
-            return false;
+void apply_move(GameStatus* gameStatus, Move move) {
+    Position* pos = &gameStatus->position;
+    UndoInfo undo;
+    make_move(pos, move, &undo);
+    log_change(gameStatus, JOURNAL_MOVE, "", move, 0);
 
-        x += dx;
-        y += dy;
+    if (gameStatus->moveCount == gameStatus->moveCapacity) {
+        gameStatus->moveCapacity = gameStatus->moveCapacity == 0 ? INITIAL_MOVE_CAPACITY : gameStatus->moveCapacity * 2;
+        gameStatus->moves = realloc(gameStatus->moves, sizeof(MoveRecord) * gameStatus->moveCapacity);
     }
-
-    return true;
+    gameStatus->moves[gameStatus->moveCount++] = (MoveRecord) {pos->hash, gameStatus->version, move};
+
+    // the side to move has no way out: checkmate if it is in check, stalemate otherwise
+    MoveList replies;
+    generate_legal_moves(pos, &replies);
+    if (replies.count == 0)
+        gameStatus->winner = is_in_check(pos) ? !pos->sideToMove : DRAW;
+    else if (pos->halfmoveClock >= FIFTY_MOVE_PLIES || is_threefold_repetition(gameStatus))
+        gameStatus->winner = DRAW;
 }
 
-bool check_rook(int fromX, int fromY, int toX, int toY, int color, int board[8][8]) {
-    if (fromX != toX && fromY != toY)
-        return false;
-
-    if (fromX == toX) {
-        int dy = (toY - fromY) / abs(toY - fromY);
-        int y = fromY + dy;
-        while (y != toY) {
-            if (board[y][fromX] != EMPTY)
-                return false;
+bool is_threefold_repetition(const GameStatus* gameStatus) {
+    // captures and pawn moves cannot be undone, so only the plies since the last one can repeat,
+    // and only every other one has the same side to move
+    const Position* pos = &gameStatus->position;
+    int seen = 1;
+    for (int back = 2; back <= pos->halfmoveClock; back += 2) {
+        int ply = gameStatus->moveCount - back;
+        uint64_t hash = ply == 0 ? gameStatus->startHash : gameStatus->moves[ply - 1].hash;
+        if (hash == pos->hash && ++seen == 3)
+            return true;
+    }
+    return false;
+}
 
-            y += dy;
-        }
-    } else {
-        int dx = (toX - fromX) / abs(toX - fromX);
-        int x = fromX + dx;
-        while (x != toX) {
-            if (board[fromY][x] != EMPTY)
-                return false;
+int first_move_since(const GameStatus* gameStatus, unsigned int version) {
+    // clients are rarely more than a move or two behind, so search from the end
+    int i = gameStatus->moveCount;
+    while (i > 0 && gameStatus->moves[i - 1].version >= version)
+        i--;
+    return i;
+}
 
-            x += dx;
+void write_board(JsonWriter* writer, const Position* position) {
+    // 64 piece codes of at most two digits, rows in wire order
+    char board[8 * (8 * 3 + 2) + 2];
+    size_t length = 0;
+    board[length++] = '[';
+    for (int i = 0; i < 8; i++) {
+        board[length++] = '[';
+        for (int j = 0; j < 8; j++) {
+            int piece = piece_at(position, SQUARE(j, i));
+            if (piece >= 10)
+                board[length++] = '1';
+            board[length++] = (char) ('0' + piece % 10);
+            board[length++] = ',';
         }
+        board[length - 1] = ']';
+        board[length++] = ',';
     }
+    board[length - 1] = ']';
+    json_add_raw(writer, "board", board, length);
+    write_position_hash(writer, position);
+}
 
-    return true;
+void write_position_hash(JsonWriter* writer, const Position* position) {
+    // the Zobrist key doubles as an ETag of the board, clients skip redrawing when it did not change
+    static const char hex[] = "0123456789abcdef";
+    char hash[17];
+    for (int i = 0; i < 16; i++)
+        hash[i] = hex[position->hash >> (60 - 4 * i) & 15];
+    hash[16] = '\0';
+    json_add_string(writer, "positionHash", hash);
 }
 
-bool check_queen(int fromX, int fromY, int toX, int toY, int color, int board[8][8]) {
-    return check_bishop(fromX, fromY, toX, toY, color, board) || check_rook(fromX, fromY, toX, toY, color, board);
+void free_game(GameStatus* gameStatus) {
+    GameShard* shard = find_shard(gameStatus->gameId);
+    leave_match_queue(gameStatus);
+    log_change(gameStatus, JOURNAL_FREE, "", NO_MOVE, 0);
+    timer_cancel(&gameStatus->timer);
+    game_table_remove(&shard->games, gameStatus);
+    metrics_add(&metrics_local()->gamesFreed, 1);
+    // the seats go with the game, players still connected leave the gauge with it
+    for (int i = 0; i < 2; i++) {
+        if (gameStatus->players[i] != nullptr && gameStatus->players[i]->counted)
+            metrics_add(&metrics_local()->playersLeft, 1);
+    }
+    if (archiving && gameStatus->moveCount > 0)
+        archive_append(&shard->archive, gameStatus);
+
+    free(gameStatus->moves);
+    for (int i = 0; i < 2; i++) {
+        byte_buffer_free(&gameStatus->cachedState[i]);
+        // connections still sending a frame hold references of their own
+        shared_buffer_release(gameStatus->spectatorFrames[i]);
+    }
+    slab_free(&shard->pool, gameStatus);
 }
 
-bool check_king(int fromX, int fromY, int toX, int toY, int color, int board[8][8]) {
-    if (abs(toX - fromX) > 1 || abs(toY - fromY) > 1)
-        return false;
+void touch_player(GameStatus* gameStatus, Player* player) {
+    time_t now = time(NULL);
+    if (player->lastHeartbeat == now)
+        return;
+    player->lastHeartbeat = now;
+    update_game_timer(gameStatus);
+}
 
-    return true;
+void disconnect_player(GameStatus* gameStatus, Player* player) {
+    player->disconnected = true;
+    count_player(player);
+    leave_match_queue(gameStatus);
+    log_change(gameStatus, JOURNAL_DISCONNECT, "", NO_MOVE, 1 << player->color);
+    update_game_timer(gameStatus);
 }
 
-bool is_occupied_by_friendly(int fromX, int fromY, int toX, int toY, int color, int board[8][8]) {
-    if (board[toY][toX] == EMPTY)
-        return false;
+void update_game_timer(GameStatus* gameStatus) {
+    time_t deadline = 0;
+    bool anyone_connected = false;
+    for (int i = 0; i < 2; i++) {
+        Player* p = gameStatus->players[i];
+        if (p == NULL || p->disconnected || is_computer(p))
+            continue;
+        anyone_connected = true;
+        // time() has second resolution, the extra second keeps a player from being dropped early
+        time_t player_deadline = p->lastHeartbeat + PLAYER_TIMEOUT + 1;
+        if (deadline == 0 || player_deadline < deadline)
+            deadline = player_deadline;
+    }
+
+    if (!anyone_connected) {
+        if (gameStatus->abandonedAt == 0)
+            gameStatus->abandonedAt = time(NULL);
+        deadline = gameStatus->abandonedAt + ABANDONED_GAME_TIMEOUT;
+    } else {
+        gameStatus->abandonedAt = 0;
+    }
 
-    return get_color(board[toY][toX]) == color;
+    timer_arm(&find_shard(gameStatus->gameId)->timers, &gameStatus->timer, deadline);
 }
 
+void expire_game_timers() {
+    // every worker calls this from its sweep, one pass per interval is enough for all of them
+    time_t now = time(NULL);
+    long long last = atomic_load(&lastTimerCheck);
+    if (now - last < TIMER_CHECK_INTERVAL || !atomic_compare_exchange_strong(&lastTimerCheck, &last, now))
+        return;
+
+    for (int i = 0; i < GAME_SHARDS; i++) {
+        mtx_lock(&shards[i].lock);
+        timer_wheel_advance(&shards[i].timers, now, expire_game, &now);
+        mtx_unlock(&shards[i].lock);
+    }
+}
 
-GameStatus* create_or_join_game(char* gameId) {
-    GameStatus* gameStatus = find_game(gameId);
+void expire_game(Timer* timer, void* arg) {
+    GameStatus* gameStatus = (GameStatus*) ((char*) timer - offsetof(GameStatus, timer));
+    time_t now = *(time_t*) arg;
+
+    if (gameStatus->abandonedAt != 0) {
+        // a parked request still holds a pointer to the game, give it time to be answered
+        if (gameStatus->waiters == nullptr && now - gameStatus->abandonedAt >= ABANDONED_GAME_TIMEOUT) {
+            printf("Freeing abandoned game %s\n", gameStatus->gameId);
+            // spectators would keep it alive forever, they get the final state and find no game on their next poll
+            if (gameStatus->spectators != nullptr)
+                mark_game_changed(gameStatus);
+            free_game(gameStatus);
+            return;
+        }
+        timer_arm(&find_shard(gameStatus->gameId)->timers, &gameStatus->timer, now + 1);
+        return;
+    }
 
-    // game exists, add a player
-    if (gameStatus != NULL && gameStatus->players[1] == NULL) {
-        Player* p = malloc(sizeof(Player));
-        assert(gameStatus->players[0]->color == WHITE);
-        bzero(p->playerId, 6);
-        sprintf(p->playerId, "%d", rand() % 1024);
-        p->color = BLACK;
-        p->disconnected = false;
-        p->lastHeartbeat = time(NULL);
-        gameStatus->players[1] = p;
-        return gameStatus;
+    int disconnected = 0;
+    for (int j = 0; j < 2; j++) {
+        Player* p = gameStatus->players[j];
+        if (p == NULL || p->disconnected || is_computer(p))
+            continue;
+        // a parked long poll proves the player is still there
+        if (p->pendingPolls > 0) {
+            p->lastHeartbeat = now;
+        } else if (now - p->lastHeartbeat > PLAYER_TIMEOUT) {
+            p->disconnected = true;
+            count_player(p);
+            disconnected |= 1 << p->color;
+        }
     }
 
-    // game exists, but is full
-    if (gameStatus != NULL) {
-        return nullptr;
+    update_game_timer(gameStatus);
+    if (disconnected != 0) {
+        leave_match_queue(gameStatus);
+        metrics_add(&metrics_local()->heartbeatExpiries, (uint64_t) __builtin_popcount(disconnected));
+        log_change(gameStatus, JOURNAL_DISCONNECT, "", NO_MOVE, disconnected);
+        mark_game_changed(gameStatus);
     }
+}
 
-    //game does not exist, create a new one
-    Player* p = malloc(sizeof(Player));
-    bzero(p->playerId, 6);
-    sprintf(p->playerId, "%d", rand() % 1024);
-    p->color = WHITE;
-    p->disconnected = false;
-    p->lastHeartbeat = time(NULL);
-    return init_game(gameId, p);
+Player* get_the_other_player(GameStatus* g, Player* currentPlayer) {
+    return g->players[0] == currentPlayer ? g->players[1] : g->players[0];
 }
 
-GameStatus* find_game(char* gameId) {
-    int gameIndex = -1;
-    for (int i = 0; i < MAX_GAMES; i++) {
-        if (games[i] != NULL && strcmp(games[i]->gameId, gameId) == 0) {
-            gameIndex = i;
-            break;
-        }
-    }
-    if (gameIndex == -1)
-        return nullptr;
+void set_game_changed_listener(GameChangedListener listener) {
+    gameChangedListener = listener;
+}
 
-    return games[gameIndex];
+void mark_game_changed(GameStatus* gameStatus) {
+    gameStatus->version++;
+    if (gameChangedListener != nullptr)
+        gameChangedListener(gameStatus);
 }
 
-Player* find_player(GameStatus* gameStatus, char* playerId) {
-    if (strcmp(gameStatus->players[0]->playerId, playerId) == 0)
-        return gameStatus->players[0];
-    if (strcmp(gameStatus->players[1]->playerId, playerId) == 0)
-        return gameStatus->players[1];
-    return nullptr;
+void log_change(GameStatus* gameStatus, int type, const char* playerId, Move move, int disconnected) {
+    if (!journaling)
+        return;
+
+    JournalRecord record = {.type = type, .move = move, .disconnected = disconnected};
+    strcpy(record.gameId, gameStatus->gameId);
+    strcpy(record.playerId, playerId);
+    journal_append(&find_shard(gameStatus->gameId)->journal, &record);
 }
 
-bool is_move_valid(GameStatus* gameStatus, int fromX, int fromY, int toX, int toY) {
-    int piece = gameStatus->board[fromY][fromX];
-    int color = get_color(piece);
-    if (color != gameStatus->currentTurn)
-        return false;
-
-    int pieceType = get_piece_type(piece);
-
-    if (is_occupied_by_friendly(fromX, fromY, toX, toY, color, gameStatus->board))
-        return false;
-
-    switch (pieceType) {
-        case PAWN:
-            return check_pawn(fromX, fromY, toX, toY, color, gameStatus->board);
-        case KNIGHT:
-            return check_knight(fromX, fromY, toX, toY, color, gameStatus->board);
-        case BISHOP:
-            return check_bishop(fromX, fromY, toX, toY, color, gameStatus->board);
-        case ROOK:
-            return check_rook(fromX, fromY, toX, toY, color, gameStatus->board);
-        case QUEEN:
-            return check_queen(fromX, fromY, toX, toY, color, gameStatus->board);
-        case KING:
-            return check_king(fromX, fromY, toX, toY, color, gameStatus->board);
-        default:
-            return false;
-    }
+void enable_game_journal() {
+    journaling = true;
 }
 
-void serialize_board(cJSON* root, int gameBoard[8][8]) {
-    cJSON* board = cJSON_CreateArray();
-    for (int i = 0; i < 8; i++) {
-        cJSON* row = cJSON_CreateArray();
-        for (int j = 0; j < 8; j++) {
-            cJSON_AddItemToArray(row, cJSON_CreateNumber(gameBoard[i][j]));
-        }
-        cJSON_AddItemToArray(board, row);
-    }
+void enable_game_archive() {
+    archiving = true;
+}
 
-    cJSON_AddItemToObject(root, "board", board);
+void collect_game_journal(ByteBuffer* batch) {
+    for (int i = 0; i < GAME_SHARDS; i++) {
+        mtx_lock(&shards[i].lock);
+        drain_journal(&shards[i], batch);
+        mtx_unlock(&shards[i].lock);
+    }
 }
 
-void free_game(GameStatus* gameStatus) {
-    for (int i = 0; i < MAX_GAMES; i++) {
-        if (games[i] == gameStatus) {
-            games[i] = NULL;
-            break;
+void collect_game_archive(ByteBuffer* batch) {
+    for (int i = 0; i < GAME_SHARDS; i++) {
+        mtx_lock(&shards[i].lock);
+        if (shards[i].archive.length > 0) {
+            byte_buffer_append(batch, shards[i].archive.data, shards[i].archive.length);
+            shards[i].archive.length = 0;
         }
+        mtx_unlock(&shards[i].lock);
     }
+}
 
-    free(gameStatus->players[0]);
-    free(gameStatus->players[1]);
-    free(gameStatus->gameId);
-    free(gameStatus);
-}
-
-void mark_disconnected_players() {
-    for (int i = 0; i < MAX_GAMES; i++) {
-        if (games[i] != NULL) {
-            for (int j = 0; j < 2; j++) {
-                if (games[i]->players[j] != NULL) {
-                    if (time(NULL) - games[i]->players[j]->lastHeartbeat > 5) {
-                        games[i]->players[j]->disconnected = true;
-                    }
-                }
-            }
-        }
+void checkpoint_games(ByteBuffer* batch, ByteBuffer* snapshot) {
+    for (int i = 0; i < GAME_SHARDS; i++) {
+        mtx_lock(&shards[i].lock);
+        drain_journal(&shards[i], batch);
+        game_table_for_each(&shards[i].games, snapshot_game, snapshot);
+        mtx_unlock(&shards[i].lock);
     }
 }
 
-Player* get_the_other_player(GameStatus* g, Player* currentPlayer) {
-    return g->players[0] == currentPlayer ? g->players[1] : g->players[0];
+void drain_journal(GameShard* shard, ByteBuffer* batch) {
+    if (shard->journal.length == 0)
+        return;
+    byte_buffer_append(batch, shard->journal.data, shard->journal.length);
+    shard->journal.length = 0;
+}
+
+void snapshot_game(GameStatus* gameStatus, void* arg) {
+    journal_snapshot_game(arg, gameStatus);
 }
@@ -5,34 +5,143 @@
 #ifndef SERVER_GAME_H
 #define SERVER_GAME_H
 
-#include <cjson/cJSON.h>
 #include <threads.h>
+#include <string.h>
+#include <stdalign.h>
+#include "bitboard.h"
+#include "movegen.h"
+#include "json_writer.h"
+#include "timer_wheel.h"
+
+struct Connection;
+struct SharedBuffer;
+
+// a game is drawn once this many plies pass without a capture or a pawn move
+#define FIFTY_MOVE_PLIES 100
+// a player not heard from for longer than this many seconds is considered gone
+#define PLAYER_TIMEOUT 5
+// seconds a game nobody is connected to is kept before it is freed
+#define ABANDONED_GAME_TIMEOUT 30
+// game ids are stored inline, longer ones are refused
+#define MAX_GAME_ID_LENGTH 15
+// id of the seat the computer plays from, never handed to a client since those ids are numbers
+#define COMPUTER_PLAYER_ID "cpu"
 
 typedef struct {
     char playerId[6];
     int color;
     bool disconnected;
     time_t lastHeartbeat;
+    // long-poll requests currently parked for this player, they count as heartbeats
+    int pendingPolls;
+    // counted in the active players gauge: joined, not disconnected and not the computer
+    bool counted;
 } Player;
 
+// the computer never polls, never times out and cannot be moved for by a client
+static inline bool is_computer(const Player* player) {
+    return strcmp(player->playerId, COMPUTER_PLAYER_ID) == 0;
+}
+
+// a move with the version the game was at when it was made and the hash of the position it led to
 typedef struct {
-    char* gameId;
+    uint64_t hash;
+    unsigned int version;
+    Move move;
+} MoveRecord;
+
+/*
+ * Everything about a game lives in this one record, handed out by the shard's
+ * slab: players and id are stored inline and the fields every request touches
+ * come first. Only the move list grows on the heap.
+ */
+typedef struct GameStatus {
+    // lock of the shard this game lives in, held while anything below is read or changed
+    alignas(64) mtx_t* lock;
+    // point into seats once the player has joined
     Player* players[2];
-    int currentTurn;
-    int board[8][8];
     int winner;
+    // bumped on every observable state change, clients long-poll against it
+    unsigned int version;
+    struct Connection* waiters;
+    // parked requests of read-only watchers, answered after the players'
+    struct Connection* spectators;
+    // side to move lives in position.sideToMove
+    Position position;
+    // every move of the game in order, clients that are behind get the tail instead of the board
+    MoveRecord* moves;
+    int moveCount;
+    int moveCapacity;
+    // hash of the position before the first move, repetitions can reach back to it
+    uint64_t startHash;
+    // fires at the earliest heartbeat deadline of the players, or when an abandoned game is to be freed
+    Timer timer;
+    // when the last connected player went away, 0 while anyone is still there
+    time_t abandonedAt;
+    // encoded once per version for each protocol and reused until the version moves on:
+    // the version, board and hash every full-state response ends with
+    ByteBuffer cachedState[2];
+    // and the whole frame spectators are sent, shared by all of them
+    struct SharedBuffer* spectatorFrames[2];
+    unsigned int cacheVersion;
+    // a search for the computer's move is queued or running, see computer.h
+    bool computerThinking;
+    // never the same for two games of a shard, so whoever kept only the id can tell a reused one apart
+    uint64_t generation;
+    // matchmaking bucket the game was opened in, -1 once it left the queue or for games joined by id
+    int matchBucket;
+    // links of that bucket's queue, guarded by the bucket's queue lock rather than the shard lock
+    bool matchQueued;
+    struct GameStatus* matchPrev;
+    struct GameStatus* matchNext;
+    char gameId[MAX_GAME_ID_LENGTH + 1];
+    Player seats[2];
 } GameStatus;
 
+typedef void (*GameChangedListener)(GameStatus* gameStatus);
+
+
+void init_games();
 
-GameStatus* create_or_join_game(char* gameId);
+GameStatus* create_or_join_game(const char* gameId);
 
-GameStatus* find_game(char* gameId);
+// a new game with only white seated, nullptr if the id is taken
+GameStatus* create_game(const char* gameId);
 
-Player* find_player(GameStatus* gameStatus, char* playerId);
+// a new game with the computer seated as black, nullptr if the id is taken
+GameStatus* create_computer_game(const char* gameId);
+
+GameStatus* find_game(const char* gameId);
+
+mtx_t* game_lock(const char* gameId);
+
+Player* find_player(GameStatus* gameStatus, const char* playerId);
 bool is_move_valid(GameStatus* gameStatus, int fromX, int fromY, int toX, int toY);
-void serialize_board(cJSON* root, int gameBoard[8][8]);
+Move find_move(GameStatus* gameStatus, int fromX, int fromY, int toX, int toY, int promotion);
+void apply_move(GameStatus* gameStatus, Move move);
+int first_move_since(const GameStatus* gameStatus, unsigned int version);
+void write_board(JsonWriter* writer, const Position* position);
+void write_position_hash(JsonWriter* writer, const Position* position);
 void free_game(GameStatus* gameStatus);
-void mark_disconnected_players();
+void touch_player(GameStatus* gameStatus, Player* player);
+void disconnect_player(GameStatus* gameStatus, Player* player);
+// gives a seated player an id that was not generated, the computer's or one restored from the journal
+void set_player_id(Player* player, const char* playerId);
+void expire_game_timers();
 Player* get_the_other_player(GameStatus* g, Player* currentPlayer);
+void set_game_changed_listener(GameChangedListener listener);
+void mark_game_changed(GameStatus* gameStatus);
+
+// used by the journal, see journal.h
+void enable_game_journal();
+// moves every change the shards logged into batch
+void collect_game_journal(ByteBuffer* batch);
+// same, and copies every game into snapshot while its shard is still locked
+void checkpoint_games(ByteBuffer* batch, ByteBuffer* snapshot);
+
+// used by the archive, see archive.h
+void enable_game_archive();
+// moves the records of every game freed since the last call into batch
+void collect_game_archive(ByteBuffer* batch);
 
 #endif //SERVER_GAME_H
@@ -0,0 +1,183 @@
+#include <stdlib.h>
+#include <string.h>
+#include "game_table.h"
+#include "common.h"
+
+#define MIN_CAPACITY 64
+// old slots moved to the new table by every operation while a resize is in progress
+#define MIGRATE_STEP 16
+
+// marks a deleted slot so probe sequences running through it stay intact
+static GameStatus tombstone;
+#define TOMBSTONE (&tombstone)
+
+static size_t probe_find(GameSlot* slots, size_t capacity, uint64_t hash, const char* gameId);
+
+static size_t probe_insert(GameSlot* slots, size_t capacity, uint64_t hash, size_t* used);
+
+static void start_resize(GameTable* table);
+
+static void migrate_step(GameTable* table, size_t steps);
+
+uint64_t hash_game_id(const char* gameId) {
+    // FNV-1a, game ids are a handful of bytes
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (const unsigned char* c = (const unsigned char*) gameId; *c != '\0'; c++) {
+        hash ^= *c;
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+void game_table_init(GameTable* table, size_t capacity) {
+    size_t real_capacity = MIN_CAPACITY;
+    while (real_capacity < capacity)
+        real_capacity <<= 1;
+
+    table->slots = calloc(real_capacity, sizeof(GameSlot));
+    table->capacity = real_capacity;
+    table->used = 0;
+    table->oldSlots = nullptr;
+    table->oldCapacity = 0;
+    table->migrateIndex = 0;
+    table->size = 0;
+}
+
+size_t probe_find(GameSlot* slots, size_t capacity, uint64_t hash, const char* gameId) {
+    size_t mask = capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        GameStatus* game = slots[i].game;
+        if (game == nullptr)
+            return capacity;
+        if (game != TOMBSTONE && slots[i].hash == hash && strcmp(game->gameId, gameId) == 0)
+            return i;
+    }
+}
+
+size_t probe_insert(GameSlot* slots, size_t capacity, uint64_t hash, size_t* used) {
+    size_t mask = capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        if (slots[i].game == nullptr) {
+            (*used)++;
+            return i;
+        }
+        if (slots[i].game == TOMBSTONE)
+            return i;
+    }
+}
+
+void start_resize(GameTable* table) {
+    // a table clogged with tombstones is rehashed at the same size instead of doubling
+    size_t capacity = table->size * 4 < table->capacity ? table->capacity : table->capacity * 2;
+
+    table->oldSlots = table->slots;
+    table->oldCapacity = table->capacity;
+    table->migrateIndex = 0;
+
+    table->slots = calloc(capacity, sizeof(GameSlot));
+    table->capacity = capacity;
+    table->used = 0;
+}
+
+void migrate_step(GameTable* table, size_t steps) {
+    if (table->oldSlots == nullptr)
+        return;
+
+    while (steps-- > 0 && table->migrateIndex < table->oldCapacity) {
+        GameSlot* slot = &table->oldSlots[table->migrateIndex++];
+        if (slot->game == nullptr || slot->game == TOMBSTONE)
+            continue;
+
+        size_t i = probe_insert(table->slots, table->capacity, slot->hash, &table->used);
+        table->slots[i] = *slot;
+        slot->game = TOMBSTONE;
+    }
+
+    if (table->migrateIndex == table->oldCapacity) {
+        free(table->oldSlots);
+        table->oldSlots = nullptr;
+        table->oldCapacity = 0;
+    }
+}
+
+GameStatus* game_table_find(GameTable* table, const char* gameId) {
+    migrate_step(table, MIGRATE_STEP);
+
+    uint64_t hash = hash_game_id(gameId);
+    size_t i = probe_find(table->slots, table->capacity, hash, gameId);
+    if (i != table->capacity)
+        return table->slots[i].game;
+
+    if (table->oldSlots != nullptr) {
+        i = probe_find(table->oldSlots, table->oldCapacity, hash, gameId);
+        if (i != table->oldCapacity)
+            return table->oldSlots[i].game;
+    }
+
+    return nullptr;
+}
+
+void game_table_insert(GameTable* table, GameStatus* game) {
+    migrate_step(table, MIGRATE_STEP);
+
+    // keep the load factor at or below one half
+    if ((table->used + 1) * 2 > table->capacity) {
+        // a resize outpaced by inserts is finished in one go before starting the next one
+        migrate_step(table, table->oldCapacity);
+        start_resize(table);
+        migrate_step(table, MIGRATE_STEP);
+    }
+
+    uint64_t hash = hash_game_id(game->gameId);
+    size_t i = probe_insert(table->slots, table->capacity, hash, &table->used);
+    table->slots[i].hash = hash;
+    table->slots[i].game = game;
+    table->size++;
+}
+
+bool game_table_remove(GameTable* table, GameStatus* game) {
+    migrate_step(table, MIGRATE_STEP);
+
+    uint64_t hash = hash_game_id(game->gameId);
+    size_t i = probe_find(table->slots, table->capacity, hash, game->gameId);
+    if (i != table->capacity) {
+        table->slots[i].game = TOMBSTONE;
+        table->size--;
+        return true;
+    }
+
+    if (table->oldSlots != nullptr) {
+        i = probe_find(table->oldSlots, table->oldCapacity, hash, game->gameId);
+        if (i != table->oldCapacity) {
+            table->oldSlots[i].game = TOMBSTONE;
+            table->size--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void game_table_for_each(GameTable* table, void (*callback)(GameStatus* game, void* arg), void* arg) {
+    for (size_t i = 0; i < table->capacity; i++) {
+        GameStatus* game = table->slots[i].game;
+        if (game != nullptr && game != TOMBSTONE)
+            callback(game, arg);
+    }
+
+    for (size_t i = table->migrateIndex; i < table->oldCapacity; i++) {
+        GameStatus* game = table->oldSlots[i].game;
+        if (game != nullptr && game != TOMBSTONE)
+            callback(game, arg);
+    }
+}
+
+void game_table_free(GameTable* table) {
+    free(table->slots);
+    free(table->oldSlots);
+    table->slots = nullptr;
+    table->oldSlots = nullptr;
+    table->capacity = 0;
+    table->oldCapacity = 0;
+    table->size = 0;
+}
@@ -0,0 +1,46 @@
+#ifndef SERVER_GAME_TABLE_H
+#define SERVER_GAME_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "game.h"
+
+typedef struct {
+    uint64_t hash;
+    GameStatus* game;
+} GameSlot;
+
+/*
+ * Open-addressing (linear probing) map from gameId to GameStatus.
+ * Growing allocates a table twice the size and moves a few slots per operation,
+ * so no single request pays for rehashing the whole registry.
+ */
+typedef struct {
+    GameSlot* slots;
+    size_t capacity;
+    // live entries plus tombstones, drives the resize
+    size_t used;
+
+    // previous table while a resize is in progress, drained from migrateIndex upwards
+    GameSlot* oldSlots;
+    size_t oldCapacity;
+    size_t migrateIndex;
+
+    size_t size;
+} GameTable;
+
+void game_table_init(GameTable* table, size_t capacity);
+
+GameStatus* game_table_find(GameTable* table, const char* gameId);
+
+void game_table_insert(GameTable* table, GameStatus* game);
+
+bool game_table_remove(GameTable* table, GameStatus* game);
+
+void game_table_for_each(GameTable* table, void (*callback)(GameStatus* game, void* arg), void* arg);
+
+void game_table_free(GameTable* table);
+
+uint64_t hash_game_id(const char* gameId);
+
+#endif //SERVER_GAME_TABLE_H
@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include "http.h"
+#include "common.h"
+
+static HttpParseResult reject(HttpParser* parser, int status);
+
+static int parse_request_line(HttpParser* parser, const char* line, size_t length);
+
+static int parse_header_line(HttpParser* parser, const char* line, size_t length, size_t limit);
+
+static bool is_token_char(char c);
+
+static bool equals_ignore_case(const char* value, size_t length, const char* expected);
+
+static const char* status_reason(int status);
+
+static size_t write_header(ByteBuffer* out, size_t bodyStart, size_t bodyLength, bool keepAlive, const char* start,
+                           size_t startLength);
+
+static const char HEADER_START[] =
+        "HTTP/1.1 200 OK\r\nAccess-Control-Allow-Origin: *\r\nContent-Type: application/json\r\nContent-Length: ";
+// what Prometheus expects from a scrape
+static const char TEXT_HEADER_START[] =
+        "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: ";
+static const char KEEP_ALIVE_END[] = "\r\nConnection: keep-alive\r\n\r\n";
+static const char CLOSE_END[] = "\r\nConnection: close\r\n\r\n";
+
+_Static_assert(sizeof(HEADER_START) - 1 + 20 + sizeof(KEEP_ALIVE_END) - 1 <= HTTP_HEADER_RESERVE,
+               "HTTP_HEADER_RESERVE too small for the response header");
+_Static_assert(sizeof(TEXT_HEADER_START) <= sizeof(HEADER_START), "text header longer than the JSON one");
+
+size_t http_response_begin(ByteBuffer* out) {
+    byte_buffer_reserve(out, HTTP_HEADER_RESERVE);
+    out->length += HTTP_HEADER_RESERVE;
+    return out->length;
+}
+
+size_t http_response_end(ByteBuffer* out, size_t bodyStart, bool keepAlive) {
+    return write_header(out, bodyStart, out->length - bodyStart, keepAlive, HEADER_START, sizeof(HEADER_START) - 1);
+}
+
+size_t http_text_response_end(ByteBuffer* out, size_t bodyStart, bool keepAlive) {
+    return write_header(out, bodyStart, out->length - bodyStart, keepAlive, TEXT_HEADER_START,
+                        sizeof(TEXT_HEADER_START) - 1);
+}
+
+size_t http_write_header(ByteBuffer* out, size_t bodyLength, bool keepAlive) {
+    // the header ends where the reserved gap ends, the body follows in a segment of its own
+    size_t end = http_response_begin(out);
+    return write_header(out, end, bodyLength, keepAlive, HEADER_START, sizeof(HEADER_START) - 1);
+}
+
+size_t write_header(ByteBuffer* out, size_t bodyStart, size_t bodyLength, bool keepAlive, const char* start,
+                    size_t startLength) {
+    size_t body_length = bodyLength;
+
+    char digits[20];
+    size_t digit_count = 0;
+    do {
+        digits[sizeof(digits) - ++digit_count] = (char) ('0' + body_length % 10);
+        body_length /= 10;
+    } while (body_length != 0);
+
+    const char* end = keepAlive ? KEEP_ALIVE_END : CLOSE_END;
+    size_t end_length = keepAlive ? sizeof(KEEP_ALIVE_END) - 1 : sizeof(CLOSE_END) - 1;
+    size_t header_length = startLength + digit_count + end_length;
+
+    char* header = out->data + bodyStart - header_length;
+    memcpy(header, start, startLength);
+    header += startLength;
+    memcpy(header, digits + sizeof(digits) - digit_count, digit_count);
+    header += digit_count;
+    memcpy(header, end, end_length);
+
+    return bodyStart - header_length;
+}
+
+void http_parser_reset(HttpParser* parser) {
+    *parser = (HttpParser) {.state = HTTP_PARSE_REQUEST_LINE};
+}
+
+HttpParseResult http_parse_request(HttpParser* parser, const char* data, size_t length, size_t limit) {
+    if (length > limit)
+        length = limit;
+
+    while (parser->state != HTTP_PARSE_BODY) {
+        // only the bytes that arrived since the last call are searched
+        const char* newline = memchr(data + parser->scanned, '\n', length - parser->scanned);
+        if (newline == nullptr) {
+            parser->scanned = length;
+            if (length == limit)
+                return reject(parser, parser->state == HTTP_PARSE_REQUEST_LINE ? 414 : 431);
+            return HTTP_INCOMPLETE;
+        }
+
+        const char* line = data + parser->lineStart;
+        size_t line_length = newline - line;
+        parser->scanned = parser->lineStart = newline - data + 1;
+        // lines end in CRLF, a bare LF is tolerated
+        if (line_length > 0 && line[line_length - 1] == '\r')
+            line_length--;
+
+        int status = 0;
+        if (parser->state == HTTP_PARSE_REQUEST_LINE) {
+            // blank lines in front of the request line are skipped
+            if (line_length == 0)
+                continue;
+            status = parse_request_line(parser, line, line_length);
+            parser->targetStart += line - data;
+            parser->state = HTTP_PARSE_HEADER_LINES;
+        } else if (line_length > 0) {
+            status = ++parser->headerLines > HTTP_MAX_HEADER_LINES
+                     ? 431
+                     : parse_header_line(parser, line, line_length, limit);
+        } else {
+            parser->headerLength = parser->scanned;
+            // HTTP/1.1 keeps the connection open unless asked otherwise, HTTP/1.0 only on request
+            parser->keepAlive = !parser->connectionClose && (parser->connectionKeepAlive || !parser->http10);
+            if (parser->headerLength + parser->contentLength > limit)
+                status = 413;
+            parser->state = HTTP_PARSE_BODY;
+        }
+        if (status != 0)
+            return reject(parser, status);
+    }
+
+    return length - parser->headerLength >= parser->contentLength ? HTTP_COMPLETE : HTTP_INCOMPLETE;
+}
+
+bool http_is_get(const HttpParser* parser, const char* data, const char* target) {
+    size_t length = strlen(target);
+    return parser->methodGet && parser->targetLength == length &&
+           memcmp(data + parser->targetStart, target, length) == 0;
+}
+
+HttpParseResult reject(HttpParser* parser, int status) {
+    parser->errorStatus = status;
+    return HTTP_INVALID;
+}
+
+int parse_request_line(HttpParser* parser, const char* line, size_t length) {
+    // method SP request-target SP HTTP-version
+    size_t i = 0;
+    while (i < length && is_token_char(line[i]))
+        i++;
+    if (i == 0 || i == length || line[i] != ' ')
+        return 400;
+
+    parser->methodGet = i == 3 && strncmp(line, "GET", 3) == 0;
+    size_t target = ++i;
+    while (i < length && line[i] > ' ' && line[i] != 0x7f)
+        i++;
+    if (i == target || i == length || line[i] != ' ')
+        return 400;
+    parser->targetStart = target;
+    parser->targetLength = i - target;
+
+    const char* version = line + i + 1;
+    size_t version_length = length - i - 1;
+    if (version_length != 8 || strncmp(version, "HTTP/", 5) != 0)
+        return 400;
+    if (version[5] != '1' || version[6] != '.' || (version[7] != '0' && version[7] != '1'))
+        return 505;
+
+    parser->http10 = version[7] == '0';
+    return 0;
+}
+
+int parse_header_line(HttpParser* parser, const char* line, size_t length, size_t limit) {
+    // field-name ":" OWS field-value OWS, folded continuation lines are obsolete and refused
+    size_t name_length = 0;
+    while (name_length < length && is_token_char(line[name_length]))
+        name_length++;
+    if (name_length == 0 || name_length == length || line[name_length] != ':')
+        return 400;
+
+    const char* value = line + name_length + 1;
+    const char* value_end = line + length;
+    while (value < value_end && (*value == ' ' || *value == '\t'))
+        value++;
+    while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+        value_end--;
+
+    if (equals_ignore_case(line, name_length, "content-length")) {
+        if (value == value_end)
+            return 400;
+        size_t content_length = 0;
+        for (const char* c = value; c < value_end; c++) {
+            if (*c < '0' || *c > '9')
+                return 400;
+            content_length = content_length * 10 + (*c - '0');
+            // anything past the limit is refused anyway, stopping here also rules out overflow
+            if (content_length > limit)
+                return 413;
+        }
+        // differing lengths are how requests get smuggled past proxies
+        if (parser->hasContentLength && parser->contentLength != content_length)
+            return 400;
+        parser->hasContentLength = true;
+        parser->contentLength = content_length;
+    } else if (equals_ignore_case(line, name_length, "connection")) {
+        // a comma separated list of options, only close and keep-alive mean anything here
+        while (value < value_end) {
+            const char* option_end = memchr(value, ',', value_end - value);
+            if (option_end == nullptr)
+                option_end = value_end;
+            const char* option = value;
+            const char* next = option_end;
+            while (option < option_end && (*option == ' ' || *option == '\t'))
+                option++;
+            while (option_end > option && (option_end[-1] == ' ' || option_end[-1] == '\t'))
+                option_end--;
+            if (equals_ignore_case(option, option_end - option, "close"))
+                parser->connectionClose = true;
+            else if (equals_ignore_case(option, option_end - option, "keep-alive"))
+                parser->connectionKeepAlive = true;
+            value = next + 1;
+        }
+    } else if (equals_ignore_case(line, name_length, "transfer-encoding")) {
+        // requests are small JSON documents, nobody needs to stream them chunked
+        return 501;
+    }
+
+    return 0;
+}
+
+bool is_token_char(char c) {
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
+        return true;
+    return c != '\0' && strchr("!#$%&'*+-.^_`|~", c) != nullptr;
+}
+
+bool equals_ignore_case(const char* value, size_t length, const char* expected) {
+    return strlen(expected) == length && strncasecmp(value, expected, length) == 0;
+}
+
+const char* status_reason(int status) {
+    switch (status) {
+        case 400:
+            return "Bad Request";
+        case 413:
+            return "Content Too Large";
+        case 414:
+            return "URI Too Long";
+        case 431:
+            return "Request Header Fields Too Large";
+        case 501:
+            return "Not Implemented";
+        case 505:
+            return "HTTP Version Not Supported";
+        default:
+            return "Error";
+    }
+}
+
+size_t http_write_error(ByteBuffer* out, int status) {
+    char response[HTTP_HEADER_RESERVE];
+    int length = snprintf(response, sizeof(response),
+                          "HTTP/1.1 %d %s\r\nAccess-Control-Allow-Origin: *\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+                          status, status_reason(status));
+    size_t start = out->length;
+    byte_buffer_append(out, response, length);
+    return start;
+}
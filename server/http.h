@@ -0,0 +1,83 @@
+#ifndef SERVER_HTTP_H
+#define SERVER_HTTP_H
+
+#include <stddef.h>
+#include "json_writer.h"
+
+// most header lines a request may carry, browsers send around fifteen
+#define HTTP_MAX_HEADER_LINES 64
+
+typedef enum {
+    HTTP_PARSE_REQUEST_LINE,
+    HTTP_PARSE_HEADER_LINES,
+    HTTP_PARSE_BODY
+} HttpParseState;
+
+typedef enum {
+    HTTP_INCOMPLETE,
+    HTTP_COMPLETE,
+    HTTP_INVALID
+} HttpParseResult;
+
+/*
+ * Incremental request parser working directly on the connection's receive
+ * buffer. Every call continues where the previous one stopped, so each byte is
+ * looked at once no matter how the request was split across reads. Offsets are
+ * relative to the start of the request, the body is left in place.
+ */
+typedef struct {
+    HttpParseState state;
+    // bytes already scanned and start of the line being scanned
+    size_t scanned;
+    size_t lineStart;
+    int headerLines;
+    bool http10;
+    // the request line, the target as an offset from the start of the request
+    bool methodGet;
+    size_t targetStart;
+    size_t targetLength;
+    bool hasContentLength;
+    // explicit Connection header tokens, resolved against the version at the end of the header
+    bool connectionClose;
+    bool connectionKeepAlive;
+
+    // valid once the header is complete
+    size_t headerLength;
+    size_t contentLength;
+    bool keepAlive;
+
+    // status to reject the request with after HTTP_INVALID
+    int errorStatus;
+} HttpParser;
+
+void http_parser_reset(HttpParser* parser);
+
+// data holds everything received for the request so far, no request may grow past limit bytes
+HttpParseResult http_parse_request(HttpParser* parser, const char* data, size_t length, size_t limit);
+
+// true for a GET of exactly target, data is the request the parser was given
+bool http_is_get(const HttpParser* parser, const char* data, const char* target);
+
+// appends a complete bodyless error response that closes the connection and returns its offset
+size_t http_write_error(ByteBuffer* out, int status);
+
+/*
+ * Responses are framed in place: the body is written first behind a gap big
+ * enough for any header, then the header is written right in front of it, so
+ * header and body end up adjacent without copying the body.
+ */
+#define HTTP_HEADER_RESERVE 160
+
+// reserves room for the header and returns the offset the body starts at
+size_t http_response_begin(ByteBuffer* out);
+
+// writes the header in front of the body and returns the offset the response starts at
+size_t http_response_end(ByteBuffer* out, size_t bodyStart, bool keepAlive);
+
+// same for a plain text body
+size_t http_text_response_end(ByteBuffer* out, size_t bodyStart, bool keepAlive);
+
+// appends only the header of a JSON response whose body is sent from elsewhere and returns its offset
+size_t http_write_header(ByteBuffer* out, size_t bodyLength, bool keepAlive);
+
+#endif //SERVER_HTTP_H
@@ -0,0 +1,577 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <time.h>
+#include <threads.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "journal.h"
+#include "chess_rules.h"
+
+// every batch starts with its payload length and an FNV-1a checksum of the payload
+#define BATCH_HEADER 8
+#define SNAPSHOT_MAGIC "CHSNAP01"
+#define MAX_PATH_LENGTH 4096
+// leaves room for the file names behind the directory
+#define MAX_DIRECTORY_LENGTH (MAX_PATH_LENGTH - 64)
+
+// fixed part of a game in a snapshot, its move records follow it
+typedef struct {
+    char gameId[MAX_GAME_ID_LENGTH + 1];
+    char playerIds[2][6];
+    // bit 0 white, bit 1 black
+    uint8_t joined;
+    uint8_t disconnected;
+    int8_t winner;
+    uint32_t version;
+    uint32_t moveCount;
+    uint64_t startHash;
+    Position position;
+} SnapshotGame;
+
+// a snapshot only fits the build that wrote it, the header makes a mismatch fail loudly
+typedef struct {
+    char magic[8];
+    uint32_t positionSize;
+    uint32_t moveRecordSize;
+    uint64_t gameCount;
+} SnapshotHeader;
+
+static char directory[MAX_DIRECTORY_LENGTH];
+static JournalSync syncMode;
+static int journalFd = -1;
+static unsigned long generation = 0;
+static size_t bytesSinceSnapshot = 0;
+static time_t lastSnapshot = 0;
+static atomic_bool stopping = false;
+static bool running = false;
+static thrd_t writerThread;
+// only touched by the writer thread once it runs
+static ByteBuffer batch = {nullptr, 0, 0};
+static ByteBuffer snapshot = {nullptr, 0, 0};
+
+static void file_path(char* path, const char* kind, unsigned long gen);
+
+static void* map_file(const char* path, size_t* length);
+
+static uint32_t checksum(const uint8_t* data, size_t length);
+
+static bool write_all(int fd, const char* data, size_t length);
+
+static bool load_snapshot(const char* path);
+
+static size_t replay_journal(const char* path);
+
+static size_t decode_record(const uint8_t* data, size_t length, JournalRecord* record);
+
+static void replay_record(const JournalRecord* record);
+
+static void begin_batch();
+
+static void commit_batch();
+
+static bool take_snapshot();
+
+static void remove_old_generations();
+
+static int run_writer(void* arg);
+
+void file_path(char* path, const char* kind, unsigned long gen) {
+    snprintf(path, MAX_PATH_LENGTH, "%s/%s.%lu", directory, kind, gen);
+}
+
+void* map_file(const char* path, size_t* length) {
+    *length = 0;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return nullptr;
+
+    struct stat st;
+    void* data = nullptr;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+        if (data == MAP_FAILED) {
+            perror("mmap has failed");
+            data = nullptr;
+        } else {
+            *length = st.st_size;
+        }
+    }
+    close(fd);
+    return data;
+}
+
+uint32_t checksum(const uint8_t* data, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++)
+        hash = (hash ^ data[i]) * 16777619u;
+    return hash;
+}
+
+bool write_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t written = write(fd, data, length);
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("journal write has failed");
+            return false;
+        }
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+bool journal_open(const char* path, JournalSync sync) {
+    if (strlen(path) >= MAX_DIRECTORY_LENGTH) {
+        printf("journal directory name is too long\n");
+        return false;
+    }
+    strcpy(directory, path);
+    syncMode = sync;
+    if (mkdir(directory, 0755) < 0 && errno != EEXIST) {
+        perror("cannot create the journal directory");
+        return false;
+    }
+
+    // the newest complete snapshot decides the generation, half written ones never got renamed
+    DIR* dir = opendir(directory);
+    if (dir == nullptr) {
+        perror("cannot open the journal directory");
+        return false;
+    }
+    bool found = false;
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        unsigned long gen;
+        int consumed = 0;
+        if (sscanf(entry->d_name, "snapshot.%lu%n", &gen, &consumed) == 1 && entry->d_name[consumed] == '\0' &&
+            (!found || gen > generation)) {
+            generation = gen;
+            found = true;
+        }
+    }
+    closedir(dir);
+
+    struct timespec start;
+    timespec_get(&start, TIME_UTC);
+    char snapshot_path[MAX_PATH_LENGTH];
+    file_path(snapshot_path, "snapshot", generation);
+    if (found && !load_snapshot(snapshot_path))
+        return false;
+
+    char journal_path[MAX_PATH_LENGTH];
+    file_path(journal_path, "journal", generation);
+    size_t valid = replay_journal(journal_path);
+
+    struct timespec end;
+    timespec_get(&end, TIME_UTC);
+    printf("Recovered generation %lu in %.1f ms\n", generation,
+           (double) (end.tv_sec - start.tv_sec) * 1e3 + (double) (end.tv_nsec - start.tv_nsec) / 1e6);
+
+    journalFd = open(journal_path, O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if (journalFd < 0) {
+        perror("cannot open the journal");
+        return false;
+    }
+    // a torn batch at the end is cut off so new batches follow the last good one
+    if (ftruncate(journalFd, (off_t) valid) < 0 || lseek(journalFd, 0, SEEK_END) < 0) {
+        perror("cannot truncate the journal");
+        return false;
+    }
+    bytesSinceSnapshot = valid;
+    lastSnapshot = time(NULL);
+
+    enable_game_journal();
+    // a long replay is folded into a snapshot right away so the next start is fast again
+    if (valid > 0) {
+        if (!take_snapshot())
+            return false;
+    } else {
+        remove_old_generations();
+    }
+
+    atomic_store(&stopping, false);
+    if (thrd_create(&writerThread, run_writer, nullptr) != thrd_success) {
+        printf("failed to start the journal writer\n");
+        return false;
+    }
+    running = true;
+    return true;
+}
+
+void journal_close() {
+    if (!running)
+        return;
+    atomic_store(&stopping, true);
+    thrd_join(writerThread, nullptr);
+    running = false;
+    close(journalFd);
+    journalFd = -1;
+    byte_buffer_free(&batch);
+    byte_buffer_free(&snapshot);
+}
+
+bool load_snapshot(const char* path) {
+    size_t length;
+    const uint8_t* data = map_file(path, &length);
+    SnapshotHeader header;
+    if (data == nullptr || length < sizeof(header)) {
+        printf("snapshot %s cannot be read\n", path);
+        return false;
+    }
+
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic)) != 0 ||
+        header.positionSize != sizeof(Position) || header.moveRecordSize != sizeof(MoveRecord)) {
+        printf("snapshot %s was written by an incompatible build\n", path);
+        munmap((void*) data, length);
+        return false;
+    }
+
+    size_t offset = sizeof(header);
+    for (uint64_t i = 0; i < header.gameCount; i++) {
+        SnapshotGame saved;
+        if (length - offset < sizeof(saved)) {
+            printf("snapshot %s is truncated\n", path);
+            munmap((void*) data, length);
+            return false;
+        }
+        memcpy(&saved, data + offset, sizeof(saved));
+        offset += sizeof(saved);
+        saved.gameId[MAX_GAME_ID_LENGTH] = '\0';
+        saved.playerIds[0][5] = '\0';
+        saved.playerIds[1][5] = '\0';
+        size_t moves_length = (size_t) saved.moveCount * sizeof(MoveRecord);
+        if (length - offset < moves_length) {
+            printf("snapshot %s is truncated\n", path);
+            munmap((void*) data, length);
+            return false;
+        }
+
+        // joining through the normal path seats the players and arms the timers, the rest is copied over
+        GameStatus* g = create_or_join_game(saved.gameId);
+        if (g == nullptr) {
+            printf("snapshot %s holds game %s twice\n", path, saved.gameId);
+            offset += moves_length;
+            continue;
+        }
+        if (saved.joined & 2)
+            create_or_join_game(saved.gameId);
+        for (int color = 0; color < 2; color++) {
+            if (g->players[color] != nullptr)
+                set_player_id(g->players[color], saved.playerIds[color]);
+        }
+        g->winner = saved.winner;
+        g->version = saved.version;
+        g->startHash = saved.startHash;
+        g->position = saved.position;
+        g->moveCount = (int) saved.moveCount;
+        g->moveCapacity = (int) saved.moveCount;
+        if (saved.moveCount > 0) {
+            g->moves = malloc(moves_length);
+            memcpy(g->moves, data + offset, moves_length);
+        }
+        offset += moves_length;
+        for (int color = 0; color < 2; color++) {
+            if (g->players[color] != nullptr && saved.disconnected & (1 << color))
+                disconnect_player(g, g->players[color]);
+        }
+    }
+
+    printf("Loaded %llu games from %s\n", (unsigned long long) header.gameCount, path);
+    munmap((void*) data, length);
+    return true;
+}
+
+size_t replay_journal(const char* path) {
+    size_t length;
+    const uint8_t* data = map_file(path, &length);
+    if (data == nullptr)
+        return 0;
+
+    size_t offset = 0;
+    size_t records = 0;
+    while (length - offset >= BATCH_HEADER) {
+        uint32_t payload = (uint32_t) data[offset] | (uint32_t) data[offset + 1] << 8 |
+                           (uint32_t) data[offset + 2] << 16 | (uint32_t) data[offset + 3] << 24;
+        uint32_t sum = (uint32_t) data[offset + 4] | (uint32_t) data[offset + 5] << 8 |
+                       (uint32_t) data[offset + 6] << 16 | (uint32_t) data[offset + 7] << 24;
+        const uint8_t* records_start = data + offset + BATCH_HEADER;
+        if (length - offset - BATCH_HEADER < payload || checksum(records_start, payload) != sum)
+            break;
+
+        size_t at = 0;
+        while (at < payload) {
+            JournalRecord record;
+            size_t used = decode_record(records_start + at, payload - at, &record);
+            if (used == 0)
+                break;
+            replay_record(&record);
+            records++;
+            at += used;
+        }
+        offset += BATCH_HEADER + payload;
+    }
+
+    if (offset < length)
+        printf("journal %s ends in a torn batch, dropping %zu bytes\n", path, length - offset);
+    printf("Replayed %zu journal records from %s\n", records, path);
+    munmap((void*) data, length);
+    return offset;
+}
+
+void journal_append(ByteBuffer* log, const JournalRecord* record) {
+    size_t id_length = strlen(record->gameId);
+    size_t player_length = strlen(record->playerId);
+    byte_buffer_reserve(log, 4 + id_length + player_length + 2);
+    uint8_t* at = (uint8_t*) log->data + log->length;
+    uint8_t* start = at;
+
+    *at++ = (uint8_t) record->type;
+    *at++ = (uint8_t) id_length;
+    memcpy(at, record->gameId, id_length);
+    at += id_length;
+    switch (record->type) {
+        case JOURNAL_CREATE:
+        case JOURNAL_JOIN:
+            *at++ = (uint8_t) player_length;
+            memcpy(at, record->playerId, player_length);
+            at += player_length;
+            break;
+        case JOURNAL_MOVE:
+            *at++ = (uint8_t) record->move;
+            *at++ = (uint8_t) (record->move >> 8);
+            break;
+        case JOURNAL_DISCONNECT:
+            *at++ = (uint8_t) record->disconnected;
+            break;
+        default:
+            break;
+    }
+    log->length += at - start;
+}
+
+size_t decode_record(const uint8_t* data, size_t length, JournalRecord* record) {
+    if (length < 2 || data[1] > MAX_GAME_ID_LENGTH || length - 2 < data[1])
+        return 0;
+    record->type = data[0];
+    memcpy(record->gameId, data + 2, data[1]);
+    record->gameId[data[1]] = '\0';
+    record->playerId[0] = '\0';
+    size_t at = 2 + data[1];
+
+    switch (record->type) {
+        case JOURNAL_CREATE:
+        case JOURNAL_JOIN:
+            if (length - at < 1 || data[at] >= sizeof(record->playerId) || length - at - 1 < data[at])
+                return 0;
+            memcpy(record->playerId, data + at + 1, data[at]);
+            record->playerId[data[at]] = '\0';
+            return at + 1 + data[at];
+        case JOURNAL_MOVE:
+            if (length - at < 2)
+                return 0;
+            record->move = (Move) (data[at] | data[at + 1] << 8);
+            return at + 2;
+        case JOURNAL_DISCONNECT:
+            if (length - at < 1)
+                return 0;
+            record->disconnected = data[at];
+            return at + 1;
+        case JOURNAL_FREE:
+            return at;
+        default:
+            return 0;
+    }
+}
+
+void replay_record(const JournalRecord* record) {
+    // the journal is only enabled after recovery, so replaying through the normal functions logs nothing
+    GameStatus* g = find_game(record->gameId);
+    if (record->type == JOURNAL_CREATE && g == nullptr)
+        g = create_or_join_game(record->gameId);
+    else if (record->type == JOURNAL_CREATE)
+        g = nullptr;
+    if (g == nullptr) {
+        printf("journal record %d does not fit game %s\n", record->type, record->gameId);
+        return;
+    }
+
+    switch (record->type) {
+        case JOURNAL_CREATE:
+            set_player_id(g->players[0], record->playerId);
+            break;
+        case JOURNAL_JOIN:
+            create_or_join_game(record->gameId);
+            if (g->players[1] != nullptr)
+                set_player_id(g->players[1], record->playerId);
+            break;
+        case JOURNAL_MOVE:
+            apply_move(g, record->move);
+            mark_game_changed(g);
+            break;
+        case JOURNAL_DISCONNECT:
+            for (int color = 0; color < 2; color++) {
+                if (g->players[color] != nullptr && record->disconnected & (1 << color))
+                    disconnect_player(g, g->players[color]);
+            }
+            mark_game_changed(g);
+            break;
+        case JOURNAL_FREE:
+            free_game(g);
+            break;
+        default:
+            break;
+    }
+}
+
+void journal_snapshot_game(ByteBuffer* out, const GameStatus* gameStatus) {
+    SnapshotGame saved;
+    memset(&saved, 0, sizeof(saved));
+    strcpy(saved.gameId, gameStatus->gameId);
+    for (int color = 0; color < 2; color++) {
+        Player* p = gameStatus->players[color];
+        if (p == nullptr)
+            continue;
+        strcpy(saved.playerIds[color], p->playerId);
+        saved.joined |= 1 << color;
+        if (p->disconnected)
+            saved.disconnected |= 1 << color;
+    }
+    saved.winner = (int8_t) gameStatus->winner;
+    saved.version = gameStatus->version;
+    saved.moveCount = gameStatus->moveCount;
+    saved.startHash = gameStatus->startHash;
+    saved.position = gameStatus->position;
+
+    byte_buffer_append(out, (const char*) &saved, sizeof(saved));
+    if (gameStatus->moveCount > 0)
+        byte_buffer_append(out, (const char*) gameStatus->moves, sizeof(MoveRecord) * gameStatus->moveCount);
+    // the header at the start of the buffer counts the games
+    ((SnapshotHeader*) out->data)->gameCount++;
+}
+
+void begin_batch() {
+    batch.length = 0;
+    byte_buffer_reserve(&batch, BATCH_HEADER);
+    batch.length = BATCH_HEADER;
+}
+
+void commit_batch() {
+    size_t payload = batch.length - BATCH_HEADER;
+    if (payload == 0)
+        return;
+
+    uint32_t sum = checksum((const uint8_t*) batch.data + BATCH_HEADER, payload);
+    for (int i = 0; i < 4; i++) {
+        batch.data[i] = (char) (payload >> (8 * i));
+        batch.data[4 + i] = (char) (sum >> (8 * i));
+    }
+    if (!write_all(journalFd, batch.data, batch.length))
+        return;
+    if (syncMode == JOURNAL_SYNC_BATCH && fdatasync(journalFd) < 0)
+        perror("journal fdatasync has failed");
+    bytesSinceSnapshot += batch.length;
+}
+
+bool take_snapshot() {
+    snapshot.length = 0;
+    SnapshotHeader header = {.positionSize = sizeof(Position), .moveRecordSize = sizeof(MoveRecord)};
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    byte_buffer_append(&snapshot, (const char*) &header, sizeof(header));
+
+    // the shards move to the next generation one by one: what they logged so far ends the old journal
+    begin_batch();
+    checkpoint_games(&batch, &snapshot);
+    commit_batch();
+
+    char tmp_path[MAX_PATH_LENGTH];
+    char snapshot_path[MAX_PATH_LENGTH];
+    char journal_path[MAX_PATH_LENGTH];
+    snprintf(tmp_path, MAX_PATH_LENGTH, "%s/snapshot.tmp", directory);
+    file_path(snapshot_path, "snapshot", generation + 1);
+    file_path(journal_path, "journal", generation + 1);
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        perror("cannot create a snapshot");
+        return false;
+    }
+    bool written = write_all(fd, snapshot.data, snapshot.length) && fsync(fd) == 0;
+    close(fd);
+    int next_fd = written ? open(journal_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644) : -1;
+    // the rename is what makes the new generation count, everything it needs is on disk before it
+    if (next_fd < 0 || rename(tmp_path, snapshot_path) < 0) {
+        perror("cannot store the snapshot");
+        if (next_fd >= 0)
+            close(next_fd);
+        unlink(tmp_path);
+        return false;
+    }
+
+    int dir_fd = open(directory, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+
+    close(journalFd);
+    journalFd = next_fd;
+    generation++;
+    bytesSinceSnapshot = 0;
+    lastSnapshot = time(NULL);
+    printf("Snapshot %lu: %llu games, %zu bytes\n", generation,
+           (unsigned long long) ((SnapshotHeader*) snapshot.data)->gameCount, snapshot.length);
+    remove_old_generations();
+    return true;
+}
+
+void remove_old_generations() {
+    DIR* dir = opendir(directory);
+    if (dir == nullptr)
+        return;
+
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != nullptr) {
+        unsigned long gen;
+        int consumed = 0;
+        bool numbered = (sscanf(entry->d_name, "snapshot.%lu%n", &gen, &consumed) == 1 ||
+                         sscanf(entry->d_name, "journal.%lu%n", &gen, &consumed) == 1) &&
+                        entry->d_name[consumed] == '\0';
+        if (numbered && gen < generation)
+            unlinkat(dirfd(dir), entry->d_name, 0);
+    }
+    closedir(dir);
+}
+
+int run_writer(void* arg) {
+    (void) arg;
+    struct timespec interval = {.tv_sec = 0, .tv_nsec = JOURNAL_FLUSH_INTERVAL_MS * 1000000L};
+    while (!atomic_load(&stopping)) {
+        thrd_sleep(&interval, nullptr);
+
+        begin_batch();
+        collect_game_journal(&batch);
+        commit_batch();
+
+        if (bytesSinceSnapshot >= JOURNAL_SNAPSHOT_BYTES ||
+            (bytesSinceSnapshot > 0 && time(NULL) - lastSnapshot >= JOURNAL_SNAPSHOT_INTERVAL))
+            take_snapshot();
+    }
+
+    // whatever was logged before the close is committed and synced
+    begin_batch();
+    collect_game_journal(&batch);
+    commit_batch();
+    if (fdatasync(journalFd) < 0)
+        perror("journal fdatasync has failed");
+    return 0;
+}
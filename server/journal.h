@@ -0,0 +1,64 @@
+#ifndef SERVER_JOURNAL_H
+#define SERVER_JOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "game.h"
+#include "json_writer.h"
+
+// the writer thread commits whatever the shards logged this often
+#define JOURNAL_FLUSH_INTERVAL_MS 5
+// a snapshot replaces the journal once it has grown this much, or this many seconds after the last one
+#define JOURNAL_SNAPSHOT_BYTES (64 << 20)
+#define JOURNAL_SNAPSHOT_INTERVAL 300
+
+typedef enum {
+    // leave write-back to the kernel, a machine crash can lose the last few seconds
+    JOURNAL_SYNC_NONE,
+    // fdatasync every batch, a crash loses at most one flush interval
+    JOURNAL_SYNC_BATCH
+} JournalSync;
+
+enum JOURNAL_RECORD_TYPE {
+    JOURNAL_CREATE = 1,
+    JOURNAL_JOIN,
+    JOURNAL_MOVE,
+    JOURNAL_DISCONNECT,
+    JOURNAL_FREE
+};
+
+// one change to one game, replaying them in order rebuilds the game including its version
+typedef struct {
+    int type;
+    char gameId[MAX_GAME_ID_LENGTH + 1];
+    // the joining player for JOURNAL_CREATE (white) and JOURNAL_JOIN (black)
+    char playerId[6];
+    Move move;
+    // players that went away, bit 0 white and bit 1 black
+    int disconnected;
+} JournalRecord;
+
+/*
+ * Games are made durable with snapshots and an append-only journal, both
+ * numbered by generation in the journal directory. snapshot.N holds every game
+ * as it was when generation N started, journal.N the changes since then.
+ * Changes are logged into the game's shard while its lock is held, which costs
+ * no system call; a writer thread collects them every flush interval and
+ * commits them to the journal as one checksummed batch. Taking a snapshot
+ * switches the shards to the next generation one at a time, under the same
+ * lock, so each snapshot lines up exactly with the end of the journal before it.
+ */
+
+// recovers the games found in directory, then starts the writer thread, false if the files cannot be used
+bool journal_open(const char* directory, JournalSync sync);
+
+// commits everything logged so far and stops the writer thread
+void journal_close();
+
+// encodes a record into a shard's pending log
+void journal_append(ByteBuffer* log, const JournalRecord* record);
+
+// encodes a whole game into a snapshot
+void journal_snapshot_game(ByteBuffer* snapshot, const GameStatus* gameStatus);
+
+#endif //SERVER_JOURNAL_H
@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <cjson/cJSON.h>
+#include "protocol.h"
+#include "chess_rules.h"
+#include "movegen.h"
+#include "matchmaking.h"
+
+static int extract_string(cJSON* root, char* key, char* value, size_t size);
+
+static bool extract_square(cJSON* move, char* key, int* x, int* y);
+
+static void write_moves(JsonWriter* writer, const MoveRecord* moves, int count);
+
+static void write_state(JsonWriter* writer, const Message* message);
+
+bool decode_json_request(const char* body, size_t length, Request* request) {
+    cJSON* root = cJSON_ParseWithLength(body, length);
+    if (root == NULL) {
+        printf("error parsing JSON body\n");
+        return false;
+    }
+
+    cJSON* message_type = cJSON_GetObjectItem(root, "messageType");
+    if (!cJSON_IsNumber(message_type)) {
+        printf("malformed message\n");
+        cJSON_Delete(root);
+        return false;
+    }
+
+    request->messageType = message_type->valueint;
+    request->gameId[0] = '\0';
+    request->playerId[0] = '\0';
+    request->lastSeenVersion = NO_VERSION;
+    request->promotion = QUEEN;
+    request->bucket = 0;
+
+    bool valid = true;
+    switch (request->messageType) {
+        case JOIN_GAME:
+            // joins still use the old key
+            valid = extract_string(root, "game_id", request->gameId, sizeof(request->gameId)) >= 0;
+            break;
+        case GAME_STATE_REQUEST:
+        case MOVE_PIECE:
+        case DISCONNECT:
+            valid = extract_string(root, "gameId", request->gameId, sizeof(request->gameId)) >= 0 &&
+                    extract_string(root, "playerId", request->playerId, sizeof(request->playerId)) >= 0;
+            break;
+        case WATCH_GAME:
+        case JOIN_COMPUTER_GAME:
+            // spectators hold no seat and a new computer game has no player id yet, both name only the game
+            valid = extract_string(root, "gameId", request->gameId, sizeof(request->gameId)) >= 0;
+            break;
+        default:
+            break;
+    }
+
+    if (valid && (request->messageType == GAME_STATE_REQUEST || request->messageType == WATCH_GAME)) {
+        cJSON* last_seen_json = cJSON_GetObjectItem(root, "lastSeenVersion");
+        if (cJSON_IsNumber(last_seen_json) && last_seen_json->valuedouble >= 0 &&
+            last_seen_json->valuedouble <= UINT_MAX)
+            request->lastSeenVersion = (long long) last_seen_json->valuedouble;
+    }
+
+    if (valid && request->messageType == FIND_MATCH) {
+        // players who do not pick a bucket all meet in the first one
+        cJSON* bucket = cJSON_GetObjectItem(root, "bucket");
+        if (cJSON_IsNumber(bucket))
+            request->bucket = bucket->valueint;
+        valid = request->bucket >= 0 && request->bucket < MATCH_BUCKETS;
+    }
+
+    if (valid && request->messageType == MOVE_PIECE) {
+        cJSON* move = cJSON_GetObjectItem(root, "move");
+        valid = extract_square(move, "from", &request->fromX, &request->fromY) &&
+                extract_square(move, "to", &request->toX, &request->toY);
+
+        // pawns reaching the last rank become a queen unless the client asks for something else
+        cJSON* promotion = cJSON_GetObjectItem(root, "promotion");
+        if (cJSON_IsNumber(promotion))
+            request->promotion = promotion->valueint;
+    }
+
+    cJSON_Delete(root);
+    return valid;
+}
+
+int extract_string(cJSON* root, char* key, char* value, size_t size) {
+    cJSON* json = cJSON_GetObjectItem(root, key);
+    if (!cJSON_IsString(json) || strlen(json->valuestring) >= size) {
+        printf("error parsing %s\n", key);
+        return -1;
+    }
+    strcpy(value, json->valuestring);
+    return 1;
+}
+
+bool extract_square(cJSON* move, char* key, int* x, int* y) {
+    cJSON* square = cJSON_GetObjectItem(move, key);
+    cJSON* x_json = cJSON_GetArrayItem(square, 0);
+    cJSON* y_json = cJSON_GetArrayItem(square, 1);
+    if (!cJSON_IsNumber(x_json) || !cJSON_IsNumber(y_json)) {
+        printf("error parsing move %s\n", key);
+        return false;
+    }
+    *x = x_json->valueint;
+    *y = y_json->valueint;
+    return true;
+}
+
+void encode_json_message(ByteBuffer* out, const Message* message) {
+    JsonWriter writer;
+    json_begin_object(&writer, out);
+    json_add_int(&writer, "messageType", message->messageType);
+    json_add_string(&writer, "gameId", message->gameId);
+    json_add_string(&writer, "playerId", message->playerId);
+
+    switch (message->messageType) {
+        case WAIT_FOR_OTHER_PLAYER:
+        case GAME_STARTED:
+            json_add_int(&writer, "playerColor", message->playerColor);
+            json_add_int(&writer, "version", message->version);
+            break;
+        case GAME_STATE_RESPONSE:
+            json_add_int(&writer, "currentTurn", message->currentTurn);
+            json_add_int(&writer, "playerColor", message->playerColor);
+            write_state(&writer, message);
+            break;
+        case GAME_ENDED:
+            json_add_int(&writer, "winner", message->winner);
+            write_state(&writer, message);
+            break;
+        case GAME_STATE_DELTA:
+            json_add_int(&writer, "currentTurn", message->currentTurn);
+            json_add_int(&writer, "baseVersion", message->baseVersion);
+            json_add_int(&writer, "version", message->version);
+            json_add_int(&writer, "playerColor", message->playerColor);
+            write_moves(&writer, message->moves, message->moveCount);
+            write_position_hash(&writer, message->position);
+            break;
+        case GAME_STATE_UNCHANGED:
+            json_add_int(&writer, "version", message->version);
+            break;
+        case SPECTATOR_STATE:
+            json_add_int(&writer, "currentTurn", message->currentTurn);
+            json_add_int(&writer, "winner", message->winner);
+            write_state(&writer, message);
+            break;
+        default:
+            break;
+    }
+
+    json_end_object(&writer);
+}
+
+void write_state(JsonWriter* writer, const Message* message) {
+    if (message->state != nullptr) {
+        json_add_members(writer, message->state, message->stateLength);
+        return;
+    }
+    json_add_int(writer, "version", message->version);
+    write_board(writer, message->position);
+}
+
+void encode_json_state(ByteBuffer* out, unsigned int version, const Position* position) {
+    // the members alone, without braces, so they can follow the per-player fields
+    JsonWriter writer = {out, false};
+    json_add_int(&writer, "version", version);
+    write_board(&writer, position);
+}
+
+void write_moves(JsonWriter* writer, const MoveRecord* moves, int count) {
+    // [fromX, fromY, toX, toY, promotion], the client works out castling and en passant itself
+    json_begin_array(writer, "moves");
+    for (int i = 0; i < count; i++) {
+        Move move = moves[i].move;
+        json_begin_array(writer, nullptr);
+        json_add_int(writer, nullptr, SQUARE_X(MOVE_FROM(move)));
+        json_add_int(writer, nullptr, SQUARE_Y(MOVE_FROM(move)));
+        json_add_int(writer, nullptr, SQUARE_X(MOVE_TO(move)));
+        json_add_int(writer, nullptr, SQUARE_Y(MOVE_TO(move)));
+        json_add_int(writer, nullptr, IS_PROMOTION(move) ? PROMOTION_PIECE(move) : 0);
+        json_end_array(writer);
+    }
+    json_end_array(writer);
+}
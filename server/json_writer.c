@@ -0,0 +1,131 @@
+#include <stdlib.h>
+#include <string.h>
+#include "json_writer.h"
+#include "common.h"
+
+#define MIN_BUFFER_CAPACITY 512
+
+static void write_key(JsonWriter* writer, const char* key, size_t value_reserve);
+
+void byte_buffer_reserve(ByteBuffer* buffer, size_t extra) {
+    if (buffer->length + extra <= buffer->capacity)
+        return;
+
+    size_t capacity = buffer->capacity < MIN_BUFFER_CAPACITY ? MIN_BUFFER_CAPACITY : buffer->capacity;
+    while (capacity < buffer->length + extra)
+        capacity *= 2;
+    buffer->data = realloc(buffer->data, capacity);
+    buffer->capacity = capacity;
+}
+
+void byte_buffer_append(ByteBuffer* buffer, const char* data, size_t length) {
+    byte_buffer_reserve(buffer, length);
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+}
+
+void byte_buffer_free(ByteBuffer* buffer) {
+    free(buffer->data);
+    buffer->data = nullptr;
+    buffer->length = 0;
+    buffer->capacity = 0;
+}
+
+void write_key(JsonWriter* writer, const char* key, size_t value_reserve) {
+    size_t key_length = key != nullptr ? strlen(key) : 0;
+    ByteBuffer* out = writer->out;
+    byte_buffer_reserve(out, key_length + value_reserve + 4);
+
+    if (writer->needsComma)
+        out->data[out->length++] = ',';
+    writer->needsComma = true;
+
+    if (key != nullptr) {
+        out->data[out->length++] = '"';
+        memcpy(out->data + out->length, key, key_length);
+        out->length += key_length;
+        out->data[out->length++] = '"';
+        out->data[out->length++] = ':';
+    }
+}
+
+void json_begin_object(JsonWriter* writer, ByteBuffer* out) {
+    writer->out = out;
+    writer->needsComma = false;
+    byte_buffer_reserve(out, 1);
+    out->data[out->length++] = '{';
+}
+
+void json_end_object(JsonWriter* writer) {
+    byte_buffer_reserve(writer->out, 1);
+    writer->out->data[writer->out->length++] = '}';
+    writer->needsComma = true;
+}
+
+void json_begin_array(JsonWriter* writer, const char* key) {
+    write_key(writer, key, 1);
+    writer->out->data[writer->out->length++] = '[';
+    writer->needsComma = false;
+}
+
+void json_end_array(JsonWriter* writer) {
+    byte_buffer_reserve(writer->out, 1);
+    writer->out->data[writer->out->length++] = ']';
+    writer->needsComma = true;
+}
+
+void json_add_int(JsonWriter* writer, const char* key, long long value) {
+    // enough for the sign and 19 digits
+    write_key(writer, key, 20);
+    ByteBuffer* out = writer->out;
+
+    unsigned long long magnitude = value < 0 ? -(unsigned long long) value : (unsigned long long) value;
+    if (value < 0)
+        out->data[out->length++] = '-';
+
+    char digits[20];
+    int count = 0;
+    do {
+        digits[count++] = (char) ('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude != 0);
+    while (count > 0)
+        out->data[out->length++] = digits[--count];
+}
+
+void json_add_string(JsonWriter* writer, const char* key, const char* value) {
+    static const char hex[] = "0123456789abcdef";
+    size_t value_length = strlen(value);
+    // worst case every byte becomes a \u00XX escape
+    write_key(writer, key, value_length * 6 + 2);
+    ByteBuffer* out = writer->out;
+
+    out->data[out->length++] = '"';
+    for (const unsigned char* c = (const unsigned char*) value; *c != '\0'; c++) {
+        if (*c == '"' || *c == '\\') {
+            out->data[out->length++] = '\\';
+            out->data[out->length++] = (char) *c;
+        } else if (*c < 0x20) {
+            memcpy(out->data + out->length, "\\u00", 4);
+            out->data[out->length + 4] = hex[*c >> 4];
+            out->data[out->length + 5] = hex[*c & 15];
+            out->length += 6;
+        } else {
+            out->data[out->length++] = (char) *c;
+        }
+    }
+    out->data[out->length++] = '"';
+}
+
+void json_add_raw(JsonWriter* writer, const char* key, const char* json, size_t length) {
+    write_key(writer, key, length);
+    memcpy(writer->out->data + writer->out->length, json, length);
+    writer->out->length += length;
+}
+
+void json_add_members(JsonWriter* writer, const char* json, size_t length) {
+    // without a key write_key only puts down the comma
+    write_key(writer, nullptr, length);
+    memcpy(writer->out->data + writer->out->length, json, length);
+    writer->out->length += length;
+}
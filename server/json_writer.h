@@ -0,0 +1,46 @@
+#ifndef SERVER_JSON_WRITER_H
+#define SERVER_JSON_WRITER_H
+
+#include <stddef.h>
+
+// growable byte array that is reused between responses, so it only allocates while it is still growing
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} ByteBuffer;
+
+void byte_buffer_reserve(ByteBuffer* buffer, size_t extra);
+
+void byte_buffer_append(ByteBuffer* buffer, const char* data, size_t length);
+
+void byte_buffer_free(ByteBuffer* buffer);
+
+/*
+ * Emits compact JSON straight into a ByteBuffer. Keys are trusted literals,
+ * string values are escaped. A key of nullptr adds a bare array element.
+ */
+typedef struct {
+    ByteBuffer* out;
+    bool needsComma;
+} JsonWriter;
+
+void json_begin_object(JsonWriter* writer, ByteBuffer* out);
+
+void json_end_object(JsonWriter* writer);
+
+void json_begin_array(JsonWriter* writer, const char* key);
+
+void json_end_array(JsonWriter* writer);
+
+void json_add_int(JsonWriter* writer, const char* key, long long value);
+
+void json_add_string(JsonWriter* writer, const char* key, const char* value);
+
+// value that is already valid JSON, for shapes the caller can format faster itself
+void json_add_raw(JsonWriter* writer, const char* key, const char* json, size_t length);
+
+// comma separated members that are already valid JSON, for parts of an object encoded ahead of time
+void json_add_members(JsonWriter* writer, const char* json, size_t length);
+
+#endif //SERVER_JSON_WRITER_H
@@ -5,42 +5,148 @@
 #include <arpa/inet.h>
 #include <string.h>
 #include <stdlib.h>
+#include <threads.h>
+#include <getopt.h>
 #include <cjson/cJSON.h>
 
 #include "common.h"
 #include "connection.h"
 #include "game.h"
+#include "event_loop.h"
+#include "journal.h"
+#include "archive.h"
+#include "metrics.h"
+#include "computer.h"
+#include "matchmaking.h"
 
 #define LISTEN_PORT 2137
+// length-prefixed binary frames instead of HTTP/JSON, see protocol.h
+#define BINARY_PORT 2138
+#define MAX_WORKERS 64
 
-int main() {
+static int open_listen_socket(int port);
+
+static int run_worker(void* arg);
+
+int open_listen_socket(int port) {
     struct sockaddr_in server_sockaddr_in;
     server_sockaddr_in.sin_family = AF_INET;
     server_sockaddr_in.sin_addr.s_addr = inet_addr("127.0.0.1");
-    server_sockaddr_in.sin_port = htons(LISTEN_PORT);
+    server_sockaddr_in.sin_port = htons(port);
 
-    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+    int sockfd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     int optval = 1;
+    // no SO_REUSEPORT: a second server on the same ports must fail here rather than take half the clients
     setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &optval, sizeof(optval));
     if (bind(sockfd, (struct sockaddr*) &server_sockaddr_in, sizeof(server_sockaddr_in)) < 0) {
         perror("bind has failed");
-        return 1;
+        close(sockfd);
+        return -1;
+    }
+    if (listen(sockfd, SOMAXCONN) < 0) {
+        perror("listen has failed");
+        close(sockfd);
+        return -1;
     }
-    listen(sockfd, 5);
 
-    printf("Starting accepting requests...\n");
+    return sockfd;
+}
 
-    for (;;) {
-        struct sockaddr_in client_sockaddr_in;
-        socklen_t len = sizeof(client_sockaddr_in);
+int run_worker(void* arg) {
+    event_loop_run(arg);
+    return 0;
+}
 
-        int conn_fd = accept(sockfd, (struct sockaddr*) &client_sockaddr_in, &len);
-        handle_connection(conn_fd);
+int main(int argc, char** argv) {
+    // -j keeps games in a journal in the given directory across restarts, -f syncs it to disk every batch,
+    // -c sets the number of threads searching computer moves, -a keeps every freed game in an archive,
+    // -u runs the event loops on io_uring instead of epoll where the kernel allows it
+    const char* journal_directory = nullptr;
+    const char* archive_directory = nullptr;
+    JournalSync journal_sync = JOURNAL_SYNC_NONE;
+    long computer_threads = -1;
+    IoBackend backend = IO_BACKEND_EPOLL;
+    int option;
+    while ((option = getopt(argc, argv, "j:fc:a:u")) != -1) {
+        switch (option) {
+            case 'j':
+                journal_directory = optarg;
+                break;
+            case 'f':
+                journal_sync = JOURNAL_SYNC_BATCH;
+                break;
+            case 'c':
+                computer_threads = strtol(optarg, NULL, 10);
+                break;
+            case 'a':
+                archive_directory = optarg;
+                break;
+            case 'u':
+                backend = IO_BACKEND_URING;
+                break;
+            default:
+                printf("usage: %s [-j journal directory] [-f] [-c computer threads] [-a archive directory] [-u] [workers]\n", argv[0]);
+                return 1;
+        }
     }
 
-    close(sockfd);
-    return 0;
-}
+    // one reactor per core unless the worker count is given on the command line
+    long workers = optind < argc ? strtol(argv[optind], NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers < 1)
+        workers = 1;
+    if (workers > MAX_WORKERS)
+        workers = MAX_WORKERS;
+    // searches run at a lower priority, half the cores leaves the event loops room even when every one is busy
+    if (computer_threads < 0)
+        computer_threads = sysconf(_SC_NPROCESSORS_ONLN) / 2;
+    if (computer_threads < 1)
+        computer_threads = 1;
+    if (computer_threads > MAX_WORKERS)
+        computer_threads = MAX_WORKERS;
+    if (!event_loop_backend_available(backend)) {
+        perror("io_uring cannot be used, falling back to epoll");
+        backend = IO_BACKEND_EPOLL;
+    }
 
+    // one socket per port shared by every loop, each of them accepts from it; bound before the journal and the
+    // archive are opened, so a second instance on the same ports stops without touching them
+    int http_socket = open_listen_socket(LISTEN_PORT);
+    int binary_socket = open_listen_socket(BINARY_PORT);
+    if (http_socket < 0 || binary_socket < 0)
+        return 1;
+
+    init_games();
+    init_matchmaking();
+    metrics_init();
+    if (journal_directory != nullptr && !journal_open(journal_directory, journal_sync))
+        return 1;
+    // after recovery, so games freed again while the journal is replayed are not archived twice
+    if (archive_directory != nullptr && !archive_open(archive_directory))
+        return 1;
+    connections_init();
+    if (!computer_start((int) computer_threads))
+        return 1;
 
+    EventLoop* loops[MAX_WORKERS];
+    for (int i = 0; i < workers; i++) {
+        loops[i] = event_loop_create(http_socket, binary_socket, backend);
+        if (loops[i] == nullptr)
+            return 1;
+    }
+
+    printf("Starting accepting requests on %ld threads with %s...\n", workers,
+           backend == IO_BACKEND_URING ? "io_uring" : "epoll");
 
+    // the main thread runs the first loop itself
+    thrd_t threads[MAX_WORKERS];
+    for (int i = 1; i < workers; i++) {
+        if (thrd_create(&threads[i], run_worker, loops[i]) != thrd_success) {
+            printf("failed to start worker %d\n", i);
+            return 1;
+        }
+    }
+    event_loop_run(loops[0]);
+
+    // loops only return when epoll or io_uring fails, the other workers cannot be stopped safely so take them all down
+    return 1;
+}
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "matchmaking.h"
+
+typedef struct {
+    // held while a player is paired or queued, so two players arriving together always meet
+    alignas(64) mtx_t lock;
+    // guards the links below and is taken last, with nothing else taken under it, so a game can leave under its shard lock
+    mtx_t queueLock;
+    // games waiting for black, linked through matchPrev and matchNext, the oldest at head
+    GameStatus* head;
+    GameStatus* tail;
+    size_t count;
+} MatchBucket;
+
+static MatchBucket buckets[MATCH_BUCKETS];
+static atomic_ullong nextMatchId = 0;
+static atomic_ullong matches = 0;
+
+static bool is_waiting(const GameStatus* gameStatus);
+
+static GameStatus* open_match(MatchBucket* bucket);
+
+static bool pop_entry(MatchBucket* bucket, char* gameId, uint64_t* generation);
+
+static void push_entry(MatchBucket* bucket, GameStatus* gameStatus);
+
+static void unlink_entry(MatchBucket* bucket, GameStatus* gameStatus);
+
+void init_matchmaking() {
+    for (int i = 0; i < MATCH_BUCKETS; i++) {
+        mtx_init(&buckets[i].lock, mtx_plain);
+        mtx_init(&buckets[i].queueLock, mtx_plain);
+        buckets[i].head = nullptr;
+        buckets[i].tail = nullptr;
+        buckets[i].count = 0;
+    }
+    // ids of an earlier run are still around after recovery, start past them instead of probing through them
+    atomic_store(&nextMatchId, (unsigned long long) time(NULL) << 16);
+}
+
+GameStatus* find_match(int bucketIndex) {
+    MatchBucket* bucket = &buckets[bucketIndex];
+    mtx_lock(&bucket->lock);
+
+    GameStatus* gameStatus = nullptr;
+    char game_id[MAX_GAME_ID_LENGTH + 1];
+    uint64_t generation;
+    while (gameStatus == nullptr && pop_entry(bucket, game_id, &generation)) {
+        // the bucket lock is taken before the shard lock everywhere, nothing holding a shard lock takes a bucket lock
+        mtx_t* lock = game_lock(game_id);
+        mtx_lock(lock);
+        gameStatus = find_game(game_id);
+        // between the pop and the shard lock the game may have been freed and its id reused by someone else
+        if (gameStatus != nullptr && gameStatus->generation == generation && is_waiting(gameStatus)) {
+            // seats black and wakes white's long poll
+            gameStatus = create_or_join_game(game_id);
+        } else {
+            gameStatus = nullptr;
+        }
+        if (gameStatus == nullptr)
+            mtx_unlock(lock);
+    }
+
+    if (gameStatus != nullptr)
+        atomic_fetch_add(&matches, 1);
+    else
+        gameStatus = open_match(bucket);
+
+    mtx_unlock(&bucket->lock);
+    return gameStatus;
+}
+
+bool is_waiting(const GameStatus* gameStatus) {
+    // freed games are not found at all, a player who missed the heartbeat is marked disconnected
+    return gameStatus->players[1] == nullptr && !gameStatus->players[0]->disconnected;
+}
+
+GameStatus* open_match(MatchBucket* bucket) {
+    char game_id[MAX_GAME_ID_LENGTH + 1];
+    for (;;) {
+        // recovered games or a client's own JOIN_GAME may already use an id, the next one is tried then
+        snprintf(game_id, sizeof(game_id), "m%llx", (unsigned long long) atomic_fetch_add(&nextMatchId, 1));
+        mtx_t* lock = game_lock(game_id);
+        mtx_lock(lock);
+        GameStatus* gameStatus = create_game(game_id);
+        if (gameStatus != nullptr) {
+            push_entry(bucket, gameStatus);
+            return gameStatus;
+        }
+        bool taken = find_game(game_id) != nullptr;
+        mtx_unlock(lock);
+        if (!taken)
+            return nullptr;
+    }
+}
+
+bool pop_entry(MatchBucket* bucket, char* gameId, uint64_t* generation) {
+    mtx_lock(&bucket->queueLock);
+    GameStatus* gameStatus = bucket->head;
+    if (gameStatus != nullptr) {
+        // a queued game is never freed, free_game takes it off under this lock first, so it can still be read here
+        strcpy(gameId, gameStatus->gameId);
+        *generation = gameStatus->generation;
+        unlink_entry(bucket, gameStatus);
+    }
+    mtx_unlock(&bucket->queueLock);
+    return gameStatus != nullptr;
+}
+
+void push_entry(MatchBucket* bucket, GameStatus* gameStatus) {
+    gameStatus->matchBucket = (int) (bucket - buckets);
+    mtx_lock(&bucket->queueLock);
+    gameStatus->matchQueued = true;
+    gameStatus->matchPrev = bucket->tail;
+    gameStatus->matchNext = nullptr;
+    if (bucket->tail != nullptr)
+        bucket->tail->matchNext = gameStatus;
+    else
+        bucket->head = gameStatus;
+    bucket->tail = gameStatus;
+    bucket->count++;
+    mtx_unlock(&bucket->queueLock);
+}
+
+void unlink_entry(MatchBucket* bucket, GameStatus* gameStatus) {
+    if (gameStatus->matchPrev != nullptr)
+        gameStatus->matchPrev->matchNext = gameStatus->matchNext;
+    else
+        bucket->head = gameStatus->matchNext;
+    if (gameStatus->matchNext != nullptr)
+        gameStatus->matchNext->matchPrev = gameStatus->matchPrev;
+    else
+        bucket->tail = gameStatus->matchPrev;
+    gameStatus->matchQueued = false;
+    bucket->count--;
+}
+
+void leave_match_queue(GameStatus* gameStatus) {
+    // matchBucket only changes under the shard lock, matchQueued also when find_match pops the game
+    if (gameStatus->matchBucket < 0)
+        return;
+    MatchBucket* bucket = &buckets[gameStatus->matchBucket];
+    mtx_lock(&bucket->queueLock);
+    if (gameStatus->matchQueued)
+        unlink_entry(bucket, gameStatus);
+    mtx_unlock(&bucket->queueLock);
+    gameStatus->matchBucket = -1;
+}
+
+void collect_match_stats(MatchStats* stats) {
+    stats->waiting = 0;
+    for (int i = 0; i < MATCH_BUCKETS; i++) {
+        mtx_lock(&buckets[i].queueLock);
+        stats->waiting += buckets[i].count;
+        mtx_unlock(&buckets[i].queueLock);
+    }
+    stats->matches = atomic_load(&matches);
+}
@@ -0,0 +1,35 @@
+#ifndef SERVER_MATCHMAKING_H
+#define SERVER_MATCHMAKING_H
+
+#include <stddef.h>
+#include "game.h"
+
+// rating or time-control classes, players are only paired within their own
+#define MATCH_BUCKETS 16
+
+typedef struct {
+    // games whose white player is still waiting for black
+    size_t waiting;
+    unsigned long long matches;
+} MatchStats;
+
+/*
+ * Pairs players who did not agree on a game id. Every bucket is a FIFO of
+ * games with only white seated: a player who finds it empty opens such a game
+ * and waits in it like after JOIN_GAME, the next player of the bucket takes
+ * the oldest one as black, which wakes the first player's long poll. The queue
+ * is linked through the games themselves, so a game whose player disconnects
+ * or times out, or that is joined by id or freed, leaves it at once in O(1).
+ */
+
+void init_matchmaking();
+
+// the game the player was seated in, with its shard lock still held, nullptr if none could be created
+GameStatus* find_match(int bucketIndex);
+
+// called by game.c under the game's shard lock whenever the game stops waiting for black
+void leave_match_queue(GameStatus* gameStatus);
+
+void collect_match_stats(MatchStats* stats);
+
+#endif //SERVER_MATCHMAKING_H
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <threads.h>
+#include <time.h>
+#include "metrics.h"
+#include "game.h"
+#include "protocol.h"
+#include "computer.h"
+#include "matchmaking.h"
+
+static const char* MESSAGE_TYPE_NAMES[METRIC_MESSAGE_TYPES] = {
+        "JOIN_GAME", "GAME_STATE_REQUEST", "MOVE_PIECE", "DISCONNECT", "WATCH_GAME", "JOIN_COMPUTER_GAME",
+        "FIND_MATCH", "OTHER"};
+
+static Metrics threadMetrics[METRICS_MAX_THREADS];
+static atomic_int threadsRegistered = 0;
+// handed to threads past the limit, their increments may get lost when they race
+static Metrics sharedMetrics;
+static thread_local Metrics* localMetrics = nullptr;
+// nanoseconds per metrics_clock unit in 32.32 fixed point
+static uint64_t clockScale = 1ULL << 32;
+
+static int latency_bucket(uint64_t elapsedNs);
+
+static void append_format(ByteBuffer* out, const char* format, ...) __attribute__((format(printf, 2, 3)));
+
+static void render_counter(ByteBuffer* out, const char* name, const char* help, const char* type, uint64_t value);
+
+static uint64_t sum_counter(const Metrics* metrics, int count, size_t offset);
+
+static uint64_t sum_gauge(const Metrics* metrics, int count, size_t added, size_t removed);
+
+Metrics* metrics_local() {
+    if (localMetrics == nullptr) {
+        int slot = atomic_fetch_add(&threadsRegistered, 1);
+        localMetrics = slot < METRICS_MAX_THREADS ? &threadMetrics[slot] : &sharedMetrics;
+    }
+    return localMetrics;
+}
+
+void metrics_init() {
+#if defined(__x86_64__)
+    struct timespec start;
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint64_t start_ticks = metrics_clock();
+    // 20 ms puts the error of the two readings far below the histogram's resolution
+    thrd_sleep(&(struct timespec) {.tv_nsec = 20000000}, nullptr);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    uint64_t ticks = metrics_clock() - start_ticks;
+    uint64_t ns = (uint64_t) (end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+    if (ticks > 0)
+        clockScale = (uint64_t) (((unsigned __int128) ns << 32) / ticks);
+#endif
+}
+
+int latency_bucket(uint64_t elapsedNs) {
+    uint64_t scaled = elapsedNs >> 8;
+    if (scaled == 0)
+        return 0;
+    int bucket = 64 - __builtin_clzll(scaled);
+    return bucket < METRICS_LATENCY_BUCKETS ? bucket : METRICS_LATENCY_BUCKETS - 1;
+}
+
+void metrics_record_request(int messageType, uint64_t elapsed) {
+    uint64_t elapsedNs = (uint64_t) ((unsigned __int128) elapsed * clockScale >> 32);
+    int type;
+    switch (messageType) {
+        case JOIN_GAME:
+            type = METRIC_JOIN_GAME;
+            break;
+        case GAME_STATE_REQUEST:
+            type = METRIC_GAME_STATE_REQUEST;
+            break;
+        case MOVE_PIECE:
+            type = METRIC_MOVE_PIECE;
+            break;
+        case DISCONNECT:
+            type = METRIC_DISCONNECT;
+            break;
+        case WATCH_GAME:
+            type = METRIC_WATCH_GAME;
+            break;
+        case JOIN_COMPUTER_GAME:
+            type = METRIC_JOIN_COMPUTER_GAME;
+            break;
+        case FIND_MATCH:
+            type = METRIC_FIND_MATCH;
+            break;
+        default:
+            type = METRIC_OTHER;
+            break;
+    }
+
+    Metrics* metrics = metrics_local();
+    metrics_add(&metrics->requests[type], 1);
+    metrics_add(&metrics->latencyNs[type], elapsedNs);
+    metrics_add(&metrics->latencyBuckets[type][latency_bucket(elapsedNs)], 1);
+}
+
+void append_format(ByteBuffer* out, const char* format, ...) {
+    char line[256];
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+    if (length > 0)
+        byte_buffer_append(out, line, (size_t) length < sizeof(line) ? (size_t) length : sizeof(line) - 1);
+}
+
+void render_counter(ByteBuffer* out, const char* name, const char* help, const char* type, uint64_t value) {
+    append_format(out, "# HELP %s %s\n# TYPE %s %s\n%s %llu\n", name, help, name, type, name,
+                  (unsigned long long) value);
+}
+
+uint64_t sum_counter(const Metrics* metrics, int count, size_t offset) {
+    uint64_t sum = atomic_load_explicit((_Atomic uint64_t*) ((char*) &sharedMetrics + offset), memory_order_relaxed);
+    for (int i = 0; i < count; i++)
+        sum += atomic_load_explicit((_Atomic uint64_t*) ((char*) &metrics[i] + offset), memory_order_relaxed);
+    return sum;
+}
+
+uint64_t sum_gauge(const Metrics* metrics, int count, size_t added, size_t removed) {
+    // each side is read once, a change in between can make the difference briefly one too small
+    uint64_t in = sum_counter(metrics, count, added);
+    uint64_t out = sum_counter(metrics, count, removed);
+    return in > out ? in - out : 0;
+}
+
+void metrics_render(ByteBuffer* out) {
+    int count = atomic_load(&threadsRegistered);
+    if (count > METRICS_MAX_THREADS)
+        count = METRICS_MAX_THREADS;
+
+    append_format(out, "# HELP chess_requests_total Requests handled, by message type.\n"
+                       "# TYPE chess_requests_total counter\n");
+    for (int type = 0; type < METRIC_MESSAGE_TYPES; type++) {
+        append_format(out, "chess_requests_total{type=\"%s\"} %llu\n", MESSAGE_TYPE_NAMES[type],
+                      (unsigned long long) sum_counter(threadMetrics, count, offsetof(Metrics, requests[type])));
+    }
+
+    append_format(out, "# HELP chess_request_duration_seconds Time spent decoding and handling a request, "
+                       "a parked long poll's wait is not included.\n"
+                       "# TYPE chess_request_duration_seconds histogram\n");
+    for (int type = 0; type < METRIC_MESSAGE_TYPES; type++) {
+        // Prometheus buckets are cumulative, ours count each range once
+        uint64_t cumulative = 0;
+        for (int bucket = 0; bucket < METRICS_LATENCY_BUCKETS - 1; bucket++) {
+            cumulative += sum_counter(threadMetrics, count, offsetof(Metrics, latencyBuckets[type][bucket]));
+            append_format(out, "chess_request_duration_seconds_bucket{type=\"%s\",le=\"%.9g\"} %llu\n",
+                          MESSAGE_TYPE_NAMES[type], (double) (256ULL << bucket) / 1e9,
+                          (unsigned long long) cumulative);
+        }
+        cumulative += sum_counter(threadMetrics, count,
+                                  offsetof(Metrics, latencyBuckets[type][METRICS_LATENCY_BUCKETS - 1]));
+        append_format(out, "chess_request_duration_seconds_bucket{type=\"%s\",le=\"+Inf\"} %llu\n",
+                      MESSAGE_TYPE_NAMES[type], (unsigned long long) cumulative);
+        append_format(out, "chess_request_duration_seconds_sum{type=\"%s\"} %.9g\n", MESSAGE_TYPE_NAMES[type],
+                      (double) sum_counter(threadMetrics, count, offsetof(Metrics, latencyNs[type])) / 1e9);
+        append_format(out, "chess_request_duration_seconds_count{type=\"%s\"} %llu\n", MESSAGE_TYPE_NAMES[type],
+                      (unsigned long long) cumulative);
+    }
+
+    render_counter(out, "chess_connections_accepted_total", "Client connections accepted.", "counter",
+                   sum_counter(threadMetrics, count, offsetof(Metrics, connectionsOpened)));
+    render_counter(out, "chess_connections_open", "Client connections currently open.", "gauge",
+                   sum_gauge(threadMetrics, count, offsetof(Metrics, connectionsOpened),
+                             offsetof(Metrics, connectionsClosed)));
+    render_counter(out, "chess_received_bytes_total", "Bytes read from clients.", "counter",
+                   sum_counter(threadMetrics, count, offsetof(Metrics, bytesReceived)));
+    render_counter(out, "chess_sent_bytes_total", "Bytes written to clients.", "counter",
+                   sum_counter(threadMetrics, count, offsetof(Metrics, bytesSent)));
+    render_counter(out, "chess_network_syscalls_total",
+                   "System calls the event loops made to accept, read, write, close and wait for connections.",
+                   "counter", sum_counter(threadMetrics, count, offsetof(Metrics, syscalls)));
+    render_counter(out, "chess_parse_failures_total", "Requests that could not be framed or decoded.", "counter",
+                   sum_counter(threadMetrics, count, offsetof(Metrics, parseFailures)));
+    render_counter(out, "chess_state_cache_hits_total", "Full-state responses built from the cached board.",
+                   "counter", sum_counter(threadMetrics, count, offsetof(Metrics, stateCacheHits)));
+    render_counter(out, "chess_state_cache_misses_total", "Full-state responses that had to encode the board.",
+                   "counter", sum_counter(threadMetrics, count, offsetof(Metrics, stateCacheMisses)));
+
+    render_counter(out, "chess_games_active", "Games currently held in memory.", "gauge",
+                   sum_gauge(threadMetrics, count, offsetof(Metrics, gamesCreated), offsetof(Metrics, gamesFreed)));
+    render_counter(out, "chess_players_active", "Players that joined a game and have not left it.", "gauge",
+                   sum_gauge(threadMetrics, count, offsetof(Metrics, playersJoined), offsetof(Metrics, playersLeft)));
+    render_counter(out, "chess_spectators_active", "Spectators waiting for the next change of a game.", "gauge",
+                   sum_gauge(threadMetrics, count, offsetof(Metrics, spectatorsParked),
+                             offsetof(Metrics, spectatorsUnparked)));
+    MatchStats match;
+    collect_match_stats(&match);
+    render_counter(out, "chess_match_queue_length", "Games waiting in the matchmaking queue for a second player.",
+                   "gauge", match.waiting);
+    render_counter(out, "chess_matches_total", "Players paired by matchmaking.", "counter", match.matches);
+    render_counter(out, "chess_heartbeat_expiries_total", "Players dropped for missing their heartbeat.", "counter",
+                   sum_counter(threadMetrics, count, offsetof(Metrics, heartbeatExpiries)));
+
+    ComputerStats computer;
+    collect_computer_stats(&computer);
+    render_counter(out, "chess_engine_searches_total", "Computer moves searched.", "counter", computer.searches);
+    render_counter(out, "chess_engine_nodes_total", "Positions visited by computer searches.", "counter",
+                   computer.nodes);
+    append_format(out, "# HELP chess_engine_search_seconds_total Time spent searching computer moves.\n"
+                       "# TYPE chess_engine_search_seconds_total counter\n"
+                       "chess_engine_search_seconds_total %.9g\n", (double) computer.searchNs / 1e9);
+    render_counter(out, "chess_engine_depth_total", "Sum of the depths computer searches completed.", "counter",
+                   computer.depths);
+    render_counter(out, "chess_engine_queued", "Computer games waiting for a search thread.", "gauge",
+                   (uint64_t) computer.queued);
+}
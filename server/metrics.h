@@ -0,0 +1,86 @@
+#ifndef SERVER_METRICS_H
+#define SERVER_METRICS_H
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stdalign.h>
+#include <time.h>
+#include "json_writer.h"
+
+// bucket i counts requests handled in under 256 << i nanoseconds, the last bucket takes everything slower
+#define METRICS_LATENCY_BUCKETS 20
+// threads that get counters of their own, any further ones share one set
+#define METRICS_MAX_THREADS 128
+
+typedef enum {
+    METRIC_JOIN_GAME,
+    METRIC_GAME_STATE_REQUEST,
+    METRIC_MOVE_PIECE,
+    METRIC_DISCONNECT,
+    METRIC_WATCH_GAME,
+    METRIC_JOIN_COMPUTER_GAME,
+    METRIC_FIND_MATCH,
+    METRIC_OTHER,
+    METRIC_MESSAGE_TYPES
+} MetricMessageType;
+
+/*
+ * Counters of one thread. Only the owning thread writes them, with plain
+ * relaxed loads and stores instead of read-modify-write instructions, so
+ * counting costs about as much as incrementing a local variable and threads
+ * never share a cache line. A scrape sums every thread's counters; it may see
+ * a request counted before its latency, which Prometheus tolerates.
+ */
+typedef struct {
+    alignas(64) _Atomic uint64_t requests[METRIC_MESSAGE_TYPES];
+    _Atomic uint64_t latencyNs[METRIC_MESSAGE_TYPES];
+    _Atomic uint64_t latencyBuckets[METRIC_MESSAGE_TYPES][METRICS_LATENCY_BUCKETS];
+    _Atomic uint64_t bytesReceived;
+    _Atomic uint64_t bytesSent;
+    _Atomic uint64_t parseFailures;
+    // full-state responses that reused the game's encoded board and those that had to encode it
+    _Atomic uint64_t stateCacheHits;
+    _Atomic uint64_t stateCacheMisses;
+    _Atomic uint64_t connectionsOpened;
+    _Atomic uint64_t connectionsClosed;
+    // calls into the kernel made to accept, read, write, close and wait for connections, whichever backend
+    _Atomic uint64_t syscalls;
+    // the game gauges as counters of what came and went, so no scrape has to walk the games
+    _Atomic uint64_t gamesCreated;
+    _Atomic uint64_t gamesFreed;
+    _Atomic uint64_t playersJoined;
+    _Atomic uint64_t playersLeft;
+    _Atomic uint64_t spectatorsParked;
+    _Atomic uint64_t spectatorsUnparked;
+    _Atomic uint64_t heartbeatExpiries;
+} Metrics;
+
+// counters of the calling thread, set up on first use
+Metrics* metrics_local();
+
+static inline void metrics_add(_Atomic uint64_t* counter, uint64_t amount) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + amount,
+                          memory_order_relaxed);
+}
+
+// measures how fast the timestamp counter runs, call once before the workers start
+void metrics_init();
+
+// a timestamp in the clock's own units, on x86-64 the TSC, which is cheaper to read than the vDSO clock
+static inline uint64_t metrics_clock() {
+#if defined(__x86_64__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+// counts a handled request of the given wire message type and how long it took in metrics_clock units
+void metrics_record_request(int messageType, uint64_t elapsed);
+
+// appends every counter, the latency histograms and the game gauges in the Prometheus text format
+void metrics_render(ByteBuffer* out);
+
+#endif //SERVER_METRICS_H
@@ -0,0 +1,306 @@
+#include "movegen.h"
+#include "common.h"
+#include "zobrist.h"
+
+#define PAWN_BB(pos, color) ((pos)->pieces[color][PIECE_INDEX(PAWN)])
+#define KNIGHT_BB(pos, color) ((pos)->pieces[color][PIECE_INDEX(KNIGHT)])
+#define BISHOP_BB(pos, color) ((pos)->pieces[color][PIECE_INDEX(BISHOP)])
+#define ROOK_BB(pos, color) ((pos)->pieces[color][PIECE_INDEX(ROOK)])
+#define QUEEN_BB(pos, color) ((pos)->pieces[color][PIECE_INDEX(QUEEN)])
+#define KING_BB(pos, color) ((pos)->pieces[color][PIECE_INDEX(KING)])
+
+// castling rights that survive a move touching the given square
+static const uint8_t castlingMask[64] = {
+        [0] = (uint8_t) ~WHITE_QUEENSIDE, [1 ... 3] = 0xF, [4] = (uint8_t) ~(WHITE_KINGSIDE | WHITE_QUEENSIDE),
+        [5 ... 6] = 0xF, [7] = (uint8_t) ~WHITE_KINGSIDE, [8 ... 55] = 0xF,
+        [56] = (uint8_t) ~BLACK_QUEENSIDE, [57 ... 59] = 0xF, [60] = (uint8_t) ~(BLACK_KINGSIDE | BLACK_QUEENSIDE),
+        [61 ... 62] = 0xF, [63] = (uint8_t) ~BLACK_KINGSIDE
+};
+
+static Bitboard pinned_pieces(const Position* pos, int us, int king);
+
+static void add_pawn_moves(MoveList* list, int from, Bitboard targets, int last_rank, bool capture);
+
+static void add_moves(MoveList* list, int from, Bitboard targets, Bitboard enemies);
+
+static void generate_castling(const Position* pos, MoveList* list, int us);
+
+Bitboard attackers_to(const Position* pos, int sq, Bitboard occupied) {
+    Bitboard diagonal = BISHOP_BB(pos, WHITE) | BISHOP_BB(pos, BLACK) | QUEEN_BB(pos, WHITE) | QUEEN_BB(pos, BLACK);
+    Bitboard straight = ROOK_BB(pos, WHITE) | ROOK_BB(pos, BLACK) | QUEEN_BB(pos, WHITE) | QUEEN_BB(pos, BLACK);
+
+    return (pawn_attacks(BLACK, sq) & PAWN_BB(pos, WHITE)) |
+           (pawn_attacks(WHITE, sq) & PAWN_BB(pos, BLACK)) |
+           (knight_attacks(sq) & (KNIGHT_BB(pos, WHITE) | KNIGHT_BB(pos, BLACK))) |
+           (king_attacks(sq) & (KING_BB(pos, WHITE) | KING_BB(pos, BLACK))) |
+           (bishop_attacks(sq, occupied) & diagonal) |
+           (rook_attacks(sq, occupied) & straight);
+}
+
+bool is_in_check(const Position* pos) {
+    int us = pos->sideToMove;
+    int king = __builtin_ctzll(KING_BB(pos, us));
+    return (attackers_to(pos, king, all_pieces(pos)) & pos->occupied[!us]) != 0;
+}
+
+Bitboard pinned_pieces(const Position* pos, int us, int king) {
+    int them = !us;
+    Bitboard occupied = all_pieces(pos);
+    Bitboard snipers = (rook_attacks(king, 0) & (ROOK_BB(pos, them) | QUEEN_BB(pos, them))) |
+                       (bishop_attacks(king, 0) & (BISHOP_BB(pos, them) | QUEEN_BB(pos, them)));
+    Bitboard pinned = 0;
+
+    while (snipers) {
+        int sniper = pop_lsb(&snipers);
+        Bitboard blockers = between_squares(king, sniper) & occupied;
+        if (blockers != 0 && (blockers & (blockers - 1)) == 0)
+            pinned |= blockers & pos->occupied[us];
+    }
+
+    return pinned;
+}
+
+void add_pawn_moves(MoveList* list, int from, Bitboard targets, int last_rank, bool capture) {
+    while (targets) {
+        int to = pop_lsb(&targets);
+        if ((to >> 3) == last_rank) {
+            int flags = capture ? CAPTURE_PROMOTION : PROMOTION;
+            for (int promotion = 3; promotion >= 0; promotion--) {
+                list->moves[list->count++] = MOVE(from, to, flags | promotion);
+            }
+        } else {
+            list->moves[list->count++] = MOVE(from, to, capture ? CAPTURE : QUIET_MOVE);
+        }
+    }
+}
+
+void add_moves(MoveList* list, int from, Bitboard targets, Bitboard enemies) {
+    while (targets) {
+        int to = pop_lsb(&targets);
+        list->moves[list->count++] = MOVE(from, to, enemies & BIT(to) ? CAPTURE : QUIET_MOVE);
+    }
+}
+
+void generate_castling(const Position* pos, MoveList* list, int us) {
+    Bitboard occupied = all_pieces(pos);
+    Bitboard enemies = pos->occupied[!us];
+    int king = us == WHITE ? 4 : 60;
+    int kingside = us == WHITE ? WHITE_KINGSIDE : BLACK_KINGSIDE;
+    int queenside = us == WHITE ? WHITE_QUEENSIDE : BLACK_QUEENSIDE;
+
+    // the king may not pass through or land on an attacked square, the squares in between must be empty
+    if (pos->castlingRights & kingside && ROOK_BB(pos, us) & BIT(king + 3) &&
+        (occupied & (BIT(king + 1) | BIT(king + 2))) == 0 &&
+        !(attackers_to(pos, king + 1, occupied) & enemies) && !(attackers_to(pos, king + 2, occupied) & enemies)) {
+        list->moves[list->count++] = MOVE(king, king + 2, KING_CASTLE);
+    }
+
+    if (pos->castlingRights & queenside && ROOK_BB(pos, us) & BIT(king - 4) &&
+        (occupied & (BIT(king - 1) | BIT(king - 2) | BIT(king - 3))) == 0 &&
+        !(attackers_to(pos, king - 1, occupied) & enemies) && !(attackers_to(pos, king - 2, occupied) & enemies)) {
+        list->moves[list->count++] = MOVE(king, king - 2, QUEEN_CASTLE);
+    }
+}
+
+void generate_legal_moves(const Position* pos, MoveList* list) {
+    int us = pos->sideToMove;
+    int them = !us;
+    Bitboard own = pos->occupied[us];
+    Bitboard enemies = pos->occupied[them];
+    Bitboard occupied = own | enemies;
+    int king = __builtin_ctzll(KING_BB(pos, us));
+    Bitboard checkers = attackers_to(pos, king, occupied) & enemies;
+
+    list->count = 0;
+
+    // the king itself must not stay on a line its own body was shielding
+    Bitboard without_king = occupied ^ BIT(king);
+    Bitboard king_targets = king_attacks(king) & ~own;
+    while (king_targets) {
+        int to = pop_lsb(&king_targets);
+        if (!(attackers_to(pos, to, without_king) & enemies))
+            list->moves[list->count++] = MOVE(king, to, enemies & BIT(to) ? CAPTURE : QUIET_MOVE);
+    }
+
+    if (checkers & (checkers - 1))
+        return;
+
+    // every other piece has to capture the single checker or block it
+    Bitboard allowed = ~own;
+    if (checkers)
+        allowed &= between_squares(king, __builtin_ctzll(checkers)) | checkers;
+    else
+        generate_castling(pos, list, us);
+
+    Bitboard pinned = pinned_pieces(pos, us, king);
+
+    Bitboard knights = KNIGHT_BB(pos, us) & ~pinned;
+    while (knights) {
+        int from = pop_lsb(&knights);
+        add_moves(list, from, knight_attacks(from) & allowed, enemies);
+    }
+
+    Bitboard diagonal = BISHOP_BB(pos, us) | QUEEN_BB(pos, us);
+    while (diagonal) {
+        int from = pop_lsb(&diagonal);
+        Bitboard targets = bishop_attacks(from, occupied) & allowed;
+        if (pinned & BIT(from))
+            targets &= line_through(king, from);
+        add_moves(list, from, targets, enemies);
+    }
+
+    Bitboard straight = ROOK_BB(pos, us) | QUEEN_BB(pos, us);
+    while (straight) {
+        int from = pop_lsb(&straight);
+        Bitboard targets = rook_attacks(from, occupied) & allowed;
+        if (pinned & BIT(from))
+            targets &= line_through(king, from);
+        add_moves(list, from, targets, enemies);
+    }
+
+    int last_rank = us == WHITE ? 7 : 0;
+    Bitboard pawns = PAWN_BB(pos, us);
+    while (pawns) {
+        int from = pop_lsb(&pawns);
+        Bitboard pin_line = pinned & BIT(from) ? line_through(king, from) : ~0ULL;
+
+        Bitboard single = (us == WHITE ? BIT(from) << 8 : BIT(from) >> 8) & ~occupied;
+        Bitboard twice = (us == WHITE ? (single & RANK_3) << 8 : (single & RANK_6) >> 8) & ~occupied;
+        add_pawn_moves(list, from, single & allowed & pin_line, last_rank, false);
+        if (twice & allowed & pin_line)
+            list->moves[list->count++] = MOVE(from, __builtin_ctzll(twice), DOUBLE_PAWN_PUSH);
+
+        add_pawn_moves(list, from, pawn_attacks(us, from) & enemies & allowed & pin_line, last_rank, true);
+
+        if (pos->epSquare != NO_SQUARE && pawn_attacks(us, from) & BIT(pos->epSquare)) {
+            // two pawns leave the rank at once, so just play it and look at the king
+            Position after = *pos;
+            UndoInfo undo;
+            Move move = MOVE(from, pos->epSquare, EN_PASSANT);
+            make_move(&after, move, &undo);
+            if (!(attackers_to(&after, king, all_pieces(&after)) & after.occupied[them]))
+                list->moves[list->count++] = move;
+        }
+    }
+}
+
+void make_move(Position* pos, Move move, UndoInfo* undo) {
+    int us = pos->sideToMove;
+    int them = !us;
+    int from = MOVE_FROM(move);
+    int to = MOVE_TO(move);
+    int flags = MOVE_FLAGS(move);
+    int piece = pos->squares[from];
+
+    undo->captured = EMPTY;
+    undo->castlingRights = pos->castlingRights;
+    undo->epSquare = pos->epSquare;
+    undo->halfmoveClock = pos->halfmoveClock;
+    undo->hash = pos->hash;
+
+    pos->hash ^= zobrist.castling[pos->castlingRights] ^ zobrist_ep(pos->epSquare) ^ zobrist.blackToMove;
+    pos->halfmoveClock++;
+    pos->epSquare = NO_SQUARE;
+
+    if (flags == EN_PASSANT) {
+        int captured_square = us == WHITE ? to - 8 : to + 8;
+        undo->captured = pos->squares[captured_square];
+        position_remove_piece(pos, captured_square);
+    } else if (flags & CAPTURE) {
+        undo->captured = pos->squares[to];
+        position_remove_piece(pos, to);
+    }
+
+    position_remove_piece(pos, from);
+    position_put_piece(pos, to, flags & PROMOTION ? MAKE_PIECE(PROMOTION_PIECE(move), us) : piece);
+
+    if (get_piece_type(piece) == PAWN || undo->captured != EMPTY)
+        pos->halfmoveClock = 0;
+
+    if (flags == DOUBLE_PAWN_PUSH) {
+        int ep = us == WHITE ? from + 8 : from - 8;
+        if (pawn_attacks(us, ep) & PAWN_BB(pos, them))
+            pos->epSquare = (int8_t) ep;
+    } else if (flags == KING_CASTLE) {
+        position_remove_piece(pos, to + 1);
+        position_put_piece(pos, to - 1, MAKE_PIECE(ROOK, us));
+    } else if (flags == QUEEN_CASTLE) {
+        position_remove_piece(pos, to - 2);
+        position_put_piece(pos, to + 1, MAKE_PIECE(ROOK, us));
+    }
+
+    pos->castlingRights &= castlingMask[from] & castlingMask[to];
+    pos->hash ^= zobrist.castling[pos->castlingRights] ^ zobrist_ep(pos->epSquare);
+    if (us == BLACK)
+        pos->fullmoveNumber++;
+    pos->sideToMove = them;
+}
+
+void unmake_move(Position* pos, Move move, const UndoInfo* undo) {
+    int them = pos->sideToMove;
+    int us = !them;
+    int from = MOVE_FROM(move);
+    int to = MOVE_TO(move);
+    int flags = MOVE_FLAGS(move);
+
+    pos->sideToMove = us;
+    if (us == BLACK)
+        pos->fullmoveNumber--;
+
+    if (flags == KING_CASTLE) {
+        position_remove_piece(pos, to - 1);
+        position_put_piece(pos, to + 1, MAKE_PIECE(ROOK, us));
+    } else if (flags == QUEEN_CASTLE) {
+        position_remove_piece(pos, to + 1);
+        position_put_piece(pos, to - 2, MAKE_PIECE(ROOK, us));
+    }
+
+    int piece = flags & PROMOTION ? MAKE_PIECE(PAWN, us) : pos->squares[to];
+    position_remove_piece(pos, to);
+    position_put_piece(pos, from, piece);
+
+    if (flags == EN_PASSANT) {
+        position_put_piece(pos, us == WHITE ? to - 8 : to + 8, undo->captured);
+    } else if (undo->captured != EMPTY) {
+        position_put_piece(pos, to, undo->captured);
+    }
+
+    pos->castlingRights = undo->castlingRights;
+    pos->epSquare = undo->epSquare;
+    pos->halfmoveClock = undo->halfmoveClock;
+    pos->hash = undo->hash;
+}
+
+Move find_legal_move(const Position* pos, int from, int to, int promotion) {
+    MoveList list;
+    generate_legal_moves(pos, &list);
+
+    for (int i = 0; i < list.count; i++) {
+        Move move = list.moves[i];
+        if (MOVE_FROM(move) != from || MOVE_TO(move) != to)
+            continue;
+        if (IS_PROMOTION(move) && PROMOTION_PIECE(move) != promotion)
+            continue;
+        return move;
+    }
+
+    return NO_MOVE;
+}
+
+uint64_t perft(Position* pos, int depth) {
+    MoveList list;
+    generate_legal_moves(pos, &list);
+
+    // bulk counting: the leaves are the legal moves one ply up
+    if (depth <= 1)
+        return depth == 1 ? (uint64_t) list.count : 1;
+
+    uint64_t nodes = 0;
+    for (int i = 0; i < list.count; i++) {
+        UndoInfo undo;
+        make_move(pos, list.moves[i], &undo);
+        nodes += perft(pos, depth - 1);
+        unmake_move(pos, list.moves[i], &undo);
+    }
+    return nodes;
+}
@@ -0,0 +1,66 @@
+#ifndef SERVER_MOVEGEN_H
+#define SERVER_MOVEGEN_H
+
+#include <stdint.h>
+#include "bitboard.h"
+
+/*
+ * A move fits in 16 bits: origin square, destination square and a 4-bit flag.
+ * Promotions carry the new piece in the two low flag bits.
+ */
+typedef uint16_t Move;
+
+#define MOVE(from, to, flags) ((Move) ((from) | (to) << 6 | (flags) << 12))
+#define MOVE_FROM(m) ((m) & 63)
+#define MOVE_TO(m) ((m) >> 6 & 63)
+#define MOVE_FLAGS(m) ((m) >> 12)
+#define NO_MOVE ((Move) 0)
+
+enum MoveFlags {
+    QUIET_MOVE = 0,
+    DOUBLE_PAWN_PUSH = 1,
+    KING_CASTLE = 2,
+    QUEEN_CASTLE = 3,
+    CAPTURE = 4,
+    EN_PASSANT = 5,
+    PROMOTION = 8,
+    CAPTURE_PROMOTION = 12
+};
+
+#define IS_CAPTURE(m) (MOVE_FLAGS(m) & CAPTURE)
+#define IS_PROMOTION(m) (MOVE_FLAGS(m) & PROMOTION)
+// KNIGHT, BISHOP, ROOK or QUEEN
+#define PROMOTION_PIECE(m) (KNIGHT + (MOVE_FLAGS(m) & 3))
+
+#define MAX_MOVES 256
+
+typedef struct {
+    Move moves[MAX_MOVES];
+    int count;
+} MoveList;
+
+// everything make_move overwrites that cannot be recomputed from the move itself
+typedef struct {
+    uint64_t hash;
+    uint8_t captured;
+    uint8_t castlingRights;
+    int8_t epSquare;
+    uint16_t halfmoveClock;
+} UndoInfo;
+
+void generate_legal_moves(const Position* pos, MoveList* list);
+
+void make_move(Position* pos, Move move, UndoInfo* undo);
+
+void unmake_move(Position* pos, Move move, const UndoInfo* undo);
+
+Bitboard attackers_to(const Position* pos, int sq, Bitboard occupied);
+
+bool is_in_check(const Position* pos);
+
+// legal move from one square to another, promotion is the piece type a pawn becomes, NO_MOVE if illegal
+Move find_legal_move(const Position* pos, int from, int to, int promotion);
+
+uint64_t perft(Position* pos, int depth);
+
+#endif //SERVER_MOVEGEN_H
@@ -0,0 +1,141 @@
+#ifndef SERVER_PROTOCOL_H
+#define SERVER_PROTOCOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "game.h"
+#include "json_writer.h"
+
+enum MESSAGE_TYPE_OUT {
+    WAIT_FOR_OTHER_PLAYER = 0,
+    GAME_STARTED,
+    GAME_STATE_RESPONSE,
+    MOVE_ACCEPTED,
+    GAME_ENDED,
+    PLAYER_DISCONNECTED,
+    OPPONENT_DISCONNECTED,
+    GAME_STATE_DELTA,
+    GAME_STATE_UNCHANGED,
+    SPECTATOR_STATE
+};
+
+enum MESSAGE_TYPE_IN {
+    JOIN_GAME = 128,
+    GAME_STATE_REQUEST,
+    MOVE_PIECE,
+    DISCONNECT,
+    WATCH_GAME,
+    JOIN_COMPUTER_GAME,
+    FIND_MATCH,
+    EXIT_SERVER = 42069
+};
+
+// sent instead of a version when the client has not seen the game yet
+#define NO_VERSION (-1)
+#define PLAYER_ID_LENGTH 5
+
+typedef enum {
+    PROTOCOL_HTTP,
+    PROTOCOL_BINARY
+} Protocol;
+
+// a decoded request, the handlers never see the wire format
+typedef struct {
+    int messageType;
+    char gameId[MAX_GAME_ID_LENGTH + 1];
+    char playerId[PLAYER_ID_LENGTH + 1];
+    long long lastSeenVersion;
+    int fromX;
+    int fromY;
+    int toX;
+    int toY;
+    int promotion;
+    // matchmaking bucket, rating or time control as the clients agree on it, below MATCH_BUCKETS
+    int bucket;
+} Request;
+
+/*
+ * A response as the handlers produce it. Which fields go on the wire depends
+ * on the message type, see encode_json_message. The board and the delta moves
+ * are read from the game while it is still locked.
+ */
+typedef struct {
+    int messageType;
+    const char* gameId;
+    const char* playerId;
+    int playerColor;
+    int currentTurn;
+    int winner;
+    unsigned int version;
+    unsigned int baseVersion;
+    const Position* position;
+    const MoveRecord* moves;
+    int moveCount;
+    // version, board and hash already encoded for the connection's protocol, see encode_json_state
+    const char* state;
+    size_t stateLength;
+} Message;
+
+// false when the body is not a well formed request
+bool decode_json_request(const char* body, size_t length, Request* request);
+
+void encode_json_message(ByteBuffer* out, const Message* message);
+
+/*
+ * Every full-state response (GAME_STATE_RESPONSE, GAME_ENDED, SPECTATOR_STATE)
+ * ends with the version, the board and its hash, which are the same for
+ * everyone asking about that version. Encoded once they can be passed in
+ * Message.state, the encoders then only write the few fields in front of it.
+ */
+void encode_json_state(ByteBuffer* out, unsigned int version, const Position* position);
+
+/*
+ * Binary framing on its own port: every frame is a big-endian u16 payload
+ * length followed by the payload, which starts with the u16 message type.
+ * Strings are a u8 length and the bytes, squares are y * 8 + x in wire
+ * coordinates, versions are u32 with 0xffffffff for none. Requests:
+ *
+ *   JOIN_GAME           gameId
+ *   GAME_STATE_REQUEST  gameId playerId u32 lastSeenVersion
+ *   MOVE_PIECE          gameId playerId u8 from u8 to u8 promotion (0 = queen)
+ *   DISCONNECT          gameId playerId
+ *   WATCH_GAME          gameId u32 lastSeenVersion
+ *   JOIN_COMPUTER_GAME  gameId
+ *   FIND_MATCH          u8 bucket
+ *   EXIT_SERVER         -
+ *
+ * Responses start with gameId playerId (empty for spectators), then by type:
+ *
+ *   WAIT_FOR_OTHER_PLAYER, GAME_STARTED  u8 playerColor u32 version
+ *   GAME_STATE_RESPONSE  u8 currentTurn u8 playerColor u32 version board u64 hash
+ *   GAME_ENDED           u8 winner u32 version board u64 hash
+ *   GAME_STATE_DELTA     u8 currentTurn u8 playerColor u32 baseVersion u32 version
+ *                        u64 hash u8 count, count * (u8 from u8 to u8 promotion)
+ *   GAME_STATE_UNCHANGED u32 version
+ *   SPECTATOR_STATE      u8 currentTurn u8 winner (0xff while playing) u32 version board u64 hash
+ *
+ * The board is 32 bytes, two squares per byte in the 4-bit piece encoding,
+ * the lower nibble holding the even square.
+ */
+#define BINARY_FRAME_HEADER 2
+#define BINARY_BOARD_SIZE 32
+#define BINARY_NO_VERSION 0xffffffffu
+
+bool decode_binary_request(const uint8_t* payload, size_t length, Request* request);
+
+void encode_binary_message(ByteBuffer* out, const Message* message);
+
+void encode_binary_state(ByteBuffer* out, unsigned int version, const Position* position);
+
+// reserves the length prefix and returns the offset the payload starts at
+size_t binary_frame_begin(ByteBuffer* out);
+
+// fills in the length prefix and returns the offset the frame starts at
+size_t binary_frame_end(ByteBuffer* out, size_t payloadStart);
+
+// appends only the length prefix of a frame whose payload is sent from elsewhere and returns its offset
+size_t binary_write_frame_header(ByteBuffer* out, size_t payloadLength);
+
+void write_packed_board(uint8_t* board, const Position* position);
+
+#endif //SERVER_PROTOCOL_H
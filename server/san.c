@@ -0,0 +1,160 @@
+#include "san.h"
+#include "chess_rules.h"
+
+static int piece_from_letter(char letter);
+
+static const char PIECE_LETTERS[] = " PNBRQK";
+
+int piece_from_letter(char letter) {
+    switch (letter) {
+        case 'N':
+            return KNIGHT;
+        case 'B':
+            return BISHOP;
+        case 'R':
+            return ROOK;
+        case 'Q':
+            return QUEEN;
+        case 'K':
+            return KING;
+        default:
+            return EMPTY;
+    }
+}
+
+Move san_parse(const Position* pos, const char* san, size_t length) {
+    // check marks and annotations say nothing about which move it is
+    while (length > 0 && (san[length - 1] == '+' || san[length - 1] == '#' || san[length - 1] == '!' ||
+                          san[length - 1] == '?'))
+        length--;
+    if (length < 2 || length >= SAN_MAX_LENGTH)
+        return NO_MOVE;
+
+    MoveList moves;
+    generate_legal_moves(pos, &moves);
+
+    if (san[0] == 'O' || san[0] == '0') {
+        int flags;
+        if (length == 3 && san[1] == '-' && san[2] == san[0])
+            flags = KING_CASTLE;
+        else if (length == 5 && san[1] == '-' && san[2] == san[0] && san[3] == '-' && san[4] == san[0])
+            flags = QUEEN_CASTLE;
+        else
+            return NO_MOVE;
+        for (int i = 0; i < moves.count; i++) {
+            if (MOVE_FLAGS(moves.moves[i]) == flags)
+                return moves.moves[i];
+        }
+        return NO_MOVE;
+    }
+
+    int piece = PAWN;
+    size_t at = 0;
+    if (piece_from_letter(san[0]) != EMPTY)
+        piece = piece_from_letter(san[at++]);
+
+    // read from the end: promotion, then the destination, whatever is left disambiguates
+    int promotion = EMPTY;
+    if (piece == PAWN && length - at >= 3 && piece_from_letter(san[length - 1]) != EMPTY) {
+        promotion = piece_from_letter(san[length - 1]);
+        length -= san[length - 2] == '=' ? 2 : 1;
+    }
+    if (length - at < 2)
+        return NO_MOVE;
+    char file = san[length - 2];
+    char rank = san[length - 1];
+    if (file < 'a' || file > 'h' || rank < '1' || rank > '8')
+        return NO_MOVE;
+    int to = (rank - '1') * 8 + (file - 'a');
+    length -= 2;
+
+    int from_file = -1;
+    int from_rank = -1;
+    if (length > at && san[length - 1] == 'x')
+        length--;
+    for (; at < length; at++) {
+        if (san[at] >= 'a' && san[at] <= 'h')
+            from_file = san[at] - 'a';
+        else if (san[at] >= '1' && san[at] <= '8')
+            from_rank = san[at] - '1';
+        else
+            return NO_MOVE;
+    }
+
+    Move found = NO_MOVE;
+    for (int i = 0; i < moves.count; i++) {
+        Move move = moves.moves[i];
+        int from = MOVE_FROM(move);
+        if (MOVE_TO(move) != to || (piece_at(pos, from) & 7) != piece ||
+            (from_file >= 0 && (from & 7) != from_file) || (from_rank >= 0 && (from >> 3) != from_rank))
+            continue;
+        // a pawn reaching the last rank has to say what it becomes
+        if (IS_PROMOTION(move) ? PROMOTION_PIECE(move) != promotion : promotion != EMPTY)
+            continue;
+        if (found != NO_MOVE)
+            return NO_MOVE;
+        found = move;
+    }
+    return found;
+}
+
+void san_format(const Position* pos, Move move, char out[SAN_MAX_LENGTH]) {
+    int from = MOVE_FROM(move);
+    int to = MOVE_TO(move);
+    int piece = piece_at(pos, from) & 7;
+    int length = 0;
+
+    if (MOVE_FLAGS(move) == KING_CASTLE || MOVE_FLAGS(move) == QUEEN_CASTLE) {
+        const char* castle = MOVE_FLAGS(move) == KING_CASTLE ? "O-O" : "O-O-O";
+        while (castle[length] != '\0') {
+            out[length] = castle[length];
+            length++;
+        }
+    } else if (piece == PAWN) {
+        if (IS_CAPTURE(move)) {
+            out[length++] = (char) ('a' + (from & 7));
+            out[length++] = 'x';
+        }
+    } else {
+        out[length++] = PIECE_LETTERS[piece];
+        // name the file if that tells the pieces apart, else the rank, else both
+        MoveList moves;
+        generate_legal_moves(pos, &moves);
+        bool ambiguous = false;
+        bool same_file = false;
+        bool same_rank = false;
+        for (int i = 0; i < moves.count; i++) {
+            int other = MOVE_FROM(moves.moves[i]);
+            if (other == from || MOVE_TO(moves.moves[i]) != to || (piece_at(pos, other) & 7) != piece)
+                continue;
+            ambiguous = true;
+            same_file |= (other & 7) == (from & 7);
+            same_rank |= (other >> 3) == (from >> 3);
+        }
+        if (ambiguous && (!same_file || same_rank))
+            out[length++] = (char) ('a' + (from & 7));
+        if (ambiguous && same_file)
+            out[length++] = (char) ('1' + (from >> 3));
+        if (IS_CAPTURE(move))
+            out[length++] = 'x';
+    }
+
+    if (MOVE_FLAGS(move) != KING_CASTLE && MOVE_FLAGS(move) != QUEEN_CASTLE) {
+        out[length++] = (char) ('a' + (to & 7));
+        out[length++] = (char) ('1' + (to >> 3));
+        if (IS_PROMOTION(move)) {
+            out[length++] = '=';
+            out[length++] = PIECE_LETTERS[PROMOTION_PIECE(move)];
+        }
+    }
+
+    Position after = *pos;
+    UndoInfo undo;
+    make_move(&after, move, &undo);
+    if (is_in_check(&after)) {
+        MoveList replies;
+        generate_legal_moves(&after, &replies);
+        out[length++] = replies.count == 0 ? '#' : '+';
+    }
+    out[length] = '\0';
+}
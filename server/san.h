@@ -0,0 +1,24 @@
+#ifndef SERVER_SAN_H
+#define SERVER_SAN_H
+
+#include <stddef.h>
+#include "movegen.h"
+
+// longest SAN a move can need, "Qa1xb2=Q+" plus the terminator with room to spare
+#define SAN_MAX_LENGTH 16
+
+/*
+ * Standard algebraic notation as PGN uses it. A move is resolved against the
+ * legal moves of the position, so parsing and legality are one step: a SAN
+ * that names no legal move, or more than one, is refused. Check and mate
+ * marks and the usual !? annotations are accepted and ignored, castling may
+ * be written with letters or zeros.
+ */
+
+// the legal move san names in pos, NO_MOVE if there is none or the notation is ambiguous
+Move san_parse(const Position* pos, const char* san, size_t length);
+
+// writes the SAN of a legal move in pos into out, with as little disambiguation as it needs and a check mark
+void san_format(const Position* pos, Move move, char out[SAN_MAX_LENGTH]);
+
+#endif //SERVER_SAN_H
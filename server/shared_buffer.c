@@ -0,0 +1,19 @@
+#include <stdlib.h>
+#include <string.h>
+#include "shared_buffer.h"
+
+SharedBuffer* shared_buffer_create(const char* data, size_t length) {
+    SharedBuffer* buffer = malloc(sizeof(SharedBuffer) + length);
+    atomic_init(&buffer->references, 1);
+    buffer->length = length;
+    memcpy(buffer->data, data, length);
+    return buffer;
+}
+
+void shared_buffer_release(SharedBuffer* buffer) {
+    if (buffer == nullptr)
+        return;
+    // acquire-release so the thread that frees sees every use made through the other references
+    if (atomic_fetch_sub_explicit(&buffer->references, 1, memory_order_acq_rel) == 1)
+        free(buffer);
+}
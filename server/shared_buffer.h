@@ -0,0 +1,29 @@
+#ifndef SERVER_SHARED_BUFFER_H
+#define SERVER_SHARED_BUFFER_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+
+/*
+ * Immutable bytes with a reference count, for a response that is serialized
+ * once and queued on many connections at the same time. Any thread may take
+ * or drop a reference, whoever drops the last one frees the buffer.
+ */
+typedef struct SharedBuffer {
+    atomic_int references;
+    size_t length;
+    char data[];
+} SharedBuffer;
+
+// copies the bytes into a new buffer, the caller holds its only reference
+SharedBuffer* shared_buffer_create(const char* data, size_t length);
+
+static inline SharedBuffer* shared_buffer_retain(SharedBuffer* buffer) {
+    // taking a reference needs no ordering, the holder's own reference keeps the bytes alive
+    atomic_fetch_add_explicit(&buffer->references, 1, memory_order_relaxed);
+    return buffer;
+}
+
+void shared_buffer_release(SharedBuffer* buffer);
+
+#endif //SERVER_SHARED_BUFFER_H
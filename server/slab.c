@@ -0,0 +1,61 @@
+#include <stdlib.h>
+#include "slab.h"
+
+static bool add_block(Slab* slab);
+
+void slab_init(Slab* slab, size_t objectSize, size_t objectsPerBlock) {
+    // every object starts on its own cache line and is big enough to hold the free list link
+    if (objectSize < sizeof(void*))
+        objectSize = sizeof(void*);
+    slab->objectSize = (objectSize + SLAB_ALIGNMENT - 1) & ~(size_t) (SLAB_ALIGNMENT - 1);
+    slab->objectsPerBlock = objectsPerBlock;
+    slab->blocks = nullptr;
+    slab->freeList = nullptr;
+    slab->live = 0;
+    slab->capacity = 0;
+}
+
+bool add_block(Slab* slab) {
+    char* block = aligned_alloc(SLAB_ALIGNMENT, SLAB_ALIGNMENT + slab->objectSize * slab->objectsPerBlock);
+    if (block == nullptr)
+        return false;
+
+    *(void**) block = slab->blocks;
+    slab->blocks = block;
+
+    // thread the new objects onto the free list back to front so they are handed out in address order
+    for (size_t i = slab->objectsPerBlock; i > 0; i--) {
+        void* object = block + SLAB_ALIGNMENT + (i - 1) * slab->objectSize;
+        *(void**) object = slab->freeList;
+        slab->freeList = object;
+    }
+    slab->capacity += slab->objectsPerBlock;
+    return true;
+}
+
+void* slab_alloc(Slab* slab) {
+    if (slab->freeList == nullptr && !add_block(slab))
+        return nullptr;
+
+    void* object = slab->freeList;
+    slab->freeList = *(void**) object;
+    slab->live++;
+    return object;
+}
+
+void slab_free(Slab* slab, void* object) {
+    *(void**) object = slab->freeList;
+    slab->freeList = object;
+    slab->live--;
+}
+
+void slab_destroy(Slab* slab) {
+    while (slab->blocks != nullptr) {
+        void* next = *(void**) slab->blocks;
+        free(slab->blocks);
+        slab->blocks = next;
+    }
+    slab->freeList = nullptr;
+    slab->live = 0;
+    slab->capacity = 0;
+}
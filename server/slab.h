@@ -0,0 +1,33 @@
+#ifndef SERVER_SLAB_H
+#define SERVER_SLAB_H
+
+#include <stddef.h>
+
+#define SLAB_ALIGNMENT 64
+
+/*
+ * Pool of equally sized, cache-line aligned objects carved out of large
+ * blocks. Freed objects go on a free list and are handed out again before a
+ * new block is allocated, so steady churn never reaches malloc. Not thread
+ * safe, callers keep one pool per lock.
+ */
+typedef struct {
+    size_t objectSize;
+    size_t objectsPerBlock;
+    // blocks are chained through their first cache line
+    void* blocks;
+    void* freeList;
+    size_t live;
+    size_t capacity;
+} Slab;
+
+void slab_init(Slab* slab, size_t objectSize, size_t objectsPerBlock);
+
+void* slab_alloc(Slab* slab);
+
+void slab_free(Slab* slab, void* object);
+
+// releases every block, objects still in use become invalid
+void slab_destroy(Slab* slab);
+
+#endif //SERVER_SLAB_H
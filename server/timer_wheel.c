@@ -0,0 +1,83 @@
+#include "timer_wheel.h"
+
+#define SLOT_MASK (TIMER_WHEEL_SLOTS - 1)
+
+_Static_assert((TIMER_WHEEL_SLOTS & SLOT_MASK) == 0, "TIMER_WHEEL_SLOTS must be a power of two");
+
+static void link_timer(Timer** head, Timer* timer);
+
+void timer_wheel_init(TimerWheel* wheel, time_t now) {
+    for (int i = 0; i < TIMER_WHEEL_SLOTS; i++)
+        wheel->slots[i] = nullptr;
+    wheel->expiring = nullptr;
+    wheel->current = now;
+}
+
+void timer_init(Timer* timer) {
+    timer->expiresAt = 0;
+    timer->head = nullptr;
+    timer->prev = nullptr;
+    timer->next = nullptr;
+}
+
+void link_timer(Timer** head, Timer* timer) {
+    timer->head = head;
+    timer->prev = nullptr;
+    timer->next = *head;
+    if (*head != nullptr)
+        (*head)->prev = timer;
+    *head = timer;
+}
+
+void timer_arm(TimerWheel* wheel, Timer* timer, time_t expiresAt) {
+    // heartbeats re-arm many times a second with the same deadline
+    if (timer->expiresAt == expiresAt && timer->head != nullptr && timer->head != &wheel->expiring)
+        return;
+
+    timer_cancel(timer);
+    timer->expiresAt = expiresAt;
+    // an overdue deadline fires on the next advance
+    time_t slot = expiresAt < wheel->current ? wheel->current : expiresAt;
+    link_timer(&wheel->slots[slot & SLOT_MASK], timer);
+}
+
+void timer_cancel(Timer* timer) {
+    if (timer->head == nullptr)
+        return;
+
+    if (timer->prev != nullptr)
+        timer->prev->next = timer->next;
+    else
+        *timer->head = timer->next;
+    if (timer->next != nullptr)
+        timer->next->prev = timer->prev;
+    timer_init(timer);
+}
+
+void timer_wheel_advance(TimerWheel* wheel, time_t now, void (*expired)(Timer* timer, void* arg), void* arg) {
+    // after a stall longer than a whole turn every slot is due, visiting the last turn covers all of them
+    if (now - wheel->current >= TIMER_WHEEL_SLOTS)
+        wheel->current = now - TIMER_WHEEL_SLOTS + 1;
+
+    while (wheel->current <= now) {
+        Timer** slot = &wheel->slots[wheel->current & SLOT_MASK];
+        wheel->expiring = *slot;
+        *slot = nullptr;
+        for (Timer* timer = wheel->expiring; timer != nullptr; timer = timer->next)
+            timer->head = &wheel->expiring;
+        wheel->current++;
+
+        while (wheel->expiring != nullptr) {
+            Timer* timer = wheel->expiring;
+            time_t expires_at = timer->expiresAt;
+            timer_cancel(timer);
+            if (expires_at > now) {
+                // wrapped around from a later turn
+                timer->expiresAt = expires_at;
+                link_timer(&wheel->slots[expires_at & SLOT_MASK], timer);
+            } else {
+                expired(timer, arg);
+            }
+        }
+    }
+}
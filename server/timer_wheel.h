@@ -0,0 +1,43 @@
+#ifndef SERVER_TIMER_WHEEL_H
+#define SERVER_TIMER_WHEEL_H
+
+#include <time.h>
+
+// one slot per second, deadlines further out wrap around and are skipped until their turn comes
+#define TIMER_WHEEL_SLOTS 64
+
+typedef struct Timer {
+    // 0 while the timer is not armed
+    time_t expiresAt;
+    // list the timer is linked into, so it can be cancelled without knowing its wheel
+    struct Timer** head;
+    struct Timer* prev;
+    struct Timer* next;
+} Timer;
+
+/*
+ * Hashed timer wheel with one second resolution. Arming, re-arming and
+ * cancelling are O(1); advancing only looks at the slots of the seconds that
+ * passed, so idle timers cost nothing until they are due.
+ */
+typedef struct {
+    Timer* slots[TIMER_WHEEL_SLOTS];
+    // timers taken off the slot being expired, callbacks may still cancel them
+    Timer* expiring;
+    // every second before this one has been expired
+    time_t current;
+} TimerWheel;
+
+void timer_wheel_init(TimerWheel* wheel, time_t now);
+
+void timer_init(Timer* timer);
+
+// arms the timer, moving it if it was already armed
+void timer_arm(TimerWheel* wheel, Timer* timer, time_t expiresAt);
+
+void timer_cancel(Timer* timer);
+
+// calls expired for every timer due by now, the callback may arm or cancel any timer including its own
+void timer_wheel_advance(TimerWheel* wheel, time_t now, void (*expired)(Timer* timer, void* arg), void* arg);
+
+#endif //SERVER_TIMER_WHEEL_H
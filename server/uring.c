@@ -0,0 +1,156 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+static int uring_register(Uring* ring, unsigned opcode, void* arg, unsigned count);
+
+int uring_register(Uring* ring, unsigned opcode, void* arg, unsigned count) {
+    return (int) syscall(__NR_io_uring_register, ring->fd, opcode, arg, count);
+}
+
+bool uring_init(Uring* ring, unsigned entries) {
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    // disabled until the loop's own thread enables it, that thread becomes the single issuer
+    params.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN |
+                   IORING_SETUP_R_DISABLED;
+    int fd = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if (fd < 0)
+        return false;
+
+    unsigned required = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_SUBMIT_STABLE | IORING_FEAT_EXT_ARG;
+    if ((params.features & required) != required) {
+        close(fd);
+        errno = ENOSYS;
+        return false;
+    }
+
+    // both rings live in one mapping, the entries in another
+    size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    ring->ringsSize = sq_size > cq_size ? sq_size : cq_size;
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->rings = mmap(nullptr, ring->ringsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                       IORING_OFF_SQ_RING);
+    if (ring->rings == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+    ring->sqes = mmap(nullptr, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                      IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        munmap(ring->rings, ring->ringsSize);
+        close(fd);
+        return false;
+    }
+
+    char* rings = ring->rings;
+    ring->fd = fd;
+    ring->sqHead = (unsigned*) (rings + params.sq_off.head);
+    ring->sqTail = (unsigned*) (rings + params.sq_off.tail);
+    ring->sqMask = *(unsigned*) (rings + params.sq_off.ring_mask);
+    ring->sqEntries = params.sq_entries;
+    ring->sqLocalTail = *ring->sqTail;
+    ring->cqHead = (unsigned*) (rings + params.cq_off.head);
+    ring->cqTail = (unsigned*) (rings + params.cq_off.tail);
+    ring->cqMask = *(unsigned*) (rings + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*) (rings + params.cq_off.cqes);
+
+    // slot i always holds entry i, so the indirection array is filled once
+    unsigned* array = (unsigned*) (rings + params.sq_off.array);
+    for (unsigned i = 0; i < params.sq_entries; i++)
+        array[i] = i;
+    return true;
+}
+
+bool uring_enable(Uring* ring) {
+    return uring_register(ring, IORING_REGISTER_ENABLE_RINGS, nullptr, 0) == 0;
+}
+
+void uring_exit(Uring* ring) {
+    munmap(ring->sqes, ring->sqesSize);
+    munmap(ring->rings, ring->ringsSize);
+    close(ring->fd);
+}
+
+unsigned uring_space(const Uring* ring) {
+    return ring->sqEntries - (ring->sqLocalTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE));
+}
+
+struct io_uring_sqe* uring_get_sqe(Uring* ring) {
+    if (uring_space(ring) == 0)
+        return nullptr;
+    struct io_uring_sqe* sqe = &ring->sqes[ring->sqLocalTail & ring->sqMask];
+    ring->sqLocalTail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int uring_submit(Uring* ring, bool wait, int timeoutMs) {
+    __atomic_store_n(ring->sqTail, ring->sqLocalTail, __ATOMIC_RELEASE);
+    unsigned pending = ring->sqLocalTail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+
+    int result;
+    if (wait) {
+        struct __kernel_timespec timeout = {.tv_sec = timeoutMs / 1000, .tv_nsec = timeoutMs % 1000 * 1000000LL};
+        struct io_uring_getevents_arg arg = {.ts = (unsigned long long) (uintptr_t) &timeout};
+        result = (int) syscall(__NR_io_uring_enter, ring->fd, pending, 1,
+                               IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    } else {
+        result = (int) syscall(__NR_io_uring_enter, ring->fd, pending, 0, 0, nullptr, 0);
+    }
+    return result < 0 ? -errno : result;
+}
+
+struct io_uring_cqe* uring_peek(Uring* ring) {
+    unsigned head = *ring->cqHead;
+    if (head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE))
+        return nullptr;
+    return &ring->cqes[head & ring->cqMask];
+}
+
+void uring_consume(Uring* ring) {
+    __atomic_store_n(ring->cqHead, *ring->cqHead + 1, __ATOMIC_RELEASE);
+}
+
+bool uring_setup_buffers(Uring* ring, UringBuffers* buffers, unsigned count, unsigned size, unsigned short group) {
+    size_t ring_size = count * sizeof(struct io_uring_buf);
+    // the kernel wants the buffer ring page aligned
+    void* buffer_ring = mmap(nullptr, ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffer_ring == MAP_FAILED)
+        return false;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long long) (uintptr_t) buffer_ring;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if (uring_register(ring, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        munmap(buffer_ring, ring_size);
+        return false;
+    }
+
+    buffers->ring = buffer_ring;
+    buffers->memory = malloc((size_t) count * size);
+    buffers->count = count;
+    buffers->size = size;
+    buffers->group = group;
+    for (unsigned i = 0; i < count; i++)
+        uring_provide_buffer(buffers, (unsigned short) i);
+    return true;
+}
+
+void uring_provide_buffer(UringBuffers* buffers, unsigned short id) {
+    // only this thread moves the tail, the kernel only reads it
+    unsigned short tail = buffers->ring->tail;
+    struct io_uring_buf* buffer = &buffers->ring->bufs[tail & (buffers->count - 1)];
+    buffer->addr = (unsigned long long) (uintptr_t) uring_buffer(buffers, id);
+    buffer->len = buffers->size;
+    buffer->bid = id;
+    __atomic_store_n(&buffers->ring->tail, (unsigned short) (tail + 1), __ATOMIC_RELEASE);
+}
@@ -0,0 +1,74 @@
+#ifndef SERVER_URING_H
+#define SERVER_URING_H
+
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+/*
+ * The few io_uring calls the event loop needs, made straight through the
+ * system calls so the server does not depend on liburing. A ring belongs to
+ * the thread that enables it: it is set up single issuer with deferred task
+ * work, so completions are only produced while that thread waits for them,
+ * and it submits every queued entry even past one that fails, which makes
+ * anything an entry points at free to reuse once uring_submit returns.
+ */
+typedef struct {
+    int fd;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    struct io_uring_sqe* sqes;
+    // entries queued by us, published to the kernel on submit
+    unsigned sqLocalTail;
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe* cqes;
+    void* rings;
+    size_t ringsSize;
+    size_t sqesSize;
+} Uring;
+
+// receive buffers the kernel picks from when a recv completes, handed back with uring_provide_buffer
+typedef struct {
+    struct io_uring_buf_ring* ring;
+    char* memory;
+    unsigned count;
+    unsigned size;
+    unsigned short group;
+} UringBuffers;
+
+// creates a disabled ring, false with errno set if the kernel is too old or does not allow it
+bool uring_init(Uring* ring, unsigned entries);
+
+// makes the calling thread the ring's only submitter
+bool uring_enable(Uring* ring);
+
+void uring_exit(Uring* ring);
+
+// free submission entries left before the next submit
+unsigned uring_space(const Uring* ring);
+
+// a zeroed entry to fill in, nullptr when the queue is full
+struct io_uring_sqe* uring_get_sqe(Uring* ring);
+
+// hands every queued entry to the kernel and, if wait is set, waits up to timeoutMs for a completion; -errno on failure
+int uring_submit(Uring* ring, bool wait, int timeoutMs);
+
+// the oldest completion not yet consumed, nullptr when there is none
+struct io_uring_cqe* uring_peek(Uring* ring);
+
+// gives the completion returned by uring_peek back to the kernel
+void uring_consume(Uring* ring);
+
+// count buffers of size bytes each in group, count a power of two
+bool uring_setup_buffers(Uring* ring, UringBuffers* buffers, unsigned count, unsigned size, unsigned short group);
+
+static inline char* uring_buffer(const UringBuffers* buffers, unsigned short id) {
+    return buffers->memory + (size_t) id * buffers->size;
+}
+
+void uring_provide_buffer(UringBuffers* buffers, unsigned short id);
+
+#endif //SERVER_URING_H
@@ -0,0 +1,33 @@
+#include <stddef.h>
+#include "zobrist.h"
+
+ZobristKeys zobrist;
+
+void zobrist_init() {
+    // fixed seed so hashes are stable between runs and can be stored
+    uint64_t seed = 0x5A0B215713C4E5EDULL;
+    uint64_t* keys = (uint64_t*) &zobrist;
+
+    for (size_t i = 0; i < sizeof(ZobristKeys) / sizeof(uint64_t); i++) {
+        seed ^= seed >> 12;
+        seed ^= seed << 25;
+        seed ^= seed >> 27;
+        keys[i] = seed * 0x2545F4914F6CDD1DULL;
+    }
+}
+
+uint64_t position_hash(const Position* pos) {
+    uint64_t hash = 0;
+    for (int sq = 0; sq < 64; sq++) {
+        int piece = pos->squares[sq];
+        if (get_piece_type(piece) != EMPTY)
+            hash ^= zobrist.pieces[get_color(piece)][PIECE_INDEX(get_piece_type(piece))][sq];
+    }
+
+    hash ^= zobrist.castling[pos->castlingRights];
+    hash ^= zobrist_ep(pos->epSquare);
+    if (pos->sideToMove == BLACK)
+        hash ^= zobrist.blackToMove;
+
+    return hash;
+}
@@ -0,0 +1,30 @@
+#ifndef SERVER_ZOBRIST_H
+#define SERVER_ZOBRIST_H
+
+#include <stdint.h>
+#include "bitboard.h"
+
+/*
+ * Random keys xored together into Position.hash. Pieces are folded in by
+ * position_put_piece/position_remove_piece, make_move takes care of the side
+ * to move, the castling rights and the en passant file.
+ */
+typedef struct {
+    uint64_t pieces[2][PIECE_TYPES][64];
+    uint64_t castling[16];
+    uint64_t epFile[8];
+    uint64_t blackToMove;
+} ZobristKeys;
+
+extern ZobristKeys zobrist;
+
+void zobrist_init();
+
+// full recomputation, only needed after building a position from scratch
+uint64_t position_hash(const Position* pos);
+
+static inline uint64_t zobrist_ep(int epSquare) {
+    return epSquare == NO_SQUARE ? 0 : zobrist.epFile[epSquare & 7];
+}
+
+#endif //SERVER_ZOBRIST_H
@@ -1,6 +1,7 @@
 import spriteUrl from "/chess_set.svg?url"
 import {ChessPiece, ChessPieceColor, ChessPieceType} from "./ChessPiece.ts";
 import {
+    DRAW,
     gameEndedHandler,
     InBoundMessageType,
     OutBoundMessageType,
@@ -252,6 +253,6 @@ type MovePieceResponse =
     currentTurn: ChessPieceColor
 } | {
     messageType: InBoundMessageType.GAME_ENDED,
-    winner: ChessPieceColor,
+    winner: ChessPieceColor | typeof DRAW,
     board: number[][]
 }
\ No newline at end of file
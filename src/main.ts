@@ -1,6 +1,6 @@
 import './style.css'
 import Gameboard from "./gameboard.ts";
-import {ChessPieceColor} from "./ChessPiece.ts";
+import {ChessPiece, ChessPieceColor, ChessPieceType} from "./ChessPiece.ts";
 
 const CANVAS_INNER_HTML = `
       <h1 id="colorTurn" class="white-turn">White Turn</h1>
@@ -26,6 +26,8 @@ export enum InBoundMessageType {
     GAME_ENDED,
     PLAYER_DISCONNECTED,
     OPPONENT_DISCONNECTED,
+    GAME_STATE_DELTA,
+    GAME_STATE_UNCHANGED,
 }
 
 export enum OutBoundMessageType {
@@ -41,7 +43,14 @@ export type ServerResponse = {
     playerId: string
 }
 
-let gameStatePollIntervalId: number | null = null
+// bumped whenever polling should stop, so a request still in flight knows it is stale
+let gameStatePollGeneration = 0
+let lastSeenVersion: number | null = null
+// board the last sync drew, version also moves on joins and disconnects that leave the board alone
+let lastPositionHash: string | null = null
+// server board as of syncedVersion, deltas are replayed onto it
+let syncedBoard: number[][] | null = null
+let syncedVersion: number | null = null
 
 let gameID: string | null = null
 let playerID: string | null = null
@@ -62,7 +71,7 @@ function gameJoinHandler(e: SubmitEvent) {
 }
 
 function showGameSelectPage() {
-    gameStatePollIntervalId && clearInterval(gameStatePollIntervalId)
+    stopGameStatePolling()
 
     const changeGameButton = document.getElementById("changeGame")
     if (changeGameButton != null)
@@ -83,7 +92,7 @@ async function connectToGame(gameId: string) {
         const resp = await sendServerRequest<GameJoinResponse>(OutBoundMessageType.JOIN_GAME, {game_id: gameId})
         gameID = resp.gameId
         playerID = resp.playerId
-        gameStatePollIntervalId = setInterval(pollForGameState, 1000)
+        startGameStatePolling()
         if (resp.messageType == InBoundMessageType.WAIT_FOR_OTHER_PLAYER) {
             document.getElementById("app")!.appendChild(document.createTextNode("Waiting for other player..."))
             return
@@ -110,20 +119,37 @@ function showGameBoard(color: ChessPieceColor) {
 }
 
 type GameStateSyncResponse = {
-    messageType: InBoundMessageType.WAIT_FOR_OTHER_PLAYER
+    messageType: InBoundMessageType.WAIT_FOR_OTHER_PLAYER,
+    version: number
 }  | {
     messageType: InBoundMessageType.GAME_STATE_SYNC | InBoundMessageType.GAME_STARTED,
     board: number[][],
     currentTurn: ChessPieceColor,
-    playerColor: ChessPieceColor
+    playerColor: ChessPieceColor,
+    positionHash: string,
+    version: number
 } | {
     messageType: InBoundMessageType.GAME_ENDED,
-    winner: ChessPieceColor,
-    board: number[][]
+    winner: ChessPieceColor | typeof DRAW,
+    board: number[][],
+    version: number
+} | {
+    messageType: InBoundMessageType.GAME_STATE_DELTA,
+    moves: DeltaMove[],
+    currentTurn: ChessPieceColor,
+    positionHash: string,
+    baseVersion: number,
+    version: number
+} | {
+    messageType: InBoundMessageType.GAME_STATE_UNCHANGED,
+    version: number
 } | {
     messageType: InBoundMessageType.OPPONENT_DISCONNECTED,
 }
 
+// fromX, fromY, toX, toY, promotion piece type or 0
+type DeltaMove = [number, number, number, number, ChessPieceType]
+
 export function sendServerRequest<T>(msgType: OutBoundMessageType, data?: object): Promise<ServerResponse & T> {
     const opts = {
         ...FETCH_BASE_OPTS,
@@ -140,34 +166,93 @@ export function sendServerRequest<T>(msgType: OutBoundMessageType, data?: object
     return fetch(URL, opts).then(r => r.json())
 }
 
-async function pollForGameState() {
-    try {
-        const resp = await sendServerRequest<GameStateSyncResponse>(OutBoundMessageType.GAME_STATE_SYNC);
-        if (resp.messageType === InBoundMessageType.WAIT_FOR_OTHER_PLAYER)
-            return
+function startGameStatePolling() {
+    stopGameStatePolling()
+    lastSeenVersion = null
+    lastPositionHash = null
+    syncedBoard = null
+    syncedVersion = null
+    pollForGameState(gameStatePollGeneration)
+}
 
-        if (resp.messageType == InBoundMessageType.GAME_ENDED) {
-            gameboard?.synchronizeBoardState(resp.board)
-            gameEndedHandler(resp.winner)
-            return
-        }
+function stopGameStatePolling() {
+    gameStatePollGeneration++
+}
 
-        if (resp.messageType == InBoundMessageType.OPPONENT_DISCONNECTED) {
-            opponentDisconnectedHandler()
-            return
-        }
+// long-poll: the server holds the request until the game moves past lastSeenVersion
+async function pollForGameState(generation: number) {
+    while (generation === gameStatePollGeneration) {
+        try {
+            const resp = await sendServerRequest<GameStateSyncResponse>(OutBoundMessageType.GAME_STATE_SYNC,
+                lastSeenVersion === null ? {} : {lastSeenVersion})
+            if (generation !== gameStatePollGeneration)
+                return
+
+            if (resp.messageType == InBoundMessageType.OPPONENT_DISCONNECTED) {
+                opponentDisconnectedHandler()
+                return
+            }
 
-        if (gameboard === null) {
-            showGameBoard(resp.playerColor)
-        }
+            if (resp.messageType === InBoundMessageType.GAME_STATE_UNCHANGED)
+                continue
+
+            if (resp.messageType === InBoundMessageType.GAME_STATE_DELTA) {
+                if (syncedBoard === null || resp.baseVersion !== syncedVersion) {
+                    // the moves build on a board we never got, ask for the whole one
+                    lastSeenVersion = null
+                    continue
+                }
+                resp.moves.forEach(move => applyMove(syncedBoard!, move))
+                syncedVersion = lastSeenVersion = resp.version
+                lastPositionHash = resp.positionHash
+                gameboard?.synchronizeBoardState(syncedBoard)
+                updateTurnIndicator(resp.currentTurn)
+                continue
+            }
 
-        gameboard?.synchronizeBoardState(resp.board)
-        updateTurnIndicator(resp.currentTurn)
-    } catch(e) {
-        console.error(e)
+            lastSeenVersion = resp.version
+            if (resp.messageType === InBoundMessageType.WAIT_FOR_OTHER_PLAYER)
+                continue
+
+            if (resp.messageType == InBoundMessageType.GAME_ENDED) {
+                gameboard?.synchronizeBoardState(resp.board)
+                gameEndedHandler(resp.winner)
+                return
+            }
+
+            if (gameboard === null) {
+                showGameBoard(resp.playerColor)
+                lastPositionHash = null
+            }
+
+            syncedBoard = resp.board
+            syncedVersion = resp.version
+            if (resp.positionHash !== lastPositionHash) {
+                lastPositionHash = resp.positionHash
+                gameboard?.synchronizeBoardState(resp.board)
+            }
+            updateTurnIndicator(resp.currentTurn)
+        } catch (e) {
+            console.error(e)
+            await new Promise(resolve => setTimeout(resolve, 1000))
+        }
     }
 }
 
+// replays a move the way the server made it: castling moves the rook too and en passant takes the pawn alongside
+function applyMove(board: number[][], [fromX, fromY, toX, toY, promotion]: DeltaMove) {
+    const piece = ChessPiece.FromValue(board[fromY][fromX])
+    if (piece.Type == ChessPieceType.KING && Math.abs(toX - fromX) == 2) {
+        const rookX = toX > fromX ? 7 : 0
+        board[fromY][(fromX + toX) / 2] = board[fromY][rookX]
+        board[fromY][rookX] = ChessPieceType.EMPTY
+    }
+    if (piece.Type == ChessPieceType.PAWN && fromX != toX && board[toY][toX] == ChessPieceType.EMPTY)
+        board[fromY][toX] = ChessPieceType.EMPTY
+
+    board[toY][toX] = promotion ? ChessPiece.FromTypeAndColor(promotion, piece.Color).Value : piece.Value
+    board[fromY][fromX] = ChessPieceType.EMPTY
+}
 
 export function updateTurnIndicator(color: ChessPieceColor) {
     const colorTurnHTML = document.getElementById("colorTurn") as HTMLElement
@@ -177,24 +262,31 @@ export function updateTurnIndicator(color: ChessPieceColor) {
     colorTurnHTML.innerText = color == ChessPieceColor.WHITE ? "White Turn" : "Black Turn"
 }
 
-export function gameEndedHandler(winner: ChessPieceColor) {
-    gameStatePollIntervalId && clearInterval(gameStatePollIntervalId)
+// winner reported by the server when the game ends in a draw (stalemate, threefold repetition or the fifty-move rule)
+export const DRAW = 2
+
+export function gameEndedHandler(winner: ChessPieceColor | typeof DRAW) {
+    stopGameStatePolling()
     gameboard?.disableInteractivity()
     gameboard = null
 
     const colorTurnHTML = document.getElementById("colorTurn") as HTMLElement
     colorTurnHTML.classList.remove("black-turn")
     colorTurnHTML.classList.remove("white-turn")
-    colorTurnHTML.classList.add(winner == ChessPieceColor.WHITE ? "white-turn" : "black-turn")
-    colorTurnHTML.innerText = winner == ChessPieceColor.WHITE
-    ? "White has won!!!"
-        : "Black has won!!!"
+    if (winner == DRAW) {
+        colorTurnHTML.innerText = "Draw!"
+    } else {
+        colorTurnHTML.classList.add(winner == ChessPieceColor.WHITE ? "white-turn" : "black-turn")
+        colorTurnHTML.innerText = winner == ChessPieceColor.WHITE
+        ? "White has won!!!"
+            : "Black has won!!!"
+    }
 
     sendServerRequest<{}>(OutBoundMessageType.DISCONNECT)
 }
 
 function opponentDisconnectedHandler() {
-gameStatePollIntervalId && clearInterval(gameStatePollIntervalId)
+    stopGameStatePolling()
     gameboard?.disableInteractivity()
     gameboard = null
 